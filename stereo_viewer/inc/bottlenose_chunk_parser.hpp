@@ -67,6 +67,74 @@ typedef struct vector3f{
 
 typedef std::vector<vector3f_t> pointcloud_t;
 
+/**
+ * @brief Frame a set of keypoints or bounding boxes was computed on.
+ */
+typedef enum {
+  FRAME_LEFT_ONLY = 0,   ///< Mono camera, or stereo transmitting only the left image
+  FRAME_RIGHT_ONLY = 1,  ///< Stereo transmitting only the right image
+  FRAME_LEFT_STEREO = 2, ///< Left image of a stereo transmission
+  FRAME_RIGHT_STEREO = 3 ///< Right image of a stereo transmission
+} frame_id_t;
+
+typedef PACKED_STRUCT_BEGIN() {
+  uint16_t x;
+  uint16_t y;
+} PACKED_STRUCT_END() keypoint_t;
+
+typedef std::vector<keypoint_t> keypoints_t;
+
+/**
+ * @brief Layout of the matches chunk. Entries are in the order of the left
+ * keypoints, each refers to the best match in the right image.
+ */
+typedef enum {
+  MATCHES_COORDINATE = 0,          ///< Coordinates of the right keypoint
+  MATCHES_INDEX = 1,               ///< Index of the right keypoint in x
+  MATCHES_COORDINATE_DETAILED = 2, ///< Coordinates of the best two matches with distances
+  MATCHES_INDEX_DETAILED = 3       ///< Indices of the best two matches with distances
+} matches_layout_t;
+
+/**
+ * @brief Entry of the detailed matches layouts.
+ */
+typedef PACKED_STRUCT_BEGIN() {
+  uint16_t x;   ///< Best match
+  uint16_t y;
+  uint16_t x2;  ///< Second best match
+  uint16_t y2;
+  uint16_t d2;  ///< Distance of the second best match
+  uint16_t d1;  ///< Distance of the best match
+  uint16_t n2;
+  uint16_t n1;
+} PACKED_STRUCT_END() match_detailed_t;
+
+/**
+ * @brief Keypoint of the left image and its match in the right image.
+ * Decoded matches only hold pairs with a match.
+ */
+typedef struct {
+  keypoint_t left;
+  keypoint_t right;
+} match_t;
+
+typedef std::vector<match_t> matches_t;
+
+/**
+ * @brief Bounding box of a detected target.
+ */
+typedef PACKED_STRUCT_BEGIN() {
+  uint32_t cid;    ///< Class ID
+  float score;     ///< Detection score
+  uint32_t left;
+  uint32_t top;
+  uint32_t right;
+  uint32_t bottom;
+  char label[24];  ///< Zero terminated class label
+} PACKED_STRUCT_END() bbox_t;
+
+typedef std::vector<bbox_t> bboxes_t;
+
 /**
  * Decode meta information from buffer, if present.
  * @param buffer Buffer received on GEV interface
@@ -79,4 +147,54 @@ std::string ms_to_date_string(uint64_t ms);
 
 bool chunkDecodePointCloud(PvBuffer *buffer, std::vector<vector3f_t>&pointcloud);
 
+/**
+ * Decode keypoints from buffer, if present.
+ * @param buffer Buffer received on GEV interface
+ * @param left Keypoints of the left (or mono) image
+ * @param right Keypoints of the right image
+ * @return True if at least one set of keypoints was decoded
+ */
+bool chunkDecodeKeypoints(PvBuffer *buffer, keypoints_t &left, keypoints_t &right);
+
+/**
+ * Decode stereo matches from buffer, if present. The chunk starts with the
+ * number of entries, the layout and the value marking a left keypoint
+ * without a match as 32-bit values, followed by the entries. Left
+ * keypoints without a match are skipped.
+ * @param buffer Buffer received on GEV interface
+ * @param left Keypoints of the left image, the entries refer to these in order
+ * @param right Keypoints of the right image, the index layouts refer to these
+ * @param matches Decoded matches
+ * @return True if at least one match was decoded
+ */
+bool chunkDecodeMatches(PvBuffer *buffer, const keypoints_t &left, const keypoints_t &right, matches_t &matches);
+
+/**
+ * Decode bounding boxes from buffer, if present.
+ * @param buffer Buffer received on GEV interface
+ * @param boxes Decoded bounding boxes
+ * @param frame_id Frame the boxes were detected on
+ * @return True if bounding boxes were decoded
+ */
+bool chunkDecodeBoundingBoxes(PvBuffer *buffer, bboxes_t &boxes, frame_id_t *frame_id);
+
+/**
+ * Copy all chunks of a buffer without decoding them, for raw recording. Each
+ * chunk is stored as its ID and length, 32-bit little endian, followed by
+ * its data.
+ * @param buffer Buffer received on GEV interface
+ * @param out Serialized chunks, cleared first
+ * @return True if at least one chunk was copied
+ */
+bool chunkCopyAll(PvBuffer *buffer, std::vector<uint8_t> &out);
+
+/**
+ * Look up a chunk in data serialized by chunkCopyAll.
+ * @param chunks Serialized chunks
+ * @param chunkID Chunk to find
+ * @param length Length of the chunk data, may be nullptr
+ * @return Chunk data, nullptr if not present
+ */
+const uint8_t *chunkFind(const std::vector<uint8_t> &chunks, uint32_t chunkID, uint32_t *length);
+
 #endif // __BOTTLENOSE_CHUNK_PARSER_HPP__
\ No newline at end of file
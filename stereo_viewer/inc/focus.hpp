@@ -20,16 +20,39 @@
 #ifndef __FOCUS_HPP__
 #define __FOCUS_HPP__
 
+#include <array>
+#include <cstdint>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
 #include <QImage>
-#include <QPixmap>
+#include <QPainter>
+#include <QRect>
+#include <QTransform>
+#include "ring_buffer.hpp"
+
+#define FOCUS_ZONES_X (16)
+#define FOCUS_ZONES_Y (9)
+#define FOCUS_ZONES (FOCUS_ZONES_X * FOCUS_ZONES_Y)
+#define FOCUS_PEAKING_THRESHOLD (96)
 
 /**
  * Focus class. This class is used to compute the focus value of an image.
  */
 class Focus {
 public:
+  /**
+   * Running sums of the Laplacian and luma over a set of pixels.
+   */
+  struct LumaStats {
+    int64_t sum;
+    uint64_t sum_sq;
+    uint64_t sum_y;
+    uint64_t count;
+
+    double variance() const;
+    double brightness() const;
+  };
+
   /**
    * Constructor
    * @param maxValues Maximum number of focus values to display in image stream.
@@ -39,17 +62,69 @@ public:
   explicit Focus(size_t maxValues = 100, QColor lineColor = Qt::green, size_t lineWidth = 3);
   ~Focus() = default;
   void enable(bool enable);
-  void process(QPixmap &pixmap);
+  bool isEnabled() const { return m_enabled; }
+  /**
+   * Sharpness of the last processed frame.
+   */
+  double value() const { return m_last_values.empty() ? 0 : m_last_values.back(); }
+  double brightness() const { return m_brightness; }
+  /**
+   * Enable the per zone sharpness heatmap.
+   * @param enable Draw the heatmap
+   */
+  void showZones(bool enable);
+  /**
+   * Enable edge peaking, pixels with a strong Laplacian response are highlighted.
+   * @param enable Compute and draw the peaking mask
+   * @param threshold Minimum absolute Laplacian response to highlight
+   */
+  void showPeaking(bool enable, int threshold = FOCUS_PEAKING_THRESHOLD);
+  /**
+   * Compute focus and brightness on the luma of a native resolution frame.
+   * The region is split into FOCUS_ZONES_X x FOCUS_ZONES_Y tiles processed in
+   * parallel, yielding the global value, the zone map and the peaking mask in one pass.
+   * @param yuyv CV_8UC2 YUV422 (YUYV) frame as streamed by the camera
+   * @param roi Region to analyze in frame coordinates, empty for the full frame
+   * @return False if disabled or the region is too small for the tiles, the values are left unchanged
+   */
+  bool process(const cv::Mat &yuyv, const QRect &roi = QRect());
+  /**
+   * Draw the focus annotation.
+   * @param paint Painter of the view
+   * @param area Area the frame is displayed in
+   */
+  void paint(QPainter &paint, const QRectF &area);
+  /**
+   * Draw heatmap and peaking mask on top of the frame.
+   * @param paint Painter of the view
+   * @param transform Frame to widget coordinate transform
+   */
+  void paintMaps(QPainter &paint, const QTransform &transform);
+  /**
+   * Sharpness of each zone of the last frame, row major.
+   */
+  const std::array<double, FOCUS_ZONES> &zones() const { return m_zones; }
+  /**
+   * Area covered by a zone, in frame coordinates.
+   * @param zone Zone index, row major
+   */
+  QRect zoneRect(int zone) const;
 private:
-  static cv::Mat to_mat(const QImage &image);
-  static double focusValue(const cv::Mat &gray);
-  static double averageBrightness(const cv::Mat& gray);
-  void paint(QPixmap &img, double brightness);
+  cv::Rect tileRect(const cv::Rect &interior, int zone) const;
+
   size_t m_maxValues;
   QColor m_lineColor;
   size_t m_lineWidth;
   bool m_enabled;
-  std::vector<double> m_last_values;
+  double m_brightness;
+  RingBuffer<double> m_last_values;
+  bool m_show_zones;
+  bool m_peaking;
+  int m_peaking_threshold;
+  cv::Rect m_region;                        ///< Analyzed region of the last frame
+  std::array<LumaStats, FOCUS_ZONES> m_tiles;
+  std::array<double, FOCUS_ZONES> m_zones;
+  QImage m_peaking_mask;                    ///< Indexed8, 255 marks in-focus edges
 };
 
 #endif // __FOCUS_HPP__
\ No newline at end of file
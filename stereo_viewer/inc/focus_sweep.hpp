@@ -0,0 +1,103 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file focus_sweep.hpp Recording of focus sweeps for lens alignment
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __FOCUS_SWEEP_HPP__
+#define __FOCUS_SWEEP_HPP__
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <QPainter>
+#include <QString>
+#include "focus.hpp"
+
+#define FOCUS_SWEEP_MAX_SAMPLES (18000)  ///< 10 minutes at 30 FPS
+#define FOCUS_SWEEP_HALF_WINDOW (5)      ///< Half width of smoothing and peak fit window, in samples
+
+/**
+ * Records the focus metric of every frame while the focus ring is turned,
+ * tracks the sharpest position seen and how far the current one is from it.
+ */
+class FocusSweep {
+public:
+  struct Sample {
+    uint64_t timestamp;
+    uint32_t count;       ///< Camera frame counter
+    float sharpness;
+    std::array<float, FOCUS_ZONES> zones;
+  };
+  struct Peak {
+    bool valid;
+    double sharpness;     ///< Vertex of the fitted parabola
+    uint64_t timestamp;
+    uint32_t count;
+  };
+
+  /**
+   * @param capacity Number of samples, allocated once on the first sweep
+   */
+  explicit FocusSweep(size_t capacity = FOCUS_SWEEP_MAX_SAMPLES);
+  ~FocusSweep() = default;
+
+  /**
+   * Start a new sweep, previous samples are dropped.
+   */
+  void start();
+  void stop();
+  bool isActive() const { return m_active; }
+  bool isFull() const { return m_size == m_capacity; }
+  size_t size() const { return m_size; }
+  const Sample &sample(size_t i) const { return m_samples[i]; }
+  /**
+   * Record the metric of a frame, ignored if not active or full.
+   * @param timestamp Frame timestamp
+   * @param count Camera frame counter
+   * @param focus Focus state after processing the frame
+   */
+  void add(uint64_t timestamp, uint32_t count, const Focus &focus);
+  /**
+   * Locate the peak. The sharpness curve is smoothed with a moving average,
+   * a parabola is fit around its maximum to refine it between samples.
+   * @return Best focus seen so far
+   */
+  Peak peak() const;
+  /**
+   * Write all samples as CSV, one row per frame with the sharpness of every zone.
+   * @param filename Output file
+   * @return True on success
+   */
+  bool exportCsv(const QString &filename) const;
+  /**
+   * Draw the return to peak indicator.
+   * @param paint Painter of the view
+   * @param area Area the frame is displayed in
+   */
+  void paint(QPainter &paint, const QRectF &area) const;
+
+private:
+  size_t m_capacity;
+  std::vector<Sample> m_samples;
+  size_t m_size;
+  bool m_active;
+  double m_window_sum;     ///< Sharpness sum of the last 2 * FOCUS_SWEEP_HALF_WINDOW + 1 samples
+  double m_best_smoothed;  ///< Largest moving average seen, negative if none yet
+  size_t m_best;           ///< Center sample of that average
+};
+
+#endif // __FOCUS_SWEEP_HPP__
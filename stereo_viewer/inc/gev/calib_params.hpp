@@ -40,6 +40,12 @@ public:
   void setParameters(PvDevice *lDevice);
   bool calibrated(uint32_t width, uint32_t height);
   void getDepthMatrix(cv::Mat &qmat);
+  /**
+   * Projection matrices of the rectified left and right camera.
+   * @param p1 3x4 left projection, empty if not calibrated
+   * @param p2 3x4 right projection, empty if not calibrated
+   */
+  void getProjectionMatrices(cv::Mat &p1, cv::Mat &p2);
 
 private:
   std::map<std::string, float> m_params;
@@ -40,6 +40,13 @@ namespace labforge::gev {
     uint64_t timestamp;
     int32_t min_disparity;
     pointcloud_t pc;
+    keypoints_t kp_left;
+    keypoints_t kp_right;
+    matches_t matches;
+    bboxes_t bboxes;
+    frame_id_t bbox_frame;
+    info_t info;
+    std::vector<uint8_t> chunks;  ///< Serialized chunk data, only while chunks are kept
   };
 
   class Pipeline : public QThread {
@@ -52,6 +59,10 @@ namespace labforge::gev {
     bool Start(bool calibrate, bool stereo);
     void Stop();
     bool IsStarted() { return m_start_flag; }
+    /**
+     * Attach a copy of all chunk data to received frames, for raw recording.
+     */
+    void KeepChunks(bool keep) { m_keep_chunks = keep; }
     size_t GetPairs(std::list<BNImageData> &out);
     void run() override;
 
@@ -75,6 +86,7 @@ namespace labforge::gev {
     std::list<PvBuffer*> m_buffers;
     QQueue<BNImageData> m_images;
     volatile bool m_start_flag;
+    volatile bool m_keep_chunks;
     QMutex m_image_lock;
 
     void enterCalibrationMode(bool enable, bool stereo);
@@ -0,0 +1,197 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file async_writer.hpp Asynchronous positional file writes from a fixed buffer pool
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_ASYNC_WRITER_HPP__
+#define __IO_ASYNC_WRITER_HPP__
+
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#define ASYNC_WRITER_BUFFERS (32)
+#define ASYNC_WRITER_BUFFER_SIZE (4 * 1024 * 1024)
+/**
+ * Offsets, lengths and buffers are aligned to this for unbuffered writes.
+ */
+#define ASYNC_WRITER_ALIGNMENT (4096)
+/**
+ * Writes queued before they are handed to the kernel in one submission.
+ */
+#define ASYNC_WRITER_BATCH (8)
+
+namespace labforge::io {
+
+/**
+ * Positional writes of pooled buffers that complete in the background. The
+ * caller fills a buffer from acquire() and hands it back with write(), the
+ * buffer returns to the pool once the data is written. Short writes are
+ * continued and interrupted writes retried, any other error marks the
+ * writer failed.
+ *
+ * Not thread safe, all calls are expected from a single thread. The
+ * io_uring backend does all I/O from that thread, the fallback backend
+ * writes on a pool of threads.
+ */
+class AsyncWriter {
+public:
+  enum Mode {
+    MODE_CACHED,  ///< Through the page cache
+    MODE_DIRECT,  ///< Bypass the page cache where supported, writes are padded to ASYNC_WRITER_ALIGNMENT
+  };
+  enum SyncPolicy {
+    SYNC_NONE,      ///< Leave it to the operating system
+    SYNC_CLOSE,     ///< Flush each file to disk when closed
+    SYNC_PERIODIC,  ///< Also flush every sync_bytes written to a file
+  };
+  struct Options {
+    Mode mode;
+    SyncPolicy sync;
+    uint64_t sync_bytes;
+    int buffers;
+    size_t buffer_size;  ///< Multiple of ASYNC_WRITER_ALIGNMENT
+  };
+  struct Buffer {
+    uint8_t *data;
+    int index;           ///< Slot in the pool, -1 if the pool could not be allocated
+  };
+  struct Stats {
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t short_writes;
+    uint64_t retries;
+    int in_flight;
+  };
+
+  /**
+   * Create the io_uring backend if built in and supported by the kernel,
+   * the thread pool backend otherwise.
+   */
+  static std::unique_ptr<AsyncWriter> create(const Options &options = defaults());
+  static Options defaults();
+  virtual ~AsyncWriter();
+
+  virtual const char *name() const = 0;
+  /**
+   * Create or truncate a file. MODE_DIRECT falls back to cached writes on
+   * file systems that do not support it.
+   * @param path File
+   * @param preallocate Bytes reserved up front, 0 for none
+   * @return Handle, -1 on error
+   */
+  int open(const QString &path, int64_t preallocate = 0);
+  /**
+   * Wait for the writes to the file, flush it according to the sync policy
+   * and trim it to its final size.
+   * @param file Handle from open
+   * @param size Final size of the file, padding and preallocation beyond are dropped
+   * @return False if a write to the file failed
+   */
+  bool close(int file, int64_t size);
+  /**
+   * Take a free buffer from the pool, waits for a write to complete if all
+   * are in flight.
+   */
+  Buffer acquire();
+  /**
+   * Queue a write, the buffer is owned by the writer until completed.
+   * @param file Handle from open
+   * @param offset Position in the file, aligned in MODE_DIRECT
+   * @param buffer Buffer from acquire
+   * @param length Bytes, padded with zeros to the alignment in MODE_DIRECT
+   * @return Ticket of the write, tickets increase with each write
+   */
+  uint64_t write(int file, int64_t offset, Buffer buffer, size_t length);
+  /**
+   * Hand queued writes to the kernel without waiting.
+   */
+  virtual void submit() = 0;
+  /**
+   * Wait for all writes to complete.
+   */
+  void drain();
+  /**
+   * @return All writes with a ticket up to this one are complete
+   */
+  uint64_t completed();
+  bool failed() const { return m_failed; }
+  const Options &options() const { return m_options; }
+  size_t bufferSize() const { return m_options.buffer_size; }
+  Stats stats();
+
+protected:
+  explicit AsyncWriter(const Options &options);
+
+  struct File;
+  struct Request {
+    std::shared_ptr<File> file;
+    int64_t offset;
+    int buffer;        ///< -1 for a flush of the file to disk
+    size_t length;
+    size_t done;       ///< Bytes written so far, short writes continue from here
+    uint64_t ticket;
+  };
+
+  /**
+   * Start a write of the remaining bytes of a request.
+   */
+  virtual void enqueue(const Request &request) = 0;
+  /**
+   * Handle completed writes, blocking until at least one completes if wait
+   * is set and writes are in flight.
+   */
+  virtual void reap(bool wait) = 0;
+  /**
+   * Called by the backends when a request is written, returns its buffer.
+   */
+  void complete(const Request &request, bool ok);
+  /**
+   * Native handle of an open file, a file descriptor where positional
+   * writes are available.
+   */
+  static int descriptor(const File &file);
+  /**
+   * Blocking positional write of the remaining bytes of a request, continues
+   * short writes and retries interrupted ones.
+   */
+  bool writeAt(Request &request);
+  static bool flush(File &file);
+
+  Options m_options;
+  std::vector<uint8_t *> m_buffers;
+  std::mutex m_lock;                 ///< Guards the pool and bookkeeping below
+  std::condition_variable m_released;
+  std::vector<int> m_free;
+  std::set<uint64_t> m_outstanding;  ///< Tickets in flight
+  std::map<int, std::shared_ptr<File>> m_files;
+  int m_next_file;
+  uint64_t m_next_ticket;
+  uint64_t m_completions;            ///< Requests completed, for waiting on the next one
+  Stats m_stats;
+  volatile bool m_failed;
+};
+
+} // namespace labforge::io
+
+#endif // __IO_ASYNC_WRITER_HPP__
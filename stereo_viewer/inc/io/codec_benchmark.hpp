@@ -0,0 +1,70 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file codec_benchmark.hpp Throughput of the recording codecs
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_CODEC_BENCHMARK_HPP__
+#define __IO_CODEC_BENCHMARK_HPP__
+
+#include <QString>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "io/image_codec.hpp"
+
+#define CODEC_BENCHMARK_MIN_MS (200.0)  ///< Encode time per codec and frame, for stable numbers
+#define CODEC_BENCHMARK_MIN_RUNS (3)
+#define CODEC_BENCHMARK_WIDTH (1920)    ///< Synthetic frames without a stream to take the size from
+#define CODEC_BENCHMARK_HEIGHT (1080)
+
+namespace labforge::io {
+
+struct BenchmarkFrame {
+  QString name;
+  cv::Mat image;      ///< As handed to encodeImage
+};
+
+struct BenchmarkResult {
+  QString frame;
+  QString codec;      ///< Name and level
+  double ms;          ///< Mean encode time of one frame
+  double mb_per_s;    ///< Uncompressed MB encoded per second on one thread
+  double ratio;       ///< Uncompressed over encoded size
+  double fps;         ///< Frames per second all encoders keep up with, excluding the disk
+  bool lossless;      ///< Decoded frame matches the input
+};
+
+/**
+ * Frames with a gradient, hard edges and sensor noise, as BGR, YUYV and
+ * 16-bit disparity.
+ * @param size Width and height, the width is rounded down to an even number
+ */
+std::vector<BenchmarkFrame> syntheticFrames(const cv::Size &size);
+/**
+ * Codecs and levels worth comparing, those not built in are left out.
+ */
+std::vector<CodecSettings> benchmarkCodecs();
+/**
+ * Encode every frame with every codec that takes its layout, on the calling thread.
+ * @param frames Frames to encode
+ * @param encoders Encoder threads the sustainable rate is scaled to
+ */
+std::vector<BenchmarkResult> runCodecBenchmark(const std::vector<BenchmarkFrame> &frames, int encoders);
+bool exportCodecBenchmark(const std::vector<BenchmarkResult> &results, const QString &filename);
+
+} // namespace labforge::io
+
+#endif // __IO_CODEC_BENCHMARK_HPP__
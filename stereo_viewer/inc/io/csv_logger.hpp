@@ -0,0 +1,71 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file csv_logger.hpp Row based CSV logging of per frame measurements
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_CSV_LOGGER_HPP__
+#define __IO_CSV_LOGGER_HPP__
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+
+namespace labforge::io {
+
+/**
+ * Buffered CSV writer. Values are streamed one at a time and a row is
+ * terminated by endRow(), the header is written on open.
+ */
+class CsvLogger {
+public:
+  CsvLogger() : m_first(true) {}
+  ~CsvLogger() { close(); }
+
+  /**
+   * Create or truncate a log file.
+   * @param filename Output file
+   * @param columns Column names of the header row
+   * @return True if the file was opened
+   */
+  bool open(const QString &filename, const QStringList &columns);
+  void close();
+  bool isOpen() const { return m_file.isOpen(); }
+  QString fileName() const { return m_file.fileName(); }
+
+  template<typename T>
+  CsvLogger &operator<<(const T &value) {
+    if(!m_first)
+      m_stream << ',';
+    m_stream << value;
+    m_first = false;
+    return *this;
+  }
+  /**
+   * Terminate the current row.
+   */
+  void endRow();
+
+private:
+  QFile m_file;
+  QTextStream m_stream;
+  bool m_first;          ///< No value written in the current row yet
+};
+
+} // namespace labforge::io
+
+#endif // __IO_CSV_LOGGER_HPP__
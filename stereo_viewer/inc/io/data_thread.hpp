@@ -26,6 +26,11 @@
 #include <cstdint>
 #include <QVector>
 #include <QPair>
+#include <QByteArray>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
 #include "inc/bottlenose_chunk_parser.hpp"
@@ -33,6 +38,14 @@
 #ifndef __IO_DATA_THREAD_HPP__
 #define __IO_DATA_THREAD_HPP__
 
+/**
+ * Default memory for frames waiting to be encoded and written, divided into
+ * slots of the size of the first frame recorded.
+ */
+#define DATA_THREAD_MEMORY_BUDGET (1024LL * 1024 * 1024)
+#define DATA_THREAD_MIN_SLOTS (2)
+#define DATA_THREAD_MAX_SLOTS (256)
+
 namespace labforge::io {
 enum ImageDataType {
     IMTYPE_IO,  ///< single image
@@ -45,14 +58,75 @@ enum ImageDataType {
 
 struct ImageData
 {
+    uint64_t sequence;  ///< Submission order
     uint64_t timestamp;
     QImage left;
     QImage right;
     QString format;
-    cv::Mat disparity;
+    cv::Mat disparity;       ///< 16-bit disparity, empty if none
+    cv::Mat confidence;      ///< 16-bit confidence, empty if none
     int32_t min_disparity;
     pointcloud_t pc;
+    std::vector<cv::Vec3b> pc_colors;  ///< RGB per point of pc, empty to sample the left image
     ImageDataType imtype;
+    bool colormapped;        ///< Also save left and right as colormapped where they show disparity or confidence
+    bool pointclouds;        ///< Save the sparse and dense point clouds as PLY
+};
+
+/**
+ * Storage of one pending frame, allocated once and reused for the frames
+ * passing through it.
+ */
+struct FrameSlot
+{
+    ImageData data;      ///< Images refer to the storage below while the slot is in use
+    QImage left;
+    QImage right;
+    cv::Mat disparity;
+    cv::Mat confidence;
+};
+
+/**
+ * What process() does when all slots are in use.
+ */
+enum QueuePolicy {
+    QUEUE_BLOCK,        ///< Wait for a slot, holds up the caller
+    QUEUE_DROP_OLDEST,  ///< Replace the oldest frame not yet being encoded
+    QUEUE_DROP_NEWEST,  ///< Drop the frame passed in
+};
+
+/**
+ * Destination of an encoded file, selects the subfolder and file prefix.
+ */
+enum OutputStream {
+    OUTPUT_LEFT,
+    OUTPUT_RIGHT,
+    OUTPUT_DISPARITY,
+    OUTPUT_CONFIDENCE,
+    OUTPUT_POINTCLOUD,
+    OUTPUT_DISPARITY_COLOR,
+    OUTPUT_CONFIDENCE_COLOR,
+    OUTPUT_COUNT
+};
+
+struct EncodedFile
+{
+    OutputStream stream;
+    QString ext;
+    QByteArray data;
+};
+
+/**
+ * Files of one frame encoded in memory, waiting to be written in order.
+ */
+struct EncodedFrame
+{
+    uint64_t sequence;
+    uint64_t timestamp;
+    QVector<EncodedFile> files;
+    double encode_ms;
+    int slot;           ///< Released once written, -1 if none
+    bool skipped;       ///< Dropped from the queue, the writer only advances past it
 };
 
 
@@ -64,16 +138,62 @@ public:
     DataThread(QObject *parent = nullptr);
     ~DataThread();
 
-    void process(uint64_t timestamp, const QImage &left,
+    /**
+     * Recording throughput, for display.
+     */
+    struct Stats {
+        int pending;       ///< Frames queued, encoding or waiting to be written
+        int capacity;      ///< Slots, pending frames before the queue policy applies
+        int encoders;
+        double encode_ms;  ///< Smoothed encode time of a frame on one encoder
+        uint64_t written;
+        uint64_t dropped;  ///< Sum of dropped_oldest and dropped_newest
+        uint64_t dropped_oldest;
+        uint64_t dropped_newest;
+        uint64_t blocked;  ///< Frames that waited for a slot
+        double blocked_ms; ///< Total time waited
+        size_t slot_bytes; ///< Memory of one slot
+    };
+
+    /**
+     * Queue a frame for saving. Frames are encoded in parallel and written
+     * in the order they were queued. Disparity and confidence are saved
+     * losslessly as 16-bit PNG, left and right are only used for them if
+     * colormapped output is enabled.
+     *
+     * Everything is copied into a free slot, once none is left the queue
+     * policy applies.
+     * @param disparity 16-bit disparity, also used for point cloud export, may be empty
+     * @param confidence 16-bit confidence, may be empty
+     * @param pc Sparse point cloud
+     * @param pc_colors RGB per point of pc, empty if the points carry no color
+     * @return False if the frame was dropped because encoding falls behind
+     */
+    bool process(uint64_t timestamp, const QImage &left,
                  const QImage &right, QString format,
-                 const uint16_t *raw, int32_t,
-                 const pointcloud_t &pc);
+                 const cv::Mat &disparity, const cv::Mat &confidence, int32_t,
+                 const pointcloud_t &pc,
+                 const std::vector<cv::Vec3b> &pc_colors = {});
     void setImageDataType(ImageDataType imtype);
+    /**
+     * Save the colormapped disparity and confidence images next to the 16-bit values.
+     */
+    void setColormapped(bool colormapped);
+    /**
+     * Save point clouds, skipped while the disk does not keep up.
+     */
+    void setPointClouds(bool enabled);
+    /**
+     * Memory for pending frames, applies once no frame is pending.
+     */
+    void setMemoryBudget(size_t bytes);
+    void setQueuePolicy(QueuePolicy policy);
     bool setFolder(QString new_folder);
     void setStereoDisparity(bool is_stereo, bool is_disparity);
     void stop();
 
     void setDepthMatrix(cv::Mat& qmat);
+    Stats stats();
 signals:
     void dataReceived();
     void dataProcessed();
@@ -82,24 +202,62 @@ protected:
     void run() override;
 
 private:
+    void encodeLoop();
+    static EncodedFrame encode(const ImageData &imdata, const cv::Mat &matQ);
+    /**
+     * Divide the budget into slots sized for a frame like this one, called
+     * with the lock held and no slot in use.
+     */
+    void allocateSlots(const QImage &left, const QImage &right, const cv::Mat &disparity,
+                       const cv::Mat &confidence, size_t points);
+    /**
+     * Take a slot according to the queue policy, called with the lock held.
+     * @return Slot, -1 if the frame is dropped
+     */
+    int acquireSlot();
+    void releaseSlot(int slot);
+
     QMutex m_mutex;
-    QWaitCondition m_condition;
+    QWaitCondition m_condition;       ///< Signals queued frames to the encoders
+    QWaitCondition m_done_condition;  ///< Signals encoded frames to the writer
+    QWaitCondition m_slot_condition;  ///< Signals released slots to a blocked process()
+    std::vector<std::thread> m_encoders;
+    std::map<uint64_t, EncodedFrame> m_done;
+    uint64_t m_next_sequence;
+    uint64_t m_next_write;            ///< Sequence of the next frame to write
+    double m_encode_ms;
+    uint64_t m_written;
+    uint64_t m_dropped_oldest;
+    uint64_t m_dropped_newest;
+    uint64_t m_blocked;
+    double m_blocked_ms;
+
+    std::vector<std::unique_ptr<FrameSlot>> m_slots;
+    std::vector<int> m_free;
+    size_t m_budget;
+    size_t m_slot_bytes;
+    bool m_replan;                    ///< Reallocate the slots once none is in use
+    QueuePolicy m_policy;
 
     QString m_folder;
     QString m_left_subfolder;
     QString m_right_subfolder;
     QString m_disparity_subfolder;
     QString m_pc_subfolder;
-    QQueue<ImageData> m_queue;
+    QQueue<int> m_queue;              ///< Slots waiting to be encoded
     uint64_t m_frame_counter;
     QString m_left_fname;
     QString m_right_fname;
     QString m_disparity_fname;
     QString m_conf_fname;
+    QString m_disparity_color_fname;
+    QString m_conf_color_fname;
     QString m_pc_fname;
 
     bool m_abort;
     ImageDataType m_imtype;
+    bool m_colormapped;
+    bool m_pointclouds;
     cv::Mat m_matQ;
 };
 }
@@ -0,0 +1,95 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file image_codec.hpp Still image codecs used for recording
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_IMAGE_CODEC_HPP__
+#define __IO_IMAGE_CODEC_HPP__
+
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#define IMAGE_CODEC_MAGIC "BNIM"
+
+namespace labforge::io {
+
+enum ImageCodec {
+  CODEC_BMP,
+  CODEC_PNG,
+  CODEC_JPEG,
+  CODEC_PPM,
+  CODEC_QOI,   ///< Quite OK Image format, fast lossless RGB
+  CODEC_ZSTD,  ///< Any pixel layout behind a RawImageHeader, built with libzstd
+  CODEC_LZ4,   ///< Any pixel layout behind a RawImageHeader, built with liblz4
+  CODEC_COUNT
+};
+
+struct CodecSettings {
+  ImageCodec codec;
+  int level;   ///< PNG compression, JPEG quality or zstd level, -1 for the default
+};
+
+/**
+ * Leads zstd and LZ4 files, followed by the compressed rows of the image.
+ */
+struct RawImageHeader {
+  char magic[4];
+  uint32_t width;
+  uint32_t height;
+  int32_t type;        ///< OpenCV type, e.g. CV_8UC2 for YUYV or CV_16UC1 for disparity
+  uint32_t codec;      ///< ImageCodec
+  uint32_t reserved;
+  uint64_t size;       ///< Uncompressed bytes
+};
+static_assert(sizeof(RawImageHeader) == 32, "RawImageHeader is stored on disk");
+
+/**
+ * Parse a format key of the format selection, e.g. "PNG", "PNG1" for PNG
+ * at compression level 1, "JPG", "QOI" or "ZSTD".
+ */
+CodecSettings parseCodec(const QString &format);
+/**
+ * @return File extension without the dot
+ */
+const char *codecExtension(ImageCodec codec);
+const char *codecName(ImageCodec codec);
+bool codecLossless(ImageCodec codec);
+/**
+ * @return False if the codec was not built in
+ */
+bool codecAvailable(ImageCodec codec);
+
+/**
+ * Encode an image in memory.
+ * @param image CV_8UC1, CV_8UC3 (BGR), CV_8UC4 (BGRA, alpha is dropped),
+ *              CV_16UC1 for PNG, zstd and LZ4, CV_8UC2 (YUYV) for zstd and LZ4
+ * @param settings Codec
+ * @param out Encoded file
+ * @return False if the codec does not take this image or is not available
+ */
+bool encodeImage(const cv::Mat &image, const CodecSettings &settings, std::vector<uint8_t> &out);
+/**
+ * Decode a file written by encodeImage, as BGR for the 8-bit color codecs.
+ */
+bool decodeImage(const uint8_t *data, size_t size, ImageCodec codec, cv::Mat &out);
+
+} // namespace labforge::io
+
+#endif // __IO_IMAGE_CODEC_HPP__
@@ -0,0 +1,111 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file pretrigger_ring.hpp In-memory history of raw frames ahead of a trigger
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_PRETRIGGER_RING_HPP__
+#define __IO_PRETRIGGER_RING_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "io/raw_session.hpp"
+
+/**
+ * Memory reserved for the history, the oldest frames are overwritten
+ * once it is used up even if they are within the requested span.
+ */
+#define PRETRIGGER_MEMORY_BUDGET (2048LL * 1024 * 1024)
+/**
+ * Frames tracked at most, independent of their size.
+ */
+#define PRETRIGGER_MAX_FRAMES (4096)
+
+namespace labforge::io {
+
+/**
+ * Keeps the most recent raw frames, images and chunk data, in one block of
+ * memory reserved up front. Frames are copied in back to back and the
+ * oldest are overwritten once the span or the memory is exceeded, pushing
+ * a frame does not allocate.
+ *
+ * Not thread safe.
+ */
+class PreTriggerRing {
+public:
+  PreTriggerRing();
+
+  /**
+   * Reserve the memory, touches every page so the first pass does not fault.
+   * @param seconds Span of frames kept, by their real time
+   * @param budget Bytes reserved
+   * @return False if the memory could not be reserved
+   */
+  bool allocate(int seconds, size_t budget = PRETRIGGER_MEMORY_BUDGET);
+  void release();
+  bool isAllocated() const { return !m_memory.empty(); }
+  void clear();
+  /**
+   * Copy a frame in, overwriting the oldest ones as needed.
+   * @return False if the frame alone is larger than the ring
+   */
+  bool push(const RawFrame &frame);
+  size_t size() const { return m_count; }
+  size_t bytes() const { return m_used; }
+  /**
+   * @return Milliseconds between the oldest and the newest frame
+   */
+  uint64_t span() const;
+  /**
+   * Look at a frame without copying, valid until the next push.
+   * @param i Frame, 0 is the oldest
+   * @param out Frame, images reference the ring and chunks is left empty
+   * @param chunks Set to the chunk data in the ring
+   * @param chunk_size Bytes of chunk data
+   */
+  void frame(size_t i, RawFrame &out, const uint8_t **chunks, size_t *chunk_size) const;
+
+private:
+  struct Slot {
+    uint64_t counter;
+    uint64_t real_time;
+    int32_t min_disparity;
+    RawFormat formats[2];
+    int rows[2];
+    int cols[2];
+    int types[2];
+    size_t offset;       ///< Start in m_memory
+    size_t sizes[RAW_SESSION_PAYLOADS];
+    size_t total;        ///< Bytes reserved for the frame, including padding
+  };
+  const Slot &slot(size_t i) const { return m_slots[(m_head + i) % m_slots.size()]; }
+  void pop();
+
+  std::vector<uint8_t> m_memory;
+  std::vector<Slot> m_slots;
+  uint64_t m_span_ms;
+  size_t m_head;     ///< Oldest slot
+  size_t m_count;
+  size_t m_begin;    ///< Offset of the oldest frame
+  size_t m_end;      ///< Offset past the newest frame
+  size_t m_used;
+};
+
+} // namespace labforge::io
+
+#endif // __IO_PRETRIGGER_RING_HPP__
@@ -0,0 +1,319 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file raw_session.hpp Append-only container for unencoded recordings
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_RAW_SESSION_HPP__
+#define __IO_RAW_SESSION_HPP__
+
+#include <QFile>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "io/async_writer.hpp"
+
+#define RAW_SESSION_MAGIC "BNRAWIDX"
+#define RAW_SESSION_VERSION (1)
+/**
+ * Segment files are preallocated to this size, a new segment is started
+ * when the next payload does not fit.
+ */
+#define RAW_SESSION_SEGMENT_SIZE (1024LL * 1024 * 1024)
+/**
+ * Payload offsets are aligned for unbuffered writes.
+ */
+#define RAW_SESSION_ALIGNMENT (4096)
+/**
+ * Payloads per frame, the left and right part followed by the chunk data.
+ */
+#define RAW_SESSION_PAYLOADS (3)
+#define RAW_SESSION_CHUNKS (2)  ///< Payload holding the chunk data
+/**
+ * Frames waiting to be written before new ones are dropped.
+ */
+#define RAW_SESSION_MAX_PENDING (64)
+/**
+ * Period the index is synced to the disk with, it is flushed to the
+ * operating system after every completed frame.
+ */
+#define RAW_SESSION_INDEX_SYNC_MS (1000)
+
+namespace labforge::io {
+
+enum RawFormat : uint16_t {
+  RAW_FORMAT_NONE = 0,        ///< Payload not present
+  RAW_FORMAT_YUYV = 1,        ///< YUV422 8-bit, CV_8UC2
+  RAW_FORMAT_DISPARITY = 2,   ///< 16-bit disparity, see proc/disparity.hpp
+  RAW_FORMAT_CONFIDENCE = 3,  ///< 16-bit confidence
+  RAW_FORMAT_CHUNKS = 4,      ///< GEV chunks serialized by chunkCopyAll
+};
+
+/**
+ * Location of one payload, stored in the index.
+ */
+struct RawPayload {
+  uint64_t offset;     ///< Byte offset in the segment
+  uint32_t size;       ///< Bytes
+  uint16_t format;     ///< RawFormat
+  uint16_t segment;
+  uint16_t width;      ///< Pixels, 0 for chunks
+  uint16_t height;
+  uint32_t reserved;
+};
+static_assert(sizeof(RawPayload) == 24, "RawPayload is stored on disk");
+
+/**
+ * Index record of one frame, the index is a header followed by these.
+ */
+struct RawIndexEntry {
+  uint64_t counter;         ///< Frame counter of the camera
+  uint64_t real_time;       ///< Milliseconds since epoch
+  int32_t min_disparity;
+  uint32_t reserved;
+  RawPayload payloads[RAW_SESSION_PAYLOADS];
+};
+static_assert(sizeof(RawIndexEntry) == 96, "RawIndexEntry is stored on disk");
+
+struct RawIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;      ///< sizeof(RawIndexEntry) of the writer
+  uint64_t segment_size;
+};
+static_assert(sizeof(RawIndexHeader) == 24, "RawIndexHeader is stored on disk");
+
+/**
+ * Frame as received.
+ */
+struct RawFrame {
+  uint64_t counter;
+  uint64_t real_time;
+  int32_t min_disparity;
+  RawFormat formats[2];
+  cv::Mat images[2];            ///< Left and right part, empty if not present
+  std::vector<uint8_t> chunks;  ///< Serialized chunk data, may be empty
+};
+
+/**
+ * Writes a session folder holding the index and numbered segment files.
+ * Payloads are appended back to back without encoding through an
+ * AsyncWriter. The index entry of a frame is held back until its payloads
+ * completed and flushed with it, an interrupted session stays readable
+ * up to the last entry that reached the disk.
+ */
+class RawSessionWriter {
+public:
+  RawSessionWriter();
+  ~RawSessionWriter() { close(); }
+
+  /**
+   * Create a session.
+   * @param folder Session folder, created if missing
+   * @param segment_size Preallocated size of each segment file
+   * @return True if the index and the first segment were created
+   */
+  bool open(const QString &folder, int64_t segment_size = RAW_SESSION_SEGMENT_SIZE);
+  /**
+   * Flush the index and trim the last segment to its used size.
+   */
+  void close();
+  bool isOpen() const { return m_index.isOpen(); }
+  bool append(const RawFrame &frame) { return append(frame, frame.chunks.data(), frame.chunks.size()); }
+  /**
+   * Append a frame whose chunk data is held elsewhere, frame.chunks is ignored.
+   */
+  bool append(const RawFrame &frame, const uint8_t *chunks, size_t chunk_size);
+  uint64_t frames() const { return m_frames; }
+  uint64_t bytes() const { return m_bytes; }
+  /**
+   * @return Name of the write backend, empty while closed
+   */
+  const char *backend() const { return m_io ? m_io->name() : ""; }
+
+private:
+  bool nextSegment();
+  bool closeSegment();
+  bool writePayload(RawFormat format, const uint8_t *data, size_t size, int width, int height, RawPayload &out);
+  /**
+   * Write the index entries whose payloads completed.
+   */
+  bool writeIndex();
+
+  QString m_folder;
+  QFile m_index;
+  std::unique_ptr<AsyncWriter> m_io;
+  int m_segment;            ///< Handle of the current segment in m_io, -1 if none
+  uint64_t m_last_ticket;   ///< Last write of the current frame
+  std::deque<std::pair<uint64_t, RawIndexEntry>> m_entries;  ///< Waiting for their payloads
+  std::chrono::steady_clock::time_point m_index_synced;
+  int64_t m_segment_size;
+  int m_segment_number;
+  int64_t m_offset;         ///< Write position in the current segment
+  uint64_t m_frames;
+  uint64_t m_bytes;
+  std::vector<uint8_t> m_staging;  ///< Non-continuous images are packed here first
+};
+
+/**
+ * Random access to a session written by RawSessionWriter. The index is
+ * loaded on open, lookups by counter or time are binary searches and
+ * assume both increase through the session.
+ */
+class RawSessionReader {
+public:
+  RawSessionReader();
+  ~RawSessionReader() { close(); }
+
+  bool open(const QString &folder);
+  void close();
+  size_t size() const { return m_entries.size(); }
+  const RawIndexEntry &entry(size_t i) const { return m_entries[i]; }
+  /**
+   * @return First frame with a counter not below counter, size() if none
+   */
+  size_t findFrame(uint64_t counter) const;
+  /**
+   * @return First frame taken at or after real_time, size() if none
+   */
+  size_t findTime(uint64_t real_time) const;
+  /**
+   * Read the left or right part of a frame.
+   * @param i Frame
+   * @param part 0 for left, 1 for right
+   * @param out CV_8UC2 or CV_16UC1 image
+   * @return False if the part is not present or could not be read
+   */
+  bool readImage(size_t i, int part, cv::Mat &out);
+  /**
+   * Read the chunk data of a frame, decode with chunkFind.
+   */
+  bool readChunks(size_t i, std::vector<uint8_t> &out);
+
+private:
+  bool readPayload(const RawPayload &payload, uint8_t *out);
+
+  QString m_folder;
+  std::vector<RawIndexEntry> m_entries;
+  std::map<uint16_t, std::unique_ptr<QFile>> m_segments;
+};
+
+class PreTriggerRing;
+
+/**
+ * Writes raw frames to a session on its own thread, the caller only copies
+ * the frame.
+ *
+ * When armed, frames are kept in a PreTriggerRing instead, without touching
+ * the disk. A trigger opens the session, the thread writes the history
+ * first and continues with the frames queued since.
+ */
+class RawRecorder : public QThread {
+public:
+  struct Stats {
+    int pending;
+    int capacity;
+    uint64_t written;
+    uint64_t dropped;
+    uint64_t bytes;
+    bool failed;     ///< Writing failed, further frames are dropped
+    const char *backend;
+    bool armed;      ///< Waiting for a trigger
+    size_t buffered; ///< Frames in the history, while armed or being written
+    uint64_t buffered_ms;
+    size_t buffered_bytes;
+  };
+
+  RawRecorder(QObject *parent = nullptr);
+  ~RawRecorder();
+
+  /**
+   * Start a new session.
+   * @param folder Session folder
+   * @return False if the session could not be created
+   */
+  bool open(const QString &folder);
+  /**
+   * Keep a history of frames until trigger() is called, the memory is
+   * reserved here.
+   * @param seconds Span of the history
+   * @return False if the memory could not be reserved
+   */
+  bool arm(int seconds);
+  /**
+   * Start the session of an armed recorder, the history becomes its first frames.
+   * @param folder Session folder
+   * @return False if not armed or the session could not be created
+   */
+  bool trigger(const QString &folder);
+  /**
+   * Write the remaining frames and close the session, or drop the history
+   * if still armed.
+   */
+  void close();
+  /**
+   * @return True if frames are accepted, armed or recording
+   */
+  bool isOpen();
+  bool isArmed();
+  /**
+   * Queue a frame, or add it to the history while armed. The images are
+   * copied so they may reference stream buffers.
+   * @return False if the frame was dropped because writing falls behind,
+   *         or the session failed
+   */
+  bool process(const RawFrame &frame);
+  Stats stats();
+
+protected:
+  void run() override;
+
+private:
+  /**
+   * Write the history to the session, called by the thread after a trigger.
+   */
+  void flush();
+
+  QMutex m_mutex;
+  QWaitCondition m_condition;
+  QWaitCondition m_drained;
+  QQueue<RawFrame> m_queue;
+  RawSessionWriter m_writer;  ///< Only used by the thread while a session is open
+  std::unique_ptr<PreTriggerRing> m_ring;  ///< Filled by process() while armed, read by the thread once triggered
+  bool m_open;
+  bool m_armed;
+  bool m_flushing;            ///< The thread is writing the history
+  bool m_writing;             ///< A dequeued frame is being written
+  bool m_failed;
+  bool m_abort;
+  uint64_t m_dropped;
+  uint64_t m_written;
+  uint64_t m_bytes;
+};
+
+} // namespace labforge::io
+
+#endif // __IO_RAW_SESSION_HPP__
@@ -0,0 +1,140 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file recording_scheduler.hpp Adapts recordings to the bandwidth and space of the disk
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_RECORDING_SCHEDULER_HPP__
+#define __IO_RECORDING_SCHEDULER_HPP__
+
+#include <QString>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#define RECORDING_PROBE_BYTES (128LL * 1024 * 1024)     ///< Written and synced once per recording
+#define RECORDING_PROBE_BLOCK (4 * 1024 * 1024)
+#define RECORDING_RESERVE_BYTES (1024LL * 1024 * 1024)  ///< Free space left when recording stops
+#define RECORDING_UPDATE_MS (1000)     ///< Period update() is expected to be called with
+#define RECORDING_ESCALATE_MS (3000)   ///< Sustained pressure before degrading one more level
+#define RECORDING_RELAX_MS (20000)     ///< Sustained headroom before restoring one level
+#define RECORDING_HIGH_FILL (0.75)     ///< Queue occupancy counted as pressure
+#define RECORDING_LOW_FILL (0.25)      ///< Queue occupancy counted as headroom
+#define RECORDING_HIGH_LOAD (0.9)      ///< Share of the probed bandwidth counted as pressure
+#define RECORDING_LOW_LOAD (0.6)       ///< Share of the probed bandwidth counted as headroom
+
+namespace labforge::io {
+
+/**
+ * Degradation steps, each one includes the ones before.
+ */
+enum RecordingLevel {
+  RECORD_FULL,            ///< As configured
+  RECORD_NO_POINTCLOUD,   ///< PLY files are skipped
+  RECORD_FAST_CODEC,      ///< Lowest effort of the selected format, e.g. PNG level 1
+  RECORD_HALF_RATE,       ///< Every second frame
+  RECORD_QUARTER_RATE,    ///< Every fourth frame
+  RECORD_LEVEL_COUNT
+};
+
+/**
+ * Watches the destination of a recording. The sustained write bandwidth
+ * of the folder is probed once in the background, the rate it fills at
+ * and the time until it is full follow from its free space. When the
+ * queue of the recorder backs up, frames are dropped or the data rate
+ * nears the probed bandwidth, recording degrades one level at a time and
+ * recovers once there is headroom again.
+ */
+class RecordingScheduler {
+public:
+  /**
+   * Queue of the active recorder.
+   */
+  struct Sample {
+    int pending;
+    int capacity;
+    uint64_t dropped;   ///< Total so far
+  };
+  struct Stats {
+    RecordingLevel level;
+    double probe_mb_s;       ///< Sustained write bandwidth, 0 until probed, negative if the probe failed
+    double write_mb_s;       ///< Rate the folder fills at
+    uint64_t free_bytes;
+    double seconds_to_full;  ///< Until the reserve is reached at the current rate, negative if not filling
+    double fill;             ///< Queue occupancy
+    uint64_t changes;        ///< Level changes
+    bool full;               ///< Reserve reached, recording should stop
+  };
+
+  RecordingScheduler();
+  ~RecordingScheduler();
+
+  /**
+   * Start watching a folder and probe its bandwidth.
+   * @param folder Destination of the recording
+   * @param adaptive Degrade recording under pressure, otherwise only report
+   */
+  void start(const QString &folder, bool adaptive);
+  void stop();
+  bool isActive() const { return m_active; }
+  void setAdaptive(bool adaptive);
+  /**
+   * Take a sample of the recorder and the folder.
+   * @return True if the level changed
+   */
+  bool update(const Sample &sample);
+  /**
+   * Called once per frame to be recorded.
+   * @return False if the frame is skipped at the current level
+   */
+  bool admit();
+  /**
+   * Format key to record with at the current level.
+   */
+  QString format(const QString &selected) const;
+  bool pointClouds() const { return m_level < RECORD_NO_POINTCLOUD; }
+  RecordingLevel level() const { return m_level; }
+  Stats stats() const;
+  static const char *levelName(RecordingLevel level);
+
+private:
+  void probe(QString folder);
+
+  bool m_active;
+  bool m_adaptive;
+  RecordingLevel m_level;
+  QString m_folder;
+  std::thread m_probe;
+  std::atomic<double> m_probe_mb_s;
+  std::atomic<bool> m_cancel;  ///< Ends a running probe early
+
+  std::chrono::steady_clock::time_point m_last_update;
+  uint64_t m_free_bytes;
+  bool m_free_known;         ///< The folder reported its free space
+  bool m_rebase;             ///< Free space of the last sample included the probe
+  double m_write_mb_s;       ///< Smoothed
+  double m_fill;
+  uint64_t m_dropped;
+  double m_pressure_ms;      ///< Time pressure was seen without a break
+  double m_headroom_ms;      ///< Time headroom was seen without a break
+  uint64_t m_changes;
+  uint64_t m_frames;         ///< Frames passed to admit()
+};
+
+} // namespace labforge::io
+
+#endif // __IO_RECORDING_SCHEDULER_HPP__
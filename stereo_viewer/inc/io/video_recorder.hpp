@@ -0,0 +1,106 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file video_recorder.hpp Recording of output streams into video containers
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __IO_VIDEO_RECORDER_HPP__
+#define __IO_VIDEO_RECORDER_HPP__
+
+#include <QImage>
+#include <QString>
+#include <cstdint>
+#include <memory>
+#include <opencv2/core.hpp>
+#include "io/data_thread.hpp"
+
+/**
+ * Frames of one stream waiting to be encoded before new ones are dropped.
+ */
+#define VIDEO_STREAM_SLOTS (8)
+/**
+ * Nominal rate stored in the containers, the actual time of each frame is
+ * in the timestamp sidecar.
+ */
+#define VIDEO_RECORDER_FPS (30.0)
+
+namespace labforge::io {
+
+enum VideoCodec {
+  VIDEO_NONE,
+  VIDEO_FFV1,   ///< Lossless, Matroska, keeps 16-bit disparity and confidence
+  VIDEO_MJPEG,  ///< AVI, for previews
+  VIDEO_H264,   ///< MP4, for previews
+};
+
+class VideoStream;
+
+/**
+ * Writes each output stream of a recording into its own container next to
+ * a CSV sidecar holding the frame counter and real time of every frame.
+ * Streams are created on their first frame and each encodes on its own
+ * thread, the caller only copies the image.
+ *
+ * 16-bit streams are only kept with FFV1, as 16-bit grayscale where
+ * OpenCV supports it and otherwise packed into the blue (low byte) and
+ * green (high byte) channel of a "_packed" file.
+ */
+class VideoRecorder {
+public:
+  struct Stats {
+    int streams;
+    int pending;        ///< Frames waiting on all streams
+    uint64_t written;   ///< Frames written on all streams
+    uint64_t dropped;
+    bool failed;        ///< A container could not be opened
+  };
+
+  VideoRecorder();
+  ~VideoRecorder();
+
+  /**
+   * @param folder Folder of the session, created if missing
+   * @param codec Codec of all streams
+   * @return False if the folder could not be created
+   */
+  bool open(const QString &folder, VideoCodec codec);
+  /**
+   * Encode the remaining frames and close the containers.
+   */
+  void close();
+  bool isOpen() const { return m_codec != VIDEO_NONE; }
+  bool isLossless() const { return m_codec == VIDEO_FFV1; }
+  /**
+   * Queue a frame of a stream.
+   * @param image RGB32 or Grayscale8 view, converted otherwise
+   * @return False if dropped
+   */
+  bool write(OutputStream stream, uint64_t counter, uint64_t real_time, const QImage &image);
+  /**
+   * @param image CV_16UC1 values or a CV_8UC1, CV_8UC3 (BGR) or CV_8UC4 (BGRA) image
+   */
+  bool write(OutputStream stream, uint64_t counter, uint64_t real_time, const cv::Mat &image);
+  Stats stats();
+
+private:
+  QString m_folder;
+  VideoCodec m_codec;
+  std::unique_ptr<VideoStream> m_streams[OUTPUT_COUNT];
+};
+
+} // namespace labforge::io
+
+#endif // __IO_VIDEO_RECORDER_HPP__
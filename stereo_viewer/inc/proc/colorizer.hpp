@@ -0,0 +1,95 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file colorizer.hpp Disparity colorization with percentile auto-range
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_COLORIZER_HPP__
+#define __PROC_COLORIZER_HPP__
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <QImage>
+#include <opencv2/core.hpp>
+
+namespace labforge::proc {
+
+/**
+ * Colorizes raw 16-bit disparity (or confidence) images through a lookup table.
+ * The histogram of each frame is collected in the same pass and yields robust
+ * percentile bounds, smoothed across frames, that are used for the next frame.
+ */
+class DisparityColorizer {
+public:
+  /**
+   * @param low Lower percentile of valid pixels mapped to the first color
+   * @param high Upper percentile of valid pixels mapped to the last color
+   * @param smoothing Weight of the newest frame when updating the bounds (0, 1]
+   */
+  explicit DisparityColorizer(double low = 0.01, double high = 0.99, double smoothing = 0.2);
+  ~DisparityColorizer() = default;
+
+  /**
+   * Set the OpenCV colormap to use.
+   * @param colormap cv::ColormapTypes value
+   */
+  void setColormap(int colormap);
+  /**
+   * Fix the display range, values outside the range are blanked.
+   * @param mindisp Lower bound in raw units / DISPARITY_SCALE, 0 for automatic
+   * @param maxdisp Upper bound in raw units / DISPARITY_SCALE, 0 for automatic
+   */
+  void setOverride(int mindisp, int maxdisp);
+  /**
+   * Forget the range learned from previous frames, e.g. on stream restart.
+   */
+  void reset();
+  /**
+   * Colorize a frame.
+   * @param raw CV_16UC1 image
+   * @param out Output image, reallocated only if size or format does not match
+   *            or if the buffer is shared
+   */
+  void process(const cv::Mat &raw, QImage &out);
+
+  uint16_t lower() const { return m_lut_lower; }
+  uint16_t upper() const { return m_lut_upper; }
+
+private:
+  void updateRange();
+  void updateLut();
+
+  double m_low;
+  double m_high;
+  double m_smoothing;
+  int m_colormap;
+  uint32_t m_override_min;     ///< Raw lower bound, 0 if automatic
+  uint32_t m_override_max;     ///< Raw upper bound, 0 if automatic
+  bool m_initialized;          ///< Smoothed bounds hold a valid range
+  double m_lower;              ///< Smoothed lower percentile, raw units
+  double m_upper;              ///< Smoothed upper percentile, raw units
+  uint16_t m_lut_lower;        ///< Range m_lut was built for
+  uint16_t m_lut_upper;
+  bool m_lut_dirty;
+  std::vector<uint32_t> m_histogram;
+  std::vector<QRgb> m_lut;     ///< Raw value to color
+  std::array<QRgb, 256> m_palette;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_COLORIZER_HPP__
@@ -0,0 +1,88 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file depth_stats.hpp Disparity and depth statistics over a region of interest
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_DEPTH_STATS_HPP__
+#define __PROC_DEPTH_STATS_HPP__
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * Raw disparity values per histogram bin, 16 raw units are 1/16 of a pixel.
+ */
+#define DEPTH_STATS_BIN_SHIFT (4)
+
+namespace labforge::proc {
+
+/**
+ * Statistics of one frame, disparities in pixels. Depths are in calibration
+ * units and 0 if uncalibrated, nearest is the depth of the largest disparity.
+ */
+struct DepthStats {
+  cv::Rect roi;
+  int pixels;
+  int valid;
+  float ratio;      ///< Valid pixels over all pixels in the ROI
+  float min;
+  float median;
+  float max;
+  float nearest;
+  float depth;      ///< Depth of the median disparity
+  float farthest;
+};
+
+/**
+ * Live measurement of raw disparity in a region of interest. The median is
+ * taken from a histogram so the cost is linear in the ROI size, rows are
+ * accumulated in parallel bands.
+ */
+class DepthStatistics {
+public:
+  DepthStatistics();
+  ~DepthStatistics() = default;
+
+  void setEnabled(bool enable) { m_enabled = enable; }
+  bool isEnabled() const { return m_enabled; }
+  /**
+   * @param qmat 4x4 reprojection matrix from CalibParams, empty if uncalibrated
+   */
+  void setDepthMatrix(const cv::Mat &qmat);
+  /**
+   * Measure one frame.
+   * @param raw CV_16UC1 raw disparity
+   * @param roi Region to measure, clipped to the frame, empty for the full frame
+   * @param min_disparity Minimum disparity configured on the camera
+   * @return Statistics, overwritten by the next call
+   */
+  const DepthStats &process(const cv::Mat &raw, const cv::Rect &roi, int32_t min_disparity);
+  const DepthStats &stats() const { return m_stats; }
+
+private:
+  bool m_enabled;
+  cv::Mat m_q;
+  std::vector<uint32_t> m_histogram;  ///< Allocated once, (DISPARITY_INVALID >> DEPTH_STATS_BIN_SHIFT) + 1 bins
+  std::mutex m_lock;                  ///< Guards m_histogram while merging bands
+  DepthStats m_stats;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_DEPTH_STATS_HPP__
@@ -0,0 +1,75 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file disparity.hpp Encoding of the disparity images streamed by Bottlenose
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_DISPARITY_HPP__
+#define __PROC_DISPARITY_HPP__
+
+#include <cmath>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+/**
+ * Raw value marking pixels without a disparity estimate.
+ */
+#define DISPARITY_INVALID (65535)
+
+/**
+ * Raw disparity values are fixed point, raw = (disparity - min_disparity) * DISPARITY_SCALE.
+ */
+#define DISPARITY_SCALE (255)
+
+namespace labforge::proc {
+
+/**
+ * Check if a raw disparity value carries a valid estimate.
+ * @param raw Raw 16-bit disparity
+ * @return True if valid
+ */
+inline bool isValidDisparity(uint16_t raw) {
+  return raw != DISPARITY_INVALID;
+}
+
+/**
+ * Convert a raw disparity value into pixels.
+ * @param raw Raw 16-bit disparity
+ * @param min_disparity Minimum disparity configured on the camera
+ * @return Disparity in pixels
+ */
+inline float toPixels(uint16_t raw, int32_t min_disparity) {
+  return static_cast<float>(raw) / DISPARITY_SCALE + min_disparity;
+}
+
+/**
+ * Depth of a disparity, the Z coordinate reprojectImageTo3D would produce.
+ * @param qmat 4x4 CV_64F reprojection matrix from CalibParams::getDepthMatrix
+ * @param disparity Disparity in pixels
+ * @return Depth in calibration units, 0 if uncalibrated or not in front of the camera
+ */
+inline float toDepth(const cv::Mat &qmat, float disparity) {
+  if(qmat.empty() || disparity <= 0)
+    return 0;
+  const double w = qmat.at<double>(3, 2) * disparity + qmat.at<double>(3, 3);
+  if(w == 0)
+    return 0;
+  return static_cast<float>(std::abs(qmat.at<double>(2, 3) / w));
+}
+
+} // namespace labforge::proc
+
+#endif // __PROC_DISPARITY_HPP__
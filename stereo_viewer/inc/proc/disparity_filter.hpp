@@ -0,0 +1,114 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file disparity_filter.hpp Post-processing of raw disparity images
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_DISPARITY_FILTER_HPP__
+#define __PROC_DISPARITY_FILTER_HPP__
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#define SPECKLE_TILES_X (4)
+#define SPECKLE_TILES_Y (4)
+
+namespace labforge::proc {
+
+/**
+ * Optional clean-up of raw 16-bit disparity, see disparity.hpp for the encoding.
+ * Stages run in order speckle removal, hole filling, median and operate on
+ * a preallocated copy, the input is never modified.
+ */
+class DisparityFilter {
+public:
+  /**
+   * Cost of the stages of the last frame in milliseconds, 0 if disabled.
+   */
+  struct Timings {
+    double speckle;
+    double holes;
+    double median;
+  };
+
+  DisparityFilter();
+  ~DisparityFilter() = default;
+
+  /**
+   * Invalidate small connected segments. Segments are grown over 4-neighbours
+   * that differ by at most max_diff. The frame is split into tiles processed
+   * in parallel, segments touching a tile border are kept.
+   * @param enable Enable the stage
+   * @param max_size Largest segment in pixels that is removed
+   * @param max_diff Largest difference within a segment, in disparity pixels
+   */
+  void setSpeckle(bool enable, int max_size = 200, int max_diff = 1);
+  /**
+   * Fill short runs of invalid pixels along scanlines with the farther
+   * (smaller) of the two bounding disparities.
+   * @param enable Enable the stage
+   * @param max_width Longest run in pixels that is filled
+   */
+  void setHoleFill(bool enable, int max_width = 16);
+  /**
+   * Median filter, invalid pixels take part as the largest value.
+   * @param enable Enable the stage
+   * @param ksize Aperture, 3 or 5 for 16-bit data
+   */
+  void setMedian(bool enable, int ksize = 5);
+
+  bool isEnabled() const { return m_speckle || m_holes || m_median; }
+  bool speckleEnabled() const { return m_speckle; }
+  bool holeFillEnabled() const { return m_holes; }
+  bool medianEnabled() const { return m_median; }
+
+  /**
+   * Run all enabled stages.
+   * @param raw CV_16UC1 disparity
+   * @return Filtered disparity sharing an internal buffer that is overwritten
+   *         by the next call, or raw if no stage is enabled
+   */
+  cv::Mat apply(const cv::Mat &raw);
+  const Timings &timings() const { return m_timings; }
+
+private:
+  struct Scratch {
+    std::vector<uint8_t> visited;
+    std::vector<cv::Point> stack;
+    std::vector<cv::Point> segment;
+  };
+
+  void removeSpeckles(cv::Mat &disp);
+  void fillHoles(cv::Mat &disp) const;
+
+  bool m_speckle;
+  int m_speckle_size;
+  int m_speckle_diff;    ///< Raw units
+  bool m_holes;
+  int m_hole_width;
+  bool m_median;
+  int m_median_ksize;
+
+  cv::Mat m_output;
+  cv::Mat m_scratch;
+  std::vector<Scratch> m_tiles;
+  Timings m_timings;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_DISPARITY_FILTER_HPP__
@@ -0,0 +1,97 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file exposure.hpp Per frame exposure analytics on raw luma
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_EXPOSURE_HPP__
+#define __PROC_EXPOSURE_HPP__
+
+#include <array>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+#define EXPOSURE_ZONES_X (8)
+#define EXPOSURE_ZONES_Y (6)
+#define EXPOSURE_ZONES (EXPOSURE_ZONES_X * EXPOSURE_ZONES_Y)
+#define EXPOSURE_CLIP_LEVEL (250)   ///< Luma at or above is counted as clipped highlight
+#define EXPOSURE_CRUSH_LEVEL (5)    ///< Luma at or below is counted as crushed shadow
+
+namespace labforge::proc {
+
+/**
+ * Exposure statistics of a single frame.
+ */
+struct ExposureStats {
+  std::array<uint32_t, 256> histogram;      ///< Luma histogram
+  std::array<float, EXPOSURE_ZONES> zones;  ///< Mean luma per zone, row major
+  double mean;                              ///< Mean luma
+  double clipped;                           ///< Percentage of clipped highlights
+  double crushed;                           ///< Percentage of crushed shadows
+  uint64_t count;                           ///< Number of pixels
+
+  /**
+   * Luma value below which a fraction of the pixels fall.
+   * @param fraction Fraction in [0, 1]
+   * @return Luma percentile
+   */
+  int percentile(double fraction) const;
+};
+
+/**
+ * Computes histogram, zone means and clipping of the luma channel of a raw
+ * YUYV frame. Zones are analyzed in parallel, each in a single vectorized pass.
+ */
+class ExposureAnalyzer {
+public:
+  ExposureAnalyzer();
+  ~ExposureAnalyzer() = default;
+
+  /**
+   * Analyze a frame.
+   * @param yuyv CV_8UC2 YUV422 (YUYV) frame
+   * @return Statistics of the frame, valid until the next call
+   */
+  const ExposureStats &process(const cv::Mat &yuyv);
+  const ExposureStats &stats() const { return m_stats; }
+
+  /**
+   * Relative brightness difference between two sensors.
+   * @param left Statistics of the left sensor
+   * @param right Statistics of the right sensor
+   * @return (left - right) / average in percent, 0 if both are black
+   */
+  static double mismatch(const ExposureStats &left, const ExposureStats &right);
+
+  /**
+   * Statistics of one zone, accumulated independently of the others.
+   */
+  struct Tile {
+    std::array<uint32_t, 256> histogram;
+    uint64_t sum;
+    uint64_t clipped;
+    uint64_t crushed;
+    uint64_t count;
+  };
+
+private:
+  std::array<Tile, EXPOSURE_ZONES> m_tiles;
+  ExposureStats m_stats;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_EXPOSURE_HPP__
@@ -0,0 +1,112 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file obstacles.hpp Ground plane and obstacle detection on raw disparity
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_OBSTACLES_HPP__
+#define __PROC_OBSTACLES_HPP__
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#define OBSTACLE_MAX_DISPARITY (256)   ///< Columns of the V-disparity histogram
+#define OBSTACLE_SECTORS (16)          ///< Vertical image stripes reporting a nearest obstacle
+#define OBSTACLE_MIN_PIXELS (64)       ///< Obstacle pixels needed in a sector to report it
+#define OBSTACLE_RANSAC_ITERATIONS (64)
+#define OBSTACLE_GROUND_TOLERANCE (1.5f)  ///< Distance of a V-disparity cell to the ground line, in pixels
+#define OBSTACLE_MIN_SLOPE (0.02f)        ///< Flatter lines are vertical structures, not ground
+
+namespace labforge::proc {
+
+/**
+ * Detection results of one frame.
+ */
+struct ObstacleResult {
+  bool ground;                              ///< Ground line found
+  float slope;                              ///< Ground disparity = slope * row + offset
+  float offset;
+  float horizon;                            ///< Row where the ground reaches zero disparity
+  int pixels;                               ///< Obstacle pixels in the frame
+  float disparity[OBSTACLE_SECTORS];        ///< Nearest obstacle per sector in pixels, 0 if none
+  float depth[OBSTACLE_SECTORS];            ///< Nearest obstacle per sector in calibration units, 0 if none or uncalibrated
+  int top[OBSTACLE_SECTORS];                ///< Rows covered by obstacle pixels per sector
+  int bottom[OBSTACLE_SECTORS];
+  cv::Mat mask;                             ///< CV_8UC1, 255 on obstacle pixels
+  double timing;                            ///< Cost in milliseconds
+};
+
+/**
+ * Near field obstacle detection. Each frame a V-disparity histogram (disparity
+ * counts per image row) is built in parallel row bands, the ground shows up
+ * as a slanted line in it that is fitted with RANSAC. Pixels closer than the
+ * ground at their row are obstacles, their nearest distance is reported per
+ * vertical sector of the image.
+ */
+class ObstacleDetector {
+public:
+  ObstacleDetector();
+  ~ObstacleDetector() = default;
+
+  void setEnabled(bool enable) { m_enabled = enable; }
+  bool isEnabled() const { return m_enabled; }
+  /**
+   * @param qmat 4x4 reprojection matrix from CalibParams, empty if uncalibrated
+   */
+  void setDepthMatrix(const cv::Mat &qmat);
+  bool hasDepth() const { return !m_q.empty(); }
+  /**
+   * @param margin Disparity in pixels a point has to exceed the ground by
+   * @param max_range Farthest obstacle reported in calibration units, 0 for no limit.
+   *                  Only used if calibrated
+   */
+  void setLimits(float margin, float max_range);
+  /**
+   * Analyze one frame.
+   * @param raw CV_16UC1 raw disparity
+   * @param min_disparity Minimum disparity configured on the camera
+   * @return Results, overwritten by the next call
+   */
+  const ObstacleResult &process(const cv::Mat &raw, int32_t min_disparity);
+  const ObstacleResult &result() const { return m_result; }
+
+private:
+  struct Cell {
+    float row;
+    float disparity;
+    int count;
+  };
+  bool fitGround(int rows, int cols);
+  void markObstacles(const cv::Mat &raw, int32_t min_disparity);
+  float disparity(float depth) const;
+
+  bool m_enabled;
+  float m_margin;
+  float m_max_range;
+  cv::Mat m_q;
+  cv::Mat m_vdisp;             ///< CV_32SC1, rows x OBSTACLE_MAX_DISPARITY
+  std::vector<Cell> m_cells;   ///< Candidate ground cells
+  cv::RNG m_rng;
+  std::mutex m_lock;           ///< Guards the sector histograms while merging bands
+  std::vector<int> m_sectors;  ///< OBSTACLE_SECTORS x OBSTACLE_MAX_DISPARITY obstacle counts
+  ObstacleResult m_result;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_OBSTACLES_HPP__
@@ -0,0 +1,120 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file rectification.hpp Rectification quality monitor from stereo matches
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_RECTIFICATION_HPP__
+#define __PROC_RECTIFICATION_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include "bottlenose_chunk_parser.hpp"
+#include "ring_buffer.hpp"
+
+#define RECTIFICATION_WINDOW (300)      ///< Frames averaged for the recent offset and spread
+#define RECTIFICATION_RANGE (32)        ///< Larger vertical offsets in pixels are treated as mismatches
+#define RECTIFICATION_MIN_MATCHES (16)  ///< Frames with fewer matches are skipped
+
+namespace labforge::proc {
+
+/**
+ * Constant memory quantile estimate of an unbounded stream, P-square
+ * algorithm by Jain and Chlamtac.
+ */
+class StreamingQuantile {
+public:
+  /**
+   * @param p Quantile to estimate in (0, 1)
+   */
+  explicit StreamingQuantile(double p);
+  ~StreamingQuantile() = default;
+
+  void reset();
+  void add(double x);
+  double value() const;
+  size_t count() const { return m_count; }
+
+private:
+  double m_p;
+  double m_q[5];   ///< Marker heights
+  double m_n[5];   ///< Marker positions
+  double m_np[5];  ///< Desired marker positions
+  double m_dn[5];  ///< Desired position increments
+  size_t m_count;
+};
+
+/**
+ * Rectification quality of the latest frame and its history. Offsets are
+ * y_left - y_right of matched keypoints, zero for a perfectly rectified rig.
+ */
+struct RectificationStats {
+  int matches;          ///< Matches within RECTIFICATION_RANGE
+  int outliers;         ///< Matches beyond RECTIFICATION_RANGE
+  float bias;           ///< Mean offset of the frame
+  float p50;            ///< Quantiles of the absolute offset in the frame
+  float p95;
+  float session_p50;    ///< Streaming quantiles of the absolute offset since reset
+  float session_p95;
+  float baseline;       ///< Streaming median offset since reset
+  float drift;          ///< Mean offset of the recent window minus baseline
+  float spread;         ///< Mean p95 of the recent window
+  bool degraded;        ///< Spread or drift above the threshold
+};
+
+/**
+ * Continuous monitor of the vertical offset between matched keypoints. Each
+ * frame costs one pass over its matches, the history is kept in constant
+ * memory so it can run for the whole session.
+ */
+class RectificationMonitor {
+public:
+  RectificationMonitor();
+  ~RectificationMonitor() = default;
+
+  /**
+   * @param threshold Spread or drift in pixels that flags degraded rectification
+   */
+  void setThreshold(float threshold) { m_threshold = threshold; }
+  void reset();
+  /**
+   * Add the matches of one frame.
+   * @param matches Pairs of left and right keypoints, as decoded with unmatched entries dropped
+   * @return True if the frame had enough matches and stats() was updated
+   */
+  bool process(const matches_t &matches);
+  const RectificationStats &stats() const { return m_stats; }
+  /**
+   * @return True once at least one frame was measured
+   */
+  bool isValid() const { return !m_bias.empty(); }
+
+private:
+  float m_threshold;
+  uint32_t m_histogram[RECTIFICATION_RANGE + 1];  ///< Absolute offsets of the current frame
+  StreamingQuantile m_session_p50;
+  StreamingQuantile m_session_p95;
+  StreamingQuantile m_baseline;
+  RingBuffer<float> m_bias;
+  RingBuffer<float> m_spread;
+  double m_bias_sum;    ///< Sums over the windows
+  double m_spread_sum;
+  RectificationStats m_stats;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_RECTIFICATION_HPP__
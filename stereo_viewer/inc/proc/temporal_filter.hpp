@@ -0,0 +1,76 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file temporal_filter.hpp Recursive temporal filtering of raw disparity
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_TEMPORAL_FILTER_HPP__
+#define __PROC_TEMPORAL_FILTER_HPP__
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+namespace labforge::proc {
+
+/**
+ * Exponential moving average of disparity over time. The weight of a new
+ * sample scales with its confidence, a change larger than the motion gate
+ * restarts the pixel from the new sample. Invalid samples invalidate the
+ * history of a pixel, nothing is held over from earlier frames.
+ */
+class TemporalFilter {
+public:
+  TemporalFilter();
+  ~TemporalFilter() = default;
+
+  void setEnabled(bool enable);
+  bool isEnabled() const { return m_enabled; }
+  /**
+   * @param strength Weight of a full confidence sample in (0, 1]
+   */
+  void setStrength(double strength);
+  /**
+   * @param gate Largest change in disparity pixels still considered noise
+   */
+  void setMotionGate(double gate);
+  /**
+   * Drop the history, the next frame is taken as is.
+   */
+  void reset();
+  /**
+   * Blend a frame into the history.
+   * @param disparity CV_16UC1 raw disparity
+   * @param confidence CV_16UC1 confidence of the same size, empty to weight all samples fully
+   * @return Filtered disparity, shares the state buffer that is updated by the next call
+   */
+  cv::Mat apply(const cv::Mat &disparity, const cv::Mat &confidence);
+  /**
+   * Cost of the last call in milliseconds.
+   */
+  double timing() const { return m_timing; }
+
+private:
+  bool m_enabled;
+  int m_strength;   ///< Weight of a full confidence sample, 8 bit fixed point
+  int m_gate;       ///< Raw units
+  cv::Mat m_state;  ///< Filtered disparity, allocated once per resolution
+  bool m_valid;     ///< m_state holds a previous frame
+  double m_timing;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_TEMPORAL_FILTER_HPP__
@@ -0,0 +1,97 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file triangulation.hpp Triangulation of stereo matches into a sparse point cloud
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __PROC_TRIANGULATION_HPP__
+#define __PROC_TRIANGULATION_HPP__
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "bottlenose_chunk_parser.hpp"
+
+namespace labforge::proc {
+
+/**
+ * Linear triangulation of matched keypoints with the rectified projection
+ * matrices from CalibParams. Matches are solved four at a time on SIMD lanes
+ * from the normal equations of the DLT system, points behind either camera or
+ * with a reprojection error above the limit are dropped.
+ */
+class Triangulator {
+public:
+  Triangulator();
+  ~Triangulator() = default;
+
+  void setEnabled(bool enable) { m_enabled = enable; }
+  bool isEnabled() const { return m_enabled; }
+  /**
+   * @param p1 3x4 projection of the left camera, empty if uncalibrated
+   * @param p2 3x4 projection of the right camera, empty if uncalibrated
+   */
+  void setProjection(const cv::Mat &p1, const cv::Mat &p2);
+  bool isCalibrated() const { return m_calibrated; }
+  /**
+   * @param max_error Largest reprojection error in pixels, in either image
+   */
+  void setMaxError(float max_error) { m_max_error = max_error; }
+  /**
+   * Triangulate the matches of one frame.
+   * @param matches Matched keypoints
+   * @param left YUV422 left image to color the points, may be empty
+   * @return Number of accepted points
+   */
+  size_t process(const matches_t &matches, const cv::Mat &left);
+
+  const pointcloud_t &points() const { return m_points; }
+  /**
+   * Colors of points(), RGB.
+   */
+  const std::vector<cv::Vec3b> &colors() const { return m_colors; }
+  /**
+   * Index into the processed matches for each of points().
+   */
+  const std::vector<uint32_t> &accepted() const { return m_accepted; }
+  size_t matches() const { return m_count; }
+  /**
+   * Cost of the last call in microseconds.
+   */
+  double timing() const { return m_timing; }
+
+private:
+  void solve(size_t count);
+
+  bool m_enabled;
+  bool m_calibrated;
+  float m_max_error;
+  float m_n[2][12];       ///< Projections in normalized image coordinates, row major
+  float m_focal;          ///< Normalization, pixels are (x - cx) / focal
+  float m_cx;
+  float m_cy;
+  std::vector<float> m_coords[4];    ///< Left x, y and right x, y in normalized coordinates, padded to SIMD width
+  std::vector<float> m_solution[4];  ///< X, Y, Z and squared reprojection error
+  pointcloud_t m_points;
+  std::vector<cv::Vec3b> m_colors;
+  std::vector<uint32_t> m_accepted;
+  size_t m_count;
+  double m_timing;
+};
+
+} // namespace labforge::proc
+
+#endif // __PROC_TRIANGULATION_HPP__
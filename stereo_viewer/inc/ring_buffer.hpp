@@ -0,0 +1,81 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file ring_buffer.hpp Fixed capacity history buffer
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __RING_BUFFER_HPP__
+#define __RING_BUFFER_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Fixed capacity ring buffer. Storage is allocated once, pushing into a full
+ * buffer overwrites the oldest element. Elements are indexed oldest first.
+ */
+template<typename T>
+class RingBuffer {
+public:
+  explicit RingBuffer(size_t capacity) : m_data(capacity), m_start(0), m_size(0) {}
+  ~RingBuffer() = default;
+
+  /**
+   * Append an element, dropping the oldest one if full.
+   * @param value Element to append
+   */
+  void push(const T &value) {
+    if(m_data.empty())
+      return;
+    if(m_size < m_data.size()) {
+      m_data[(m_start + m_size) % m_data.size()] = value;
+      m_size++;
+    } else {
+      m_data[m_start] = value;
+      m_start = (m_start + 1) % m_data.size();
+    }
+  }
+  /**
+   * Fill the whole buffer with a single value.
+   * @param value Value of all elements
+   */
+  void fill(const T &value) {
+    std::fill(m_data.begin(), m_data.end(), value);
+    m_start = 0;
+    m_size = m_data.size();
+  }
+  void clear() {
+    m_start = 0;
+    m_size = 0;
+  }
+
+  const T &operator[](size_t i) const { return m_data[(m_start + i) % m_data.size()]; }
+  T &operator[](size_t i) { return m_data[(m_start + i) % m_data.size()]; }
+  const T &front() const { return (*this)[0]; }
+  const T &back() const { return (*this)[m_size - 1]; }
+  size_t size() const { return m_size; }
+  size_t capacity() const { return m_data.size(); }
+  bool empty() const { return m_size == 0; }
+  bool full() const { return m_size == m_data.size(); }
+
+private:
+  std::vector<T> m_data;
+  size_t m_start;  ///< Index of the oldest element
+  size_t m_size;
+};
+
+#endif // __RING_BUFFER_HPP__
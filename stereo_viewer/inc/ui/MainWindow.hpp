@@ -28,6 +28,7 @@
 #include <PvDevice.h>
 #include <PvStreamGEV.h>
 #include <chrono>
+#include <QFutureWatcher>
 #include <QProgressDialog>
 #include <QPair>
 #include <QtWidgets>
@@ -35,9 +36,26 @@
 #include "ui_stereo_viewer.h"
 #include "gev/pipeline.hpp"
 #include "io/data_thread.hpp"
+#include "io/raw_session.hpp"
+#include "io/video_recorder.hpp"
+#include "io/codec_benchmark.hpp"
+#include "io/recording_scheduler.hpp"
 #include "gev/calib_params.hpp"
 #include "io/file_uploader.hpp"
+#include "ui/render_scheduler.hpp"
+#include "ui/overlay.hpp"
+#include "ui/frame_layout.hpp"
+#include "proc/colorizer.hpp"
+#include "proc/exposure.hpp"
+#include "proc/disparity_filter.hpp"
+#include "proc/temporal_filter.hpp"
+#include "proc/obstacles.hpp"
+#include "proc/depth_stats.hpp"
+#include "proc/triangulation.hpp"
+#include "proc/rectification.hpp"
+#include "io/csv_logger.hpp"
 #include <cstdint>
+#include <functional>
 
 class PvGenBrowserWnd;
 
@@ -55,14 +73,20 @@ public Q_SLOTS:
   void handleConnect();
   void handleDisconnect();
   void handleRecording();
+  /**
+   * Start writing an armed pre-trigger recording, its history first.
+   */
+  void handleTrigger();
   void handleStereoData();
   void handleMonoData();
   void handleError(const QString &msg);
-  void newData(uint64_t timestamp, QImage &left, QImage &right, QPair<QString, QString> &label,
-               bool disparity, uint16_t *raw_disparity, int32_t min_disparity, const pointcloud_t &pc);
+  void renderFrame();
+  void setDisplayRate(int fps);
   void onFolderSelect();
   void handleSave();
   void handleFocus();
+  void handleSweep();
+  void handleAnalytics();
   void handleDeviceControl();
   void setRuler(int value);
   void handleTimeOut();
@@ -70,6 +94,17 @@ public Q_SLOTS:
   void onFileTransferSelect();
   void handleFileUploadError(QString msg);
   void handleFileUploadFinished(bool);
+  /**
+   * Benchmark the recording formats on synthetic frames and the last
+   * received frame in the background.
+   */
+  void handleBenchmark();
+  void showBenchmark();
+  /**
+   * Sample the recording and its destination, adapt to the disk and stop
+   * before it is full.
+   */
+  void updateRecording();
 
 protected:
   void ShowGenWindow( PvGenBrowserWnd *aWnd, PvGenParameterArray *aArray, const QString &aTitle );
@@ -77,7 +112,132 @@ protected:
   bool eventFilter(QObject *obj, QEvent *event) override;
 
 private:
+  /**
+   * Frame converted for display and recording.
+   */
+  struct ConvertedFrame {
+    QImage q1;
+    QImage q2;
+    QPair<QString, QString> label;
+    bool disparity;
+    int disparity_slot;          ///< View showing disparity, -1 if none
+    bool intensity[2];           ///< Views showing camera images
+    cv::Mat raw_disparity;       ///< 16-bit disparity after post-processing, empty if none
+    cv::Mat raw_confidence;      ///< 16-bit confidence, empty if none
+    labforge::io::ImageDataType imtype;
+  };
+  typedef void (MainWindow::*FrameConverter)(const cv::Mat &left, const cv::Mat &right, ConvertedFrame &out);
+  typedef void (MainWindow::*FrameHandler)(const labforge::gev::BNImageData &image);
+  /**
+   * Newest received frame, waiting for the next display tick.
+   */
+  struct StagedFrame {
+    cv::Mat left;
+    cv::Mat right;
+    keypoints_t kp_left;
+    keypoints_t kp_right;
+    bboxes_t bboxes;
+    frame_id_t bbox_frame;
+    FrameConverter convert;
+    ConvertedFrame frame;
+    bool converted;
+  };
+
   bool connectGEV(const PvDeviceInfo *info);
+  bool isRecording() const;
+  /**
+   * Receive images from the pipeline.
+   * @param parts Number of images per frame, for the statistics
+   */
+  void handleData(uint32_t parts);
+  /**
+   * Forward a frame to the handler of its layout, the handler is only looked
+   * up again when the stream layout changes.
+   */
+  void dispatchFrame(const labforge::gev::BNImageData &image);
+  void selectFrameHandler(int left, int right);
+  template<int L, int R>
+  void handleFrame(const labforge::gev::BNImageData &image);
+  /**
+   * Post-process the 16-bit parts of a frame and fill in its layout, leaving
+   * the images for display empty.
+   */
+  template<int L, int R>
+  void prepareFrame(const cv::Mat &left, const cv::Mat &right, ConvertedFrame &out);
+  template<int L, int R>
+  void convertFrame(const cv::Mat &left, const cv::Mat &right, ConvertedFrame &out);
+  /**
+   * Convert a 16-bit disparity or confidence image for display.
+   * @param raw CV_16UC1 image
+   * @param slot View slot the image is shown in, 0 or 1
+   * @param out Converted image
+   */
+  void convertDisparity(const cv::Mat &raw, int slot, QImage &out);
+  /**
+   * Append exposure statistics of a frame to the analytics log.
+   * @param image Received frame, for timestamp and sensor settings
+   * @param left Statistics of the left sensor, nullptr if not a camera image
+   * @param right Statistics of the right sensor, nullptr if not a camera image
+   */
+  void logExposure(const labforge::gev::BNImageData &image, const labforge::proc::ExposureStats *left,
+                   const labforge::proc::ExposureStats *right);
+  /**
+   * Append obstacle detection results of a frame to the obstacle log.
+   * @param image Received frame, for timestamp and frame counter
+   * @param result Detection results of the frame
+   */
+  void logObstacles(const labforge::gev::BNImageData &image, const labforge::proc::ObstacleResult &result);
+  void logDepth(const labforge::gev::BNImageData &image, const labforge::proc::DepthStats &stats);
+  void logRectification(const labforge::gev::BNImageData &image, const labforge::proc::RectificationStats &stats);
+  void recordData(uint64_t timestamp, const ConvertedFrame &frame, int32_t min_disparity,
+                  const pointcloud_t &pc, const std::vector<cv::Vec3b> &pc_colors = {});
+  /**
+   * Start a raw session in the output folder if raw recording is selected.
+   * @return False if the session could not be created
+   */
+  bool openRawSession();
+  /**
+   * Keep raw frames in memory until triggered.
+   * @return False if the memory could not be reserved
+   */
+  bool armRawSession();
+  void closeRawSession();
+  void startRecordingScheduler();
+  void stopRecordingScheduler();
+  /**
+   * Apply the level of the recording scheduler to the recorders.
+   */
+  void applyRecordingLevel();
+  /**
+   * Start a video session in the output folder if a codec is selected.
+   * @return False if the session could not be created
+   */
+  bool openVideoSession();
+  /**
+   * Queue the views of a converted frame to their video streams.
+   */
+  void recordVideo(const labforge::gev::BNImageData &image, const ConvertedFrame &frame);
+  /**
+   * Queue the received parts and chunks of a frame to the raw session.
+   * @param formats Payload formats of the left and right part
+   */
+  void recordRaw(const labforge::gev::BNImageData &image, const labforge::io::RawFormat formats[2]);
+  /**
+   * Show a converted frame on the views that are visible.
+   * @return Whether the left and the right view got a new image, only those may be annotated
+   */
+  std::pair<bool, bool> displayData(const ConvertedFrame &frame);
+  void annotate(CameraView *view, const keypoints_t &keypoints, const bboxes_t &boxes);
+  void annotateObstacles(CameraView *view);
+  void annotateDepth(CameraView *view);
+  void addOverlayAction(const QString &name, OverlayLayer layer);
+  void addFilterAction(const QString &name, const std::function<void(bool)> &enable);
+  QString filterTimings() const;
+  QString recordingStatus() const;
+  QString schedulerStatus() const;
+  QString triangulationStatus() const;
+  QString rectificationStatus() const;
+  void addFocusAction(const QString &name, void (CameraView::*show)(bool));
 
 
   // Reflect GUI state of connected device
@@ -90,6 +250,9 @@ private:
   volatile bool m_saving;
 
   std::unique_ptr<labforge::io::DataThread> m_data_thread;
+  std::unique_ptr<labforge::io::RawRecorder> m_raw_recorder;  ///< Replaces m_data_thread while a session is open
+  labforge::io::RawFrame m_raw_frame;  ///< Reused for every frame, keeps the chunk buffer allocated
+  std::unique_ptr<labforge::io::VideoRecorder> m_video_recorder;  ///< Replaces m_data_thread while a session is open
   PvGenBrowserWnd *m_device_browser;
 
   //Status counters
@@ -103,6 +266,29 @@ private:
 
   labforge::gev::CalibParams m_calib;
 
+  RenderScheduler m_scheduler;
+  StagedFrame m_staged;
+  FrameHandler m_frame_handler;
+  QPair<int, int> m_frame_layout;   ///< Left and right format m_frame_handler was selected for
+  labforge::proc::DisparityColorizer m_colorizer[2];  ///< Per view slot, ranges differ for disparity and confidence
+  labforge::proc::ExposureAnalyzer m_exposure[2];
+  labforge::proc::DisparityFilter m_disparity_filter;
+  labforge::proc::TemporalFilter m_temporal_filter;  ///< Runs on every received frame, ahead of m_disparity_filter
+  QMenu *m_filter_menu;
+  labforge::io::CsvLogger m_analytics;
+  labforge::proc::ObstacleDetector m_obstacles;
+  labforge::io::CsvLogger m_obstacle_log;
+  labforge::proc::DepthStatistics m_depth_stats;
+  labforge::io::CsvLogger m_depth_log;
+  labforge::proc::Triangulator m_triangulator;  ///< Replaces the point cloud of the camera while enabled
+  labforge::proc::RectificationMonitor m_rectification;  ///< Always on, fed by the matches of every frame
+  labforge::io::CsvLogger m_rectification_log;
+  QFutureWatcher<std::vector<labforge::io::BenchmarkResult>> m_benchmark;
+  labforge::io::RecordingScheduler m_recording_scheduler;  ///< Active while recording
+  QTimer m_recording_timer;
+  labforge::io::CsvLogger m_recording_log;
+  QMenu *m_overlay_menu;
+
   std::unique_ptr<labforge::io::FileUploader> m_uploader;
   QProgressDialog *m_upbar;
 };
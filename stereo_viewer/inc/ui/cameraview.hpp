@@ -24,10 +24,18 @@
 #include <QtWidgets/QLabel>
 #include <QtWidgets/QRubberBand>
 #include <QMouseEvent>
+#include <QImage>
+#include <QTransform>
 #include "focus.hpp"
+#include "focus_sweep.hpp"
+#include "ui/overlay.hpp"
 
 namespace labforge::ui {
 
+/**
+ * Camera view widget. The last frame is kept as-is and scaled into the widget
+ * while painting, all annotations are drawn at widget resolution on top.
+ */
 class CameraView : public QLabel {
   Q_OBJECT
 public:
@@ -35,27 +43,63 @@ public:
   virtual ~CameraView() {};
 
   void resizeEvent(QResizeEvent* event) override;
+  void paintEvent(QPaintEvent* event) override;
   void mousePressEvent(QMouseEvent* event) override;
   void mouseReleaseEvent(QMouseEvent* event) override;
   void mouseMoveEvent(QMouseEvent* event) override;
-  void setImage(QImage &img, bool redraw);
-  void addTarget(QRect &pos, QString &label, QColor &color, int width);
-  void addFeature(QPoint &pos, QColor &color, int width);
+  /**
+   * Set the frame to display. The image is shared, not copied.
+   * @param img Frame to display
+   * @param redraw Schedule a repaint immediately
+   */
+  void setImage(const QImage &img, bool redraw);
+  /**
+   * Annotations of the current frame, in frame coordinates.
+   * @return Overlay model drawn on top of the frame
+   */
+  Overlay &overlay() { return m_overlay; }
   void setRuler(int val);
   void reset();
-  void redrawPixmap();
+  void redraw();
   void enableFocus(bool value);
+  bool focusEnabled() const { return m_focus.isEnabled(); }
+  void showFocusZones(bool value);
+  void showFocusPeaking(bool value);
+  /**
+   * Update focus assist from a native resolution frame, restricted to the
+   * zoomed region if any. Feeds the focus sweep while one is recorded.
+   * @param yuyv Raw YUV422 frame shown in this view
+   * @param timestamp Frame timestamp
+   * @param count Camera frame counter
+   */
+  void processFocus(const cv::Mat &yuyv, uint64_t timestamp, uint32_t count);
+  void startSweep();
+  void stopSweep();
+  const FocusSweep &sweep() const { return m_sweep; }
+  /**
+   * Region selected with the rubber band, in frame coordinates.
+   * @return Zoomed region, empty if the full frame is shown
+   */
+  QRect selection() const { return m_scaled ? m_crop : QRect(); }
 
 private:
+  void updateTransform();
+  void updateRuler();
+
   QPoint m_origin;
   QRect m_crop;
   Focus m_focus;
+  FocusSweep m_sweep;
   std::unique_ptr<QRubberBand> m_rubberband;
-  std::unique_ptr<QPixmap> m_last_frame;
+  QImage m_frame;
+  QRect m_source;          ///< Displayed region of m_frame, full frame or zoomed crop
+  QRectF m_target;         ///< Widget area m_source is painted into
+  QTransform m_transform;  ///< Maps frame coordinates to widget coordinates
+  Overlay m_overlay;
   bool m_scaled;
   int m_ruler_pos;
 };
 
 } // namespace labforge::ui
 
-#endif // #define __CAMERAVIEW_HPP__
\ No newline at end of file
+#endif // #define __CAMERAVIEW_HPP__
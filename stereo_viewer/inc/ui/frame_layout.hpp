@@ -0,0 +1,110 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file frame_layout.hpp Compile-time description of the supported stream layouts
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __UI_FRAME_LAYOUT_HPP__
+#define __UI_FRAME_LAYOUT_HPP__
+
+#include <opencv2/core.hpp>
+#include "io/data_thread.hpp"
+#include "io/raw_session.hpp"
+
+/**
+ * Format of the missing second part in single image streams.
+ */
+#define FORMAT_NONE (-1)
+
+namespace labforge::ui {
+
+/**
+ * Layout of a frame keyed on the OpenCV types of its left and right part.
+ * Each supported combination is a specialization, providing:
+ *  - imtype: how the data thread records the frame
+ *  - labels: captions of the left and right view
+ *  - disparity_slot: part holding raw disparity, -1 if none
+ *  - confidence_slot: part holding the confidence of the disparity, -1 if none
+ *  - intensity: parts showing camera images, keypoints and boxes apply to these
+ *  - raw: payload formats of the parts in raw sessions
+ * Unsupported combinations fail to compile.
+ */
+template<int L, int R>
+struct FrameLayout;
+
+template<>
+struct FrameLayout<CV_8UC2, FORMAT_NONE> {
+  static constexpr labforge::io::ImageDataType imtype = labforge::io::IMTYPE_IO;
+  static constexpr const char *labels[2] = {"Display", ""};
+  static constexpr int disparity_slot = -1;
+  static constexpr int confidence_slot = -1;
+  static constexpr bool intensity[2] = {true, false};
+  static constexpr labforge::io::RawFormat raw[2] = {labforge::io::RAW_FORMAT_YUYV, labforge::io::RAW_FORMAT_NONE};
+};
+
+template<>
+struct FrameLayout<CV_16UC1, FORMAT_NONE> {
+  static constexpr labforge::io::ImageDataType imtype = labforge::io::IMTYPE_DO;
+  static constexpr const char *labels[2] = {"Disparity", ""};
+  static constexpr int disparity_slot = 0;
+  static constexpr int confidence_slot = -1;
+  static constexpr bool intensity[2] = {false, false};
+  static constexpr labforge::io::RawFormat raw[2] = {labforge::io::RAW_FORMAT_DISPARITY, labforge::io::RAW_FORMAT_NONE};
+};
+
+template<>
+struct FrameLayout<CV_8UC2, CV_8UC2> {
+  static constexpr labforge::io::ImageDataType imtype = labforge::io::IMTYPE_LR;
+  static constexpr const char *labels[2] = {"Left", "Right"};
+  static constexpr int disparity_slot = -1;
+  static constexpr int confidence_slot = -1;
+  static constexpr bool intensity[2] = {true, true};
+  static constexpr labforge::io::RawFormat raw[2] = {labforge::io::RAW_FORMAT_YUYV, labforge::io::RAW_FORMAT_YUYV};
+};
+
+template<>
+struct FrameLayout<CV_8UC2, CV_16UC1> {
+  static constexpr labforge::io::ImageDataType imtype = labforge::io::IMTYPE_LD;
+  static constexpr const char *labels[2] = {"Left", "Disparity"};
+  static constexpr int disparity_slot = 1;
+  static constexpr int confidence_slot = -1;
+  static constexpr bool intensity[2] = {true, false};
+  static constexpr labforge::io::RawFormat raw[2] = {labforge::io::RAW_FORMAT_YUYV, labforge::io::RAW_FORMAT_DISPARITY};
+};
+
+template<>
+struct FrameLayout<CV_16UC1, CV_8UC2> {
+  static constexpr labforge::io::ImageDataType imtype = labforge::io::IMTYPE_DR;
+  static constexpr const char *labels[2] = {"Disparity", "Right"};
+  static constexpr int disparity_slot = 0;
+  static constexpr int confidence_slot = -1;
+  static constexpr bool intensity[2] = {false, true};
+  static constexpr labforge::io::RawFormat raw[2] = {labforge::io::RAW_FORMAT_DISPARITY, labforge::io::RAW_FORMAT_YUYV};
+};
+
+template<>
+struct FrameLayout<CV_16UC1, CV_16UC1> {
+  static constexpr labforge::io::ImageDataType imtype = labforge::io::IMTYPE_DC;
+  static constexpr const char *labels[2] = {"Disparity", "Confidence"};
+  static constexpr int disparity_slot = 0;
+  static constexpr int confidence_slot = 1;
+  static constexpr bool intensity[2] = {false, false};
+  static constexpr labforge::io::RawFormat raw[2] = {labforge::io::RAW_FORMAT_DISPARITY, labforge::io::RAW_FORMAT_CONFIDENCE};
+};
+
+} // namespace labforge::ui
+
+#endif // __UI_FRAME_LAYOUT_HPP__
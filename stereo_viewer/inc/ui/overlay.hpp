@@ -0,0 +1,111 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file overlay.hpp Retained annotation layers drawn on top of a camera view
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __UI_OVERLAY_HPP__
+#define __UI_OVERLAY_HPP__
+
+#include <array>
+#include <vector>
+#include <QImage>
+#include <QLineF>
+#include <QPainter>
+#include <QPen>
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+#include <QTransform>
+
+namespace labforge::ui {
+
+/**
+ * Annotation layers, each one can be toggled individually.
+ */
+enum OverlayLayer {
+  LAYER_FEATURES,  ///< Keypoints
+  LAYER_TARGETS,   ///< Bounding boxes of detected targets
+  LAYER_RULER,     ///< Horizontal ruler for checking rectification
+  LAYER_OBSTACLES, ///< Obstacle mask, horizon and nearest distances
+  LAYER_MEASUREMENTS, ///< Depth statistics of the selected region
+  LAYER_COUNT
+};
+
+/**
+ * Retained overlay model. Annotations are stored in frame coordinates and
+ * drawn in batches at widget resolution, the frame itself is never touched.
+ */
+class Overlay {
+public:
+  Overlay();
+  ~Overlay() = default;
+
+  /**
+   * Drop annotations of the previous frame, persistent layers are kept.
+   */
+  void clearFrame();
+  void clear(OverlayLayer layer);
+  void setVisible(OverlayLayer layer, bool visible);
+  bool isVisible(OverlayLayer layer) const { return m_layers[layer].visible; }
+  /**
+   * Set pen used for a layer, the pen is made cosmetic so widths are in screen pixels.
+   * @param layer Layer to configure
+   * @param pen Pen to draw points, rectangles and lines with
+   * @param persistent Keep annotations across frames
+   */
+  void setStyle(OverlayLayer layer, const QPen &pen, bool persistent = false);
+
+  void addPoint(OverlayLayer layer, const QPointF &pos) { m_layers[layer].points.push_back(pos); }
+  void addRect(OverlayLayer layer, const QRectF &rect) { m_layers[layer].rects.push_back(rect); }
+  void addLine(OverlayLayer layer, const QLineF &line) { m_layers[layer].lines.push_back(line); }
+  void addLabel(OverlayLayer layer, const QRectF &rect, const QString &text);
+  /**
+   * Set an image drawn below the geometry of a layer, scaled like the frame.
+   * @param layer Layer to draw the image in
+   * @param image Image in frame resolution, typically with alpha or an indexed palette
+   */
+  void setImage(OverlayLayer layer, const QImage &image) { m_layers[layer].image = image; }
+
+  /**
+   * Draw all visible layers.
+   * @param paint Painter of the view
+   * @param transform Frame to widget coordinate transform
+   */
+  void draw(QPainter &paint, const QTransform &transform) const;
+
+private:
+  struct Label {
+    QRectF pos;
+    QString text;
+  };
+  struct Layer {
+    bool visible;
+    bool persistent;
+    QPen pen;
+    QImage image;
+    std::vector<QPointF> points;
+    std::vector<QRectF> rects;
+    std::vector<QLineF> lines;
+    std::vector<Label> labels;
+  };
+
+  std::array<Layer, LAYER_COUNT> m_layers;
+};
+
+} // namespace labforge::ui
+
+#endif // __UI_OVERLAY_HPP__
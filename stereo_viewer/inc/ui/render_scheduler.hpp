@@ -0,0 +1,84 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file render_scheduler.hpp Display pacing for the camera views
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#ifndef __UI_RENDER_SCHEDULER_HPP__
+#define __UI_RENDER_SCHEDULER_HPP__
+
+#include <cstdint>
+#include <vector>
+#include <QObject>
+#include <QTimer>
+#include <QWidget>
+
+namespace labforge::ui {
+
+/**
+ * Paces display updates independently of the acquisition rate. Frames are
+ * submitted at stream rate, render() is emitted at most once per tick and
+ * only if a new frame arrived and at least one view can be seen.
+ */
+class RenderScheduler : public QObject {
+  Q_OBJECT
+public:
+  explicit RenderScheduler(QObject *parent = nullptr);
+  ~RenderScheduler() = default;
+
+  /**
+   * Register a view to check for visibility.
+   * @param view View displaying the stream
+   */
+  void addView(QWidget *view);
+  /**
+   * Set the display rate.
+   * @param fps Maximum number of rendered frames per second
+   */
+  void setRate(int fps);
+  void start();
+  void stop();
+  /**
+   * Mark a newly received frame as pending for display.
+   */
+  void submit();
+  /**
+   * Check if a view is visible on screen, hidden and minimized views are skipped.
+   * @param view View to check
+   * @return True if rendering into the view is useful
+   */
+  static bool isRenderable(const QWidget *view);
+  uint64_t received() const { return m_received; }
+  uint64_t displayed() const { return m_displayed; }
+  void resetCounters();
+
+Q_SIGNALS:
+  void render();
+
+private Q_SLOTS:
+  void tick();
+
+private:
+  QTimer m_timer;
+  std::vector<QWidget*> m_views;
+  bool m_pending;
+  uint64_t m_received;
+  uint64_t m_displayed;
+};
+
+} // namespace labforge::ui
+
+#endif // __UI_RENDER_SCHEDULER_HPP__
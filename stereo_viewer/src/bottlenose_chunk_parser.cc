@@ -17,6 +17,7 @@
 @file bottlenose_chunk_parser.cpp Parse chunk data.
 @author G. M. Tchamgoue <martin@labforge.ca>, Thomas Reidemeister <thomas@labforge.ca>
 */
+#include <algorithm>
 #include <iomanip>
 #include "bottlenose_chunk_parser.hpp"
 #include <cstring>
@@ -180,4 +181,186 @@ bool chunkDecodePointCloud(PvBuffer *buffer, std::vector<vector3f_t>&pointcloud)
   }
 
   return true;
-}
\ No newline at end of file
+}
+
+/**
+ * Parse one set of keypoints.
+ * @param data Start of the keypoint set
+ * @param keypoints Decoded keypoints
+ * @param frame_id Frame the keypoints belong to
+ * @return Offset of the next set, 0 if there is none
+ */
+static uint32_t parseKeypoints(const uint8_t *data, keypoints_t &keypoints, uint32_t *frame_id) {
+  uint32_t count = uintFromBytes(data, 2, true);
+  *frame_id = uintFromBytes(&data[2], 2, true);
+  if((count == 0) || (count > MAX_KEYPOINTS) || (*frame_id > FRAME_RIGHT_STEREO)) {
+    return 0;
+  }
+
+  const keypoint_t *points = (const keypoint_t *)&data[sizeof(uint32_t)];
+  keypoints.assign(points, points + count);
+
+  if((*frame_id == FRAME_LEFT_STEREO) || (*frame_id == FRAME_RIGHT_STEREO)) {
+    return (count + 1) * sizeof(uint32_t);
+  }
+  return 0;
+}
+
+bool chunkDecodeKeypoints(PvBuffer *buffer, keypoints_t &left, keypoints_t &right) {
+  left.clear();
+  right.clear();
+  uint8_t *data = getChunkRawData(buffer, CHUNK_ID_FEATURES);
+  if(data == nullptr) return false;
+
+  keypoints_t *sets[] = {&left, &right, &left, &right};
+  keypoints_t first;
+  uint32_t frame_id = 0;
+  uint32_t offset = parseKeypoints(data, first, &frame_id);
+  if(first.empty()) return false;
+  sets[frame_id]->swap(first);
+
+  // Stereo transmissions carry a second set
+  if(offset > 0) {
+    keypoints_t second;
+    parseKeypoints(&data[offset], second, &frame_id);
+    if(!second.empty()) {
+      sets[frame_id]->swap(second);
+    }
+  }
+  return true;
+}
+
+bool chunkDecodeMatches(PvBuffer *buffer, const keypoints_t &left, const keypoints_t &right, matches_t &matches) {
+  matches.clear();
+  uint8_t *data = getChunkRawData(buffer, CHUNK_ID_MATCHES);
+  if(data == nullptr) return false;
+
+  uint32_t count = uintFromBytes(data, 4, true);
+  uint32_t layout = uintFromBytes(&data[4], 4, true);
+  uint32_t unmatched = uintFromBytes(&data[8], 4, true);
+  if((count == 0) || (count > MAX_KEYPOINTS) || (layout > MATCHES_INDEX_DETAILED)) {
+    return false;
+  }
+  // Entries are aligned with the left keypoints of the same frame
+  count = std::min<uint32_t>(count, static_cast<uint32_t>(left.size()));
+  const uint8_t *entries = &data[3 * sizeof(uint32_t)];
+  const bool detailed = (layout == MATCHES_COORDINATE_DETAILED) || (layout == MATCHES_INDEX_DETAILED);
+  const bool indexed = (layout == MATCHES_INDEX) || (layout == MATCHES_INDEX_DETAILED);
+  const size_t stride = detailed ? sizeof(match_detailed_t) : sizeof(keypoint_t);
+
+  for(uint32_t i = 0; i < count; ++i) {
+    // The best match leads the detailed entries as well
+    keypoint_t best;
+    memcpy(&best, &entries[i * stride], sizeof(keypoint_t));
+    if(indexed) {
+      if((best.x == unmatched) || (best.x >= right.size())) continue;
+      matches.push_back({left[i], right[best.x]});
+    } else {
+      if((best.x == unmatched) || (best.y == unmatched)) continue;
+      matches.push_back({left[i], best});
+    }
+  }
+  return !matches.empty();
+}
+
+bool chunkDecodeBoundingBoxes(PvBuffer *buffer, bboxes_t &boxes, frame_id_t *frame_id) {
+  boxes.clear();
+  uint8_t *data = getChunkRawData(buffer, CHUNK_ID_DNNBBOXES);
+  if((data == nullptr) || (frame_id == nullptr)) return false;
+
+  uint32_t fid = uintFromBytes(data, 4, true);
+  uint32_t count = uintFromBytes(&data[4], 4, true);
+  if((fid > FRAME_RIGHT_STEREO) || (count == 0) || (count > MAX_KEYPOINTS)) {
+    return false;
+  }
+
+  *frame_id = static_cast<frame_id_t>(fid);
+  const bbox_t *bbox = (const bbox_t *)&data[2 * sizeof(uint32_t)];
+  boxes.assign(bbox, bbox + count);
+  for(auto &box : boxes) {
+    box.label[sizeof(box.label) - 1] = '\0';
+  }
+  return true;
+}
+
+/**
+ * Append a chunk in the serialized form of chunkCopyAll.
+ */
+static void appendChunk(std::vector<uint8_t> &out, uint32_t chunkID, const uint8_t *data, uint32_t len){
+  const size_t pos = out.size();
+  out.resize(pos + 8 + len);
+  for(uint32_t i = 0; i < 4; ++i){
+    out[pos + i] = (chunkID >> (8 * i)) & 0xFF;
+    out[pos + 4 + i] = (len >> (8 * i)) & 0xFF;
+  }
+  memcpy(&out[pos + 8], data, len);
+}
+
+bool chunkCopyAll(PvBuffer *buffer, std::vector<uint8_t> &out){
+  out.clear();
+  if(buffer == nullptr){
+    return false;
+  }
+
+  PvPayloadType payload = buffer->GetPayloadType();
+  if(payload == PvPayloadTypeImage){
+    if(!buffer->HasChunks()){
+      return false;
+    }
+    // Serialized chunks take no more than they do in the buffer, grown once instead of per chunk
+    out.reserve(buffer->GetChunkDataSize());
+    for(uint32_t i = 0; i < buffer->GetChunkCount(); ++i){
+      uint32_t id;
+      if(!buffer->GetChunkIDByIndex(i, id).IsOK()){
+        continue;
+      }
+      const uint8_t *data = buffer->GetChunkRawDataByIndex(i);
+      if(data != nullptr){
+        appendChunk(out, id, data, buffer->GetChunkSizeByIndex(i));
+      }
+    }
+  } else if (payload == PvPayloadTypeMultiPart){
+    if(buffer->GetMultiPartContainer()->GetPartCount() != 3){
+      return false;
+    }
+    IPvChunkData *chkbuffer = buffer->GetMultiPartContainer()->GetPart(2)->GetChunkData();
+    if((chkbuffer == nullptr) || (!chkbuffer->HasChunks())){
+      return false;
+    }
+    // Chunks are laid out back to front, data followed by ID and length in big endian
+    const uint8_t *rawdata = buffer->GetMultiPartContainer()->GetPart(2)->GetDataPointer();
+    out.reserve(chkbuffer->GetChunkDataSize());
+    int64_t pos = static_cast<int64_t>(chkbuffer->GetChunkDataSize()) - 4;
+    while(pos >= 4){
+      uint32_t chunk_len = uintFromBytes(&rawdata[pos], 4, false);
+      uint32_t chunk_id = uintFromBytes(&rawdata[pos - 4], 4, false);
+      int64_t start = pos - 4 - static_cast<int64_t>(chunk_len);
+      if((chunk_len == 0) || (start < 0)){
+        break;
+      }
+      appendChunk(out, chunk_id, &rawdata[start], chunk_len);
+      pos = start - 4;
+    }
+  }
+
+  return !out.empty();
+}
+
+const uint8_t *chunkFind(const std::vector<uint8_t> &chunks, uint32_t chunkID, uint32_t *length){
+  size_t pos = 0;
+  while(pos + 8 <= chunks.size()){
+    uint32_t id = uintFromBytes(&chunks[pos], 4);
+    uint32_t len = uintFromBytes(&chunks[pos + 4], 4);
+    if(pos + 8 + len > chunks.size()){
+      break;
+    }
+    if(id == chunkID){
+      if(length != nullptr){
+        *length = len;
+      }
+      return &chunks[pos + 8];
+    }
+    pos += 8 + len;
+  }
+  return nullptr;
+}
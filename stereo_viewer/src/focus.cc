@@ -19,85 +19,270 @@
 */
 #include "focus.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <utility>
 #include <QPainter>
+#include <opencv2/core/hal/intrin.hpp>
 
 using namespace cv;
 using namespace std;
 
+// Pixels accumulated in 32-bit lanes before flushing into 64-bit totals
+#define MAX_LANE_PIXELS (1024)
+
+static QRect s_to_qrect(const Rect &r) {
+  return QRect(r.x, r.y, r.width, r.height);
+}
+
+/**
+ * Accumulate Laplacian and luma statistics over a set of pixels, the 1 pixel
+ * neighbourhood of pixels has to be inside the frame.
+ */
+template<bool PEAKING>
+static void s_accumulate(const Mat &yuyv, const Rect &pixels, Focus::LumaStats &stats,
+                         Mat &mask, int threshold) {
+  const int x0 = pixels.x;
+  const int x1 = pixels.x + pixels.width;
+  int64_t sum = 0;
+  uint64_t sum_sq = 0;
+  uint64_t sum_y = 0;
+  (void)mask;
+  (void)threshold;
+
+  for(int y = pixels.y; y < pixels.y + pixels.height; ++y) {
+    // Luma is every other byte
+    const uint8_t *up = yuyv.ptr<uint8_t>(y - 1);
+    const uint8_t *row = yuyv.ptr<uint8_t>(y);
+    const uint8_t *down = yuyv.ptr<uint8_t>(y + 1);
+    uint8_t *peaks = nullptr;
+    if constexpr(PEAKING) {
+      peaks = mask.ptr<uint8_t>(y);
+    }
+    int x = x0;
+#if CV_SIMD128
+    // 16 pixels per iteration, reads up to one pixel right of the last one
+    while(x + 16 <= x1) {
+      v_int32x4 acc_sum = v_setzero_s32();
+      v_int32x4 acc_sq = v_setzero_s32();
+      v_uint32x4 acc_y = v_setzero_u32();
+      const int end = std::min(x1 - 16, x + MAX_LANE_PIXELS);
+      for(; x <= end; x += 16) {
+        v_uint8x16 c, l, r, u, d, chroma;
+        v_load_deinterleave(row + 2 * x, c, chroma);
+        v_load_deinterleave(row + 2 * (x - 1), l, chroma);
+        v_load_deinterleave(row + 2 * (x + 1), r, chroma);
+        v_load_deinterleave(up + 2 * x, u, chroma);
+        v_load_deinterleave(down + 2 * x, d, chroma);
+
+        v_uint16x8 c0, c1, l0, l1, r0, r1, u0, u1, d0, d1;
+        v_expand(c, c0, c1);
+        v_expand(l, l0, l1);
+        v_expand(r, r0, r1);
+        v_expand(u, u0, u1);
+        v_expand(d, d0, d1);
+
+        // |lap| <= 1020, no saturation in 16 bit
+        v_int16x8 lap0 = (v_reinterpret_as_s16(c0) << 2) - v_reinterpret_as_s16(l0) - v_reinterpret_as_s16(r0) -
+                         v_reinterpret_as_s16(u0) - v_reinterpret_as_s16(d0);
+        v_int16x8 lap1 = (v_reinterpret_as_s16(c1) << 2) - v_reinterpret_as_s16(l1) - v_reinterpret_as_s16(r1) -
+                         v_reinterpret_as_s16(u1) - v_reinterpret_as_s16(d1);
+
+        v_int32x4 s0, s1, s2, s3;
+        v_expand(lap0, s0, s1);
+        v_expand(lap1, s2, s3);
+        acc_sum += (s0 + s1) + (s2 + s3);
+        acc_sq += v_dotprod(lap0, lap0) + v_dotprod(lap1, lap1);
+
+        v_uint32x4 luma0, luma1;
+        v_expand(c0 + c1, luma0, luma1);
+        acc_y += luma0 + luma1;
+
+        if constexpr(PEAKING) {
+          v_uint16x8 limit = v_setall_u16(static_cast<uint16_t>(threshold));
+          v_uint16x8 m0 = v_abs(lap0) > limit;
+          v_uint16x8 m1 = v_abs(lap1) > limit;
+          v_store(peaks + x, v_pack(m0, m1));
+        }
+      }
+      sum += v_reduce_sum(acc_sum);
+      sum_sq += static_cast<uint64_t>(v_reduce_sum(acc_sq));
+      sum_y += v_reduce_sum(acc_y);
+    }
+#endif // CV_SIMD128
+    for(; x < x1; ++x) {
+      int c = row[2 * x];
+      int lap = 4 * c - row[2 * (x - 1)] - row[2 * (x + 1)] - up[2 * x] - down[2 * x];
+      sum += lap;
+      sum_sq += static_cast<uint64_t>(lap * lap);
+      sum_y += c;
+      if constexpr(PEAKING) {
+        peaks[x] = (std::abs(lap) > threshold) ? 255 : 0;
+      }
+    }
+  }
+
+  stats.sum = sum;
+  stats.sum_sq = sum_sq;
+  stats.sum_y = sum_y;
+  stats.count = static_cast<uint64_t>(pixels.width) * pixels.height;
+}
+
+double Focus::LumaStats::variance() const {
+  if(count == 0)
+    return 0;
+  const double n = static_cast<double>(count);
+  const double mean = sum / n;
+  return (sum_sq / n) - mean * mean;
+}
+
+double Focus::LumaStats::brightness() const {
+  return (count > 0) ? (sum_y / static_cast<double>(count)) : 0;
+}
+
 Focus::Focus(size_t maxValues, QColor lineColor, size_t lineWidth)
-: m_maxValues(maxValues), m_lineColor(std::move(lineColor)), m_lineWidth(lineWidth), m_enabled(false) {
-  m_last_values.reserve(maxValues);
+: m_maxValues(maxValues), m_lineColor(std::move(lineColor)), m_lineWidth(lineWidth), m_enabled(false),
+  m_brightness(0), m_last_values(maxValues), m_show_zones(false), m_peaking(false),
+  m_peaking_threshold(FOCUS_PEAKING_THRESHOLD), m_tiles{}, m_zones{} {
 }
 
 void Focus::enable(bool enable) {
   m_enabled = enable;
   // Reset values every time this gets touched
   m_last_values.clear();
+  m_region = Rect();
 }
 
-void Focus::process(QPixmap &pixmap) {
-  if(m_enabled) {
-    QImage image = pixmap.toImage();
-    Mat mat = to_mat(image);
-    if(!mat.empty()) {
-      Mat gray;
-      cvtColor(mat, gray, COLOR_BGR2GRAY);
-      double value = focusValue(gray);
-      double brightness = averageBrightness(gray);
-      m_last_values.push_back(value);
-      // Overflow
-      if(m_last_values.size() > m_maxValues) {
-        m_last_values.erase(m_last_values.begin());
-      }
-      // Front fill
-      if(m_last_values.size() < m_maxValues) {
-        m_last_values.insert(m_last_values.begin(), m_maxValues - m_last_values.size(), value);
+void Focus::showZones(bool enable) {
+  m_show_zones = enable;
+}
+
+void Focus::showPeaking(bool enable, int threshold) {
+  m_peaking = enable;
+  m_peaking_threshold = threshold;
+  if(!enable)
+    m_peaking_mask = QImage();
+}
+
+Rect Focus::tileRect(const Rect &interior, int zone) const {
+  const int tx = zone % FOCUS_ZONES_X;
+  const int ty = zone / FOCUS_ZONES_X;
+  const int x0 = interior.x + (interior.width * tx) / FOCUS_ZONES_X;
+  const int x1 = interior.x + (interior.width * (tx + 1)) / FOCUS_ZONES_X;
+  const int y0 = interior.y + (interior.height * ty) / FOCUS_ZONES_Y;
+  const int y1 = interior.y + (interior.height * (ty + 1)) / FOCUS_ZONES_Y;
+  return Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+QRect Focus::zoneRect(int zone) const {
+  return s_to_qrect(tileRect(m_region, zone));
+}
+
+bool Focus::process(const cv::Mat &yuyv, const QRect &roi) {
+  if(!m_enabled || yuyv.empty() || (yuyv.type() != CV_8UC2))
+    return false;
+
+  Rect region(0, 0, yuyv.cols, yuyv.rows);
+  if(!roi.isEmpty()) {
+    region &= Rect(roi.x(), roi.y(), roi.width(), roi.height());
+  }
+  // Laplacian is evaluated on the interior, every tile needs at least one pixel
+  Rect interior(region.x + 1, region.y + 1, region.width - 2, region.height - 2);
+  if(interior.width < FOCUS_ZONES_X || interior.height < FOCUS_ZONES_Y)
+    return false;
+
+  Mat mask;
+  if(m_peaking) {
+    // Pixels outside the analyzed region are never written, clear them on changes
+    if(m_peaking_mask.width() != yuyv.cols || m_peaking_mask.height() != yuyv.rows || interior != m_region) {
+      m_peaking_mask = QImage(yuyv.cols, yuyv.rows, QImage::Format_Indexed8);
+      QVector<QRgb> colors(256, qRgba(0, 0, 0, 0));
+      colors[255] = qRgba(255, 0, 255, 255);
+      m_peaking_mask.setColorTable(colors);
+      m_peaking_mask.fill(0);
+    }
+    mask = Mat(m_peaking_mask.height(), m_peaking_mask.width(), CV_8UC1, m_peaking_mask.bits(),
+               m_peaking_mask.bytesPerLine());
+  }
+  m_region = interior;
+
+  // Tiles are independent, each writes its own statistics and part of the mask
+  const bool peaking = m_peaking;
+  const int threshold = m_peaking_threshold;
+  parallel_for_(Range(0, FOCUS_ZONES), [&](const Range &range) {
+    for(int zone = range.start; zone < range.end; ++zone) {
+      Rect tile = tileRect(interior, zone);
+      if(peaking) {
+        s_accumulate<true>(yuyv, tile, m_tiles[zone], mask, threshold);
+      } else {
+        s_accumulate<false>(yuyv, tile, m_tiles[zone], mask, threshold);
       }
-      // Draw focus helper
-      paint(pixmap, brightness);
     }
+  });
+
+  LumaStats total{0, 0, 0, 0};
+  for(int zone = 0; zone < FOCUS_ZONES; ++zone) {
+    const LumaStats &tile = m_tiles[zone];
+    total.sum += tile.sum;
+    total.sum_sq += tile.sum_sq;
+    total.sum_y += tile.sum_y;
+    total.count += tile.count;
+    m_zones[zone] = tile.variance();
   }
-}
 
-cv::Mat Focus::to_mat(const QImage &image) {
-  Mat mat;
-  switch (image.format()) {
-    case QImage::Format_RGB32:
-    case QImage::Format_ARGB32:
-    case QImage::Format_ARGB32_Premultiplied:
-      mat = Mat(image.height(), image.width(), CV_8UC4, const_cast<uchar*>(image.bits()), image.bytesPerLine());
-      break;
-    default:
-      return mat;
+  double value = total.variance();
+  m_brightness = total.brightness();
+  // Front fill on the first value
+  if(m_last_values.empty()) {
+    m_last_values.fill(value);
+  } else {
+    m_last_values.push(value);
   }
-  return mat;
+  return true;
 }
 
-double Focus::focusValue(const cv::Mat &gray) {
-  Mat lap;
-  Laplacian(gray, lap, CV_64F);
-  Scalar mu, sigma;
-  meanStdDev(lap, mu, sigma);
-  return sigma.val[0] * sigma.val[0];
-}
+void Focus::paintMaps(QPainter &paint, const QTransform &transform) {
+  if(!m_enabled || m_region.empty() || (!m_show_zones && !m_peaking))
+    return;
 
-double Focus::averageBrightness(const cv::Mat& gray) {
-    cv::Scalar meanBrightness = cv::mean(gray);
-    return meanBrightness[0];
+  paint.save();
+  paint.setTransform(transform);
+  if(m_peaking && !m_peaking_mask.isNull()) {
+    paint.drawImage(QPointF(0, 0), m_peaking_mask);
+  }
+  if(m_show_zones) {
+    // Relative to the sharpest zone, red is soft and green is sharp
+    double best = *std::max_element(m_zones.begin(), m_zones.end());
+    paint.setPen(Qt::NoPen);
+    for(int zone = 0; zone < FOCUS_ZONES; ++zone) {
+      double ratio = (best > 0) ? (m_zones[zone] / best) : 0;
+      paint.setBrush(QColor::fromHsvF(ratio / 3.0, 1.0, 1.0, 0.3));
+      paint.drawRect(zoneRect(zone));
+    }
+  }
+  paint.restore();
 }
 
-void Focus::paint(QPixmap &img, double brightness) {
-  QPainter paint(&img);
+void Focus::paint(QPainter &paint, const QRectF &area) {
+  if(!m_enabled || m_last_values.empty())
+    return;
+
+  paint.save();
+  paint.translate(area.topLeft());
   paint.setPen(QPen(m_lineColor, m_lineWidth));
 
   // Determine the range of the data
-  double minValue = *std::min_element(m_last_values.begin(), m_last_values.end());
-  double maxValue = *std::max_element(m_last_values.begin(), m_last_values.end());
-  double range = maxValue - minValue;
-  int width = img.width();
-  int height = img.height();
+  double minValue = m_last_values[0];
+  double maxValue = m_last_values[0];
+  for(size_t i = 1; i < m_last_values.size(); ++i) {
+    minValue = std::min(minValue, m_last_values[i]);
+    maxValue = std::max(maxValue, m_last_values[i]);
+  }
+  // Flat history is drawn at the bottom
+  double range = (maxValue > minValue) ? (maxValue - minValue) : 1.0;
+  int width = area.width();
+  int height = area.height();
 
   // Plot each point
   for (std::size_t i = 0; i < m_last_values.size() - 1; ++i) {
@@ -118,7 +303,7 @@ void Focus::paint(QPixmap &img, double brightness) {
   paint.setPen(Qt::red); // Choose a color that contrasts well with your image background
 
   // Create the text to display
-  QString brightnessText = QString("Brightness: %1").arg(brightness, 3, 'f', 0, ' ');
+  QString brightnessText = QString("Brightness: %1").arg(m_brightness, 3, 'f', 0, ' ');
 
   // Calculate the position to draw the text
   int textPadding = 5; // Padding from the top-right corner
@@ -138,4 +323,5 @@ void Focus::paint(QPixmap &img, double brightness) {
     // Draw the text on the image
     paint.drawText(textX, textY, lastValueText);
   }
+  paint.restore();
 }
\ No newline at end of file
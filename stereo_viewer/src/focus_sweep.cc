@@ -0,0 +1,168 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file focus_sweep.cc Recording of focus sweeps for lens alignment
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "focus_sweep.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <QStringList>
+#include "io/csv_logger.hpp"
+
+#define WINDOW_SIZE (2 * FOCUS_SWEEP_HALF_WINDOW + 1)
+
+FocusSweep::FocusSweep(size_t capacity)
+: m_capacity(capacity), m_size(0), m_active(false), m_window_sum(0), m_best_smoothed(-1), m_best(0) {
+}
+
+void FocusSweep::start() {
+  // Allocate once, recording must not allocate per frame
+  if(m_samples.size() != m_capacity)
+    m_samples.resize(m_capacity);
+  m_size = 0;
+  m_window_sum = 0;
+  m_best_smoothed = -1;
+  m_best = 0;
+  m_active = true;
+}
+
+void FocusSweep::stop() {
+  m_active = false;
+}
+
+void FocusSweep::add(uint64_t timestamp, uint32_t count, const Focus &focus) {
+  if(!m_active || isFull())
+    return;
+
+  Sample &sample = m_samples[m_size];
+  sample.timestamp = timestamp;
+  sample.count = count;
+  sample.sharpness = static_cast<float>(focus.value());
+  const auto &zones = focus.zones();
+  std::transform(zones.begin(), zones.end(), sample.zones.begin(), [](double v) {
+    return static_cast<float>(v);
+  });
+
+  // Centered moving average, lagging by half a window
+  m_window_sum += sample.sharpness;
+  if(m_size >= WINDOW_SIZE)
+    m_window_sum -= m_samples[m_size - WINDOW_SIZE].sharpness;
+  m_size++;
+  if(m_size >= WINDOW_SIZE) {
+    double smoothed = m_window_sum / WINDOW_SIZE;
+    if(smoothed > m_best_smoothed) {
+      m_best_smoothed = smoothed;
+      m_best = m_size - 1 - FOCUS_SWEEP_HALF_WINDOW;
+    }
+  }
+}
+
+FocusSweep::Peak FocusSweep::peak() const {
+  Peak result{false, 0, 0, 0};
+  if(m_best_smoothed < 0)
+    return result;
+
+  // Least squares parabola y = a t^2 + b t + c over t = -W..W around the best average,
+  // the odd moments vanish for the symmetric window
+  double s2 = 0, s4 = 0, sy = 0, sty = 0, st2y = 0;
+  for(int t = -FOCUS_SWEEP_HALF_WINDOW; t <= FOCUS_SWEEP_HALF_WINDOW; ++t) {
+    double y = m_samples[m_best + t].sharpness;
+    s2 += t * t;
+    s4 += t * t * t * t;
+    sy += y;
+    sty += t * y;
+    st2y += t * t * y;
+  }
+  const double n = WINDOW_SIZE;
+  const double a = (n * st2y - s2 * sy) / (n * s4 - s2 * s2);
+  const double b = sty / s2;
+  const double c = (sy - a * s2) / n;
+
+  double offset = 0;
+  result.sharpness = m_best_smoothed;
+  if(a < 0) {
+    double vertex = -b / (2 * a);
+    if(std::fabs(vertex) <= FOCUS_SWEEP_HALF_WINDOW) {
+      offset = vertex;
+      result.sharpness = c - (b * b) / (4 * a);
+    }
+  }
+
+  const Sample &nearest = m_samples[m_best + static_cast<long>(std::lround(offset))];
+  result.timestamp = nearest.timestamp;
+  result.count = nearest.count;
+  result.valid = true;
+  return result;
+}
+
+bool FocusSweep::exportCsv(const QString &filename) const {
+  QStringList columns = {"timestamp", "count", "sharpness"};
+  for(int zone = 0; zone < FOCUS_ZONES; ++zone) {
+    columns << QString("zone_%1_%2").arg(zone % FOCUS_ZONES_X).arg(zone / FOCUS_ZONES_X);
+  }
+  labforge::io::CsvLogger csv;
+  if(!csv.open(filename, columns)) {
+    return false;
+  }
+
+  for(size_t i = 0; i < m_size; ++i) {
+    const Sample &sample = m_samples[i];
+    csv << sample.timestamp << sample.count << sample.sharpness;
+    for(float zone : sample.zones) {
+      csv << zone;
+    }
+    csv.endRow();
+  }
+  csv.close();
+  return true;
+}
+
+void FocusSweep::paint(QPainter &paint, const QRectF &area) const {
+  if(m_size == 0)
+    return;
+
+  Peak best = peak();
+  double current = m_samples[m_size - 1].sharpness;
+  double ratio = (best.valid && best.sharpness > 0) ? std::clamp(current / best.sharpness, 0.0, 1.0) : 0.0;
+
+  paint.save();
+  paint.translate(area.topLeft());
+  QFont font = paint.font();
+  font.setPixelSize(12);
+  paint.setFont(font);
+  QFontMetrics fontMetrics(font);
+
+  // Gauge along the bottom edge, full when back at the peak
+  const int padding = 5;
+  const int gaugeHeight = 8;
+  QRectF gauge(padding, area.height() - padding - gaugeHeight, area.width() / 3.0, gaugeHeight);
+  QColor color = (ratio >= 0.95) ? Qt::green : ((ratio >= 0.8) ? QColor(255, 165, 0) : Qt::red);
+  paint.setPen(QPen(Qt::white, 1));
+  paint.setBrush(Qt::NoBrush);
+  paint.drawRect(gauge);
+  paint.fillRect(QRectF(gauge.x(), gauge.y(), gauge.width() * ratio, gauge.height()), color);
+
+  QString text = best.valid ? QString("Sweep: %1 frames   Peak: %2   Now: %3%")
+                                  .arg(m_size).arg(best.sharpness, 0, 'f', 0).arg(ratio * 100.0, 0, 'f', 0)
+                            : QString("Sweep: %1 frames").arg(m_size);
+  if(isFull())
+    text += "   (buffer full)";
+  paint.setPen(color);
+  paint.drawText(QPointF(gauge.x(), gauge.y() - fontMetrics.descent() - 2), text);
+  paint.restore();
+}
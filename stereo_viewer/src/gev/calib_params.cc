@@ -124,3 +124,8 @@ void CalibParams::applyStereoRectify(){
 void CalibParams::getDepthMatrix(cv::Mat &qmat){
   qmat = m_Q.clone();
 }
+
+void CalibParams::getProjectionMatrices(cv::Mat &p1, cv::Mat &p2){
+  p1 = m_P1.clone();
+  p2 = m_P2.clone();
+}
@@ -22,6 +22,7 @@
 #include "gev/util.hpp"
 #include <stdexcept>
 #include <iostream>
+#include <utility>
 #include <vector>
 #include <bottlenose_chunk_parser.hpp>
 
@@ -87,6 +88,7 @@ Pipeline::Pipeline(PvStreamGEV *stream_gev, PvDeviceGEV *device_gev, QObject * p
   }
 
   m_start_flag = false;
+  m_keep_chunks = false;
 }
 
 Pipeline::~Pipeline() {
@@ -190,8 +192,7 @@ size_t Pipeline::GetPairs(list<BNImageData> &out) {
   QMutexLocker l(&m_image_lock);
 
   if(!m_images.empty()){
-    BNImageData image = m_images.dequeue();
-    out.push_back(image);
+    out.push_back(m_images.dequeue());
   }
 
   return 0;
@@ -218,6 +219,12 @@ void Pipeline::run() {
     int64_t minDisparity = 0;
     info_t info = {};
     pointcloud_t pointcloud;
+    keypoints_t kp_left;
+    keypoints_t kp_right;
+    matches_t matches;
+    bboxes_t bboxes;
+    frame_id_t bbox_frame = FRAME_LEFT_ONLY;
+    std::vector<uint8_t> chunks;
 
     // Retrieve next buffer
     PvResult lResult = m_stream->RetrieveBuffer( &lBuffer, &lOperationResult, 1500 );
@@ -240,6 +247,12 @@ void Pipeline::run() {
         }
 
         chunkDecodePointCloud(lBuffer, pointcloud);
+        chunkDecodeKeypoints(lBuffer, kp_left, kp_right);
+        chunkDecodeMatches(lBuffer, kp_left, kp_right, matches);
+        chunkDecodeBoundingBoxes(lBuffer, bboxes, &bbox_frame);
+        if(m_keep_chunks){
+          chunkCopyAll(lBuffer, chunks);
+        }
 
         if(m_mindisparity){
           m_mindisparity->GetValue(minDisparity);
@@ -262,7 +275,8 @@ void Pipeline::run() {
               m_images.enqueue({
                               new Mat(img0->GetHeight(), img0->GetWidth(), cv_pixfmt0, img0->GetDataPointer()),
                               new Mat(img1->GetHeight(), img1->GetWidth(), cv_pixfmt1, img1->GetDataPointer()),
-                              timestamp, static_cast<int32_t>(minDisparity), pointcloud
+                              timestamp, static_cast<int32_t>(minDisparity), pointcloud,
+                              kp_left, kp_right, matches, bboxes, bbox_frame, info, std::move(chunks)
                               }
                               );
             }
@@ -277,7 +291,8 @@ void Pipeline::run() {
               int cv_pixformat = (img0->GetPixelType() == PvPixelYUV422_8)? CV_8UC2: CV_16UC1;
 
               m_images.enqueue({new Mat(img0->GetHeight(), img0->GetWidth(), cv_pixformat, img0->GetDataPointer()),
-                                new Mat(), timestamp, static_cast<int32_t>(minDisparity), pointcloud});
+                                new Mat(), timestamp, static_cast<int32_t>(minDisparity), pointcloud,
+                                kp_left, kp_right, matches, bboxes, bbox_frame, info, std::move(chunks)});
             }
 
             emit monoReceived();
@@ -0,0 +1,529 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file async_writer.cc Asynchronous positional file writes from a fixed buffer pool
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/async_writer.hpp"
+
+#include <QFile>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <thread>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <sys/uio.h>
+#endif
+
+using namespace labforge::io;
+
+struct AsyncWriter::File {
+#ifdef __linux__
+  int fd;
+#else
+  QFile handle;
+  std::mutex lock;      ///< QFile has no positional writes
+#endif
+  bool direct;          ///< Writes are padded to the alignment
+  int pending;          ///< Requests in flight, guarded by m_lock
+  uint64_t unsynced;    ///< Bytes written since the last flush
+  bool error;
+};
+
+static size_t s_align(size_t size) {
+  return ((size + ASYNC_WRITER_ALIGNMENT - 1) / ASYNC_WRITER_ALIGNMENT) * ASYNC_WRITER_ALIGNMENT;
+}
+
+static uint8_t *s_alloc_aligned(size_t size) {
+#ifdef _WIN32
+  return static_cast<uint8_t *>(_aligned_malloc(size, ASYNC_WRITER_ALIGNMENT));
+#else
+  void *ptr = nullptr;
+  return (posix_memalign(&ptr, ASYNC_WRITER_ALIGNMENT, size) == 0) ? static_cast<uint8_t *>(ptr) : nullptr;
+#endif
+}
+
+static void s_free_aligned(uint8_t *ptr) {
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+AsyncWriter::Options AsyncWriter::defaults() {
+  return {MODE_DIRECT, SYNC_CLOSE, 256ULL * 1024 * 1024, ASYNC_WRITER_BUFFERS, ASYNC_WRITER_BUFFER_SIZE};
+}
+
+AsyncWriter::AsyncWriter(const Options &options)
+: m_options(options), m_next_file(0), m_next_ticket(1), m_completions(0), m_stats{}, m_failed(false) {
+  m_options.buffer_size = s_align(std::max<size_t>(options.buffer_size, ASYNC_WRITER_ALIGNMENT));
+  m_options.buffers = std::max(1, options.buffers);
+  for(int i = 0; i < m_options.buffers; ++i) {
+    uint8_t *buffer = s_alloc_aligned(m_options.buffer_size);
+    if(buffer == nullptr)
+      break;
+    m_buffers.push_back(buffer);
+    m_free.push_back(i);
+  }
+}
+
+AsyncWriter::~AsyncWriter() {
+  // Backends drain before they go away, only handles left open remain
+  for(auto &entry : m_files) {
+#ifdef __linux__
+    ::close(entry.second->fd);
+#else
+    entry.second->handle.close();
+#endif
+  }
+  for(uint8_t *buffer : m_buffers) {
+    s_free_aligned(buffer);
+  }
+}
+
+int AsyncWriter::open(const QString &path, int64_t preallocate) {
+  auto file = std::make_shared<File>();
+  file->pending = 0;
+  file->unsynced = 0;
+  file->error = false;
+#ifdef __linux__
+  const QByteArray native = QFile::encodeName(path);
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  file->direct = (m_options.mode == MODE_DIRECT);
+  file->fd = ::open(native.constData(), flags | (file->direct ? O_DIRECT : 0), 0644);
+  if((file->fd < 0) && file->direct && (errno == EINVAL)) {
+    // tmpfs and some network file systems reject O_DIRECT
+    file->direct = false;
+    file->fd = ::open(native.constData(), flags, 0644);
+  }
+  if(file->fd < 0)
+    return -1;
+  if((preallocate > 0) && (posix_fallocate(file->fd, 0, preallocate) != 0)) {
+    ::close(file->fd);
+    return -1;
+  }
+#else
+  file->direct = false;
+  file->handle.setFileName(path);
+  if(!file->handle.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+    return -1;
+  if((preallocate > 0) && !file->handle.resize(preallocate)) {
+    file->handle.close();
+    return -1;
+  }
+#endif
+
+  std::lock_guard<std::mutex> locker(m_lock);
+  m_files[m_next_file] = file;
+  return m_next_file++;
+}
+
+bool AsyncWriter::close(int handle, int64_t size) {
+  std::shared_ptr<File> file;
+  {
+    std::lock_guard<std::mutex> locker(m_lock);
+    auto it = m_files.find(handle);
+    if(it == m_files.end())
+      return false;
+    file = it->second;
+  }
+
+  submit();
+  while(true) {
+    {
+      std::lock_guard<std::mutex> locker(m_lock);
+      if(file->pending == 0)
+        break;
+    }
+    reap(true);
+  }
+
+  // Trimmed first so the flush covers the final size
+  bool ok = !file->error;
+#ifdef __linux__
+  ok = (ftruncate(file->fd, size) == 0) && ok;
+  if(m_options.sync != SYNC_NONE)
+    ok = flush(*file) && ok;
+  ok = (::close(file->fd) == 0) && ok;
+#else
+  ok = file->handle.resize(size) && ok;
+  if(m_options.sync != SYNC_NONE)
+    ok = flush(*file) && ok;
+  file->handle.close();
+#endif
+
+  std::lock_guard<std::mutex> locker(m_lock);
+  m_files.erase(handle);
+  return ok;
+}
+
+AsyncWriter::Buffer AsyncWriter::acquire() {
+  while(true) {
+    {
+      std::lock_guard<std::mutex> locker(m_lock);
+      if(!m_free.empty()) {
+        const int index = m_free.back();
+        m_free.pop_back();
+        return {m_buffers[index], index};
+      }
+      if(m_buffers.empty())
+        return {nullptr, -1};
+    }
+    submit();
+    reap(true);
+  }
+}
+
+uint64_t AsyncWriter::write(int handle, int64_t offset, Buffer buffer, size_t length) {
+  Request request = {nullptr, offset, buffer.index, length, 0, 0};
+  Request sync = {nullptr, 0, -1, 0, 0, 0};
+  {
+    std::lock_guard<std::mutex> locker(m_lock);
+    auto it = m_files.find(handle);
+    if((it == m_files.end()) || (buffer.index < 0)) {
+      if(buffer.index >= 0)
+        m_free.push_back(buffer.index);
+      m_failed = true;
+      return 0;
+    }
+    request.file = it->second;
+    if(request.file->direct) {
+      const size_t padded = s_align(length);
+      memset(buffer.data + length, 0, padded - length);
+      request.length = padded;
+    }
+    request.ticket = m_next_ticket++;
+    m_outstanding.insert(request.ticket);
+    request.file->pending++;
+    m_stats.writes++;
+    m_stats.in_flight++;
+
+    request.file->unsynced += request.length;
+    if((m_options.sync == SYNC_PERIODIC) && (request.file->unsynced >= m_options.sync_bytes)) {
+      request.file->unsynced = 0;
+      sync.file = request.file;
+      sync.ticket = m_next_ticket++;
+      m_outstanding.insert(sync.ticket);
+      sync.file->pending++;
+      m_stats.in_flight++;
+    }
+  }
+
+  enqueue(request);
+  if(sync.file)
+    enqueue(sync);
+  return request.ticket;
+}
+
+void AsyncWriter::drain() {
+  submit();
+  while(true) {
+    {
+      std::lock_guard<std::mutex> locker(m_lock);
+      if(m_stats.in_flight == 0)
+        return;
+    }
+    reap(true);
+  }
+}
+
+uint64_t AsyncWriter::completed() {
+  std::lock_guard<std::mutex> locker(m_lock);
+  return m_outstanding.empty() ? (m_next_ticket - 1) : (*m_outstanding.begin() - 1);
+}
+
+AsyncWriter::Stats AsyncWriter::stats() {
+  std::lock_guard<std::mutex> locker(m_lock);
+  return m_stats;
+}
+
+void AsyncWriter::complete(const Request &request, bool ok) {
+  std::lock_guard<std::mutex> locker(m_lock);
+  m_outstanding.erase(request.ticket);
+  if(request.buffer >= 0) {
+    m_free.push_back(request.buffer);
+    m_stats.bytes += request.done;
+  }
+  request.file->pending--;
+  m_stats.in_flight--;
+  m_completions++;
+  if(!ok) {
+    request.file->error = true;
+    m_failed = true;
+  }
+  m_released.notify_all();
+}
+
+int AsyncWriter::descriptor(const File &file) {
+#ifdef __linux__
+  return file.fd;
+#else
+  (void)file;
+  return -1;
+#endif
+}
+
+bool AsyncWriter::writeAt(Request &request) {
+  const uint8_t *data = m_buffers[request.buffer];
+  File &file = *request.file;
+  while(request.done < request.length) {
+    const size_t remaining = request.length - request.done;
+#ifdef __linux__
+    const ssize_t written = pwrite(file.fd, data + request.done, remaining, request.offset + request.done);
+    if((written < 0) && ((errno == EINTR) || (errno == EAGAIN))) {
+      std::lock_guard<std::mutex> locker(m_lock);
+      m_stats.retries++;
+      continue;
+    }
+#else
+    qint64 written;
+    {
+      std::lock_guard<std::mutex> locker(file.lock);
+      written = file.handle.seek(request.offset + request.done) ?
+                file.handle.write(reinterpret_cast<const char *>(data + request.done), remaining) : -1;
+    }
+#endif
+    if(written <= 0)
+      return false;
+    if(static_cast<size_t>(written) < remaining) {
+      std::lock_guard<std::mutex> locker(m_lock);
+      m_stats.short_writes++;
+    }
+    request.done += written;
+  }
+  return true;
+}
+
+bool AsyncWriter::flush(File &file) {
+#ifdef __linux__
+  return fdatasync(file.fd) == 0;
+#else
+  std::lock_guard<std::mutex> locker(file.lock);
+  return file.handle.flush();
+#endif
+}
+
+namespace {
+
+/**
+ * Fallback backend, blocking positional writes on a few threads.
+ */
+class ThreadedWriter : public AsyncWriter {
+public:
+  explicit ThreadedWriter(const Options &options) : AsyncWriter(options), m_stop(false) {
+    const int count = std::clamp(static_cast<int>(std::thread::hardware_concurrency()) / 2, 2, 8);
+    for(int i = 0; i < count; ++i) {
+      m_threads.emplace_back(&ThreadedWriter::work, this);
+    }
+  }
+
+  ~ThreadedWriter() override {
+    drain();
+    {
+      std::lock_guard<std::mutex> locker(m_queue_lock);
+      m_stop = true;
+    }
+    m_queued.notify_all();
+    for(auto &thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  const char *name() const override { return "threads"; }
+  void submit() override {}
+
+protected:
+  void enqueue(const Request &request) override {
+    {
+      std::lock_guard<std::mutex> locker(m_queue_lock);
+      m_queue.push_back(request);
+    }
+    m_queued.notify_one();
+  }
+
+  void reap(bool wait) override {
+    std::unique_lock<std::mutex> locker(m_lock);
+    if(!wait || (m_stats.in_flight == 0))
+      return;
+    const uint64_t seen = m_completions;
+    m_released.wait(locker, [this, seen]() { return m_completions != seen; });
+  }
+
+private:
+  void work() {
+    while(true) {
+      Request request;
+      {
+        std::unique_lock<std::mutex> locker(m_queue_lock);
+        m_queued.wait(locker, [this]() { return m_stop || !m_queue.empty(); });
+        if(m_queue.empty())
+          return;
+        request = std::move(m_queue.front());
+        m_queue.pop_front();
+      }
+      const bool ok = (request.buffer < 0) ? flush(*request.file) : writeAt(request);
+      complete(request, ok);
+    }
+  }
+
+  std::mutex m_queue_lock;
+  std::condition_variable m_queued;
+  std::deque<Request> m_queue;
+  std::vector<std::thread> m_threads;
+  bool m_stop;
+};
+
+#ifdef HAVE_LIBURING
+/**
+ * All writes are issued from the calling thread through one ring, the pool
+ * is registered with the kernel so buffers are not mapped on every write.
+ */
+class UringWriter : public AsyncWriter {
+public:
+  explicit UringWriter(const Options &options) : AsyncWriter(options), m_ready(false), m_fixed(false), m_queued(0) {
+    if(io_uring_queue_init(std::max(8, 2 * m_options.buffers), &m_ring, 0) < 0)
+      return;
+    std::vector<iovec> iovecs(m_buffers.size());
+    for(size_t i = 0; i < m_buffers.size(); ++i) {
+      iovecs[i] = {m_buffers[i], m_options.buffer_size};
+    }
+    // Registration counts against the locked memory limit, plain writes still work without it
+    m_fixed = (io_uring_register_buffers(&m_ring, iovecs.data(), iovecs.size()) == 0);
+    m_ready = true;
+  }
+
+  ~UringWriter() override {
+    if(!m_ready)
+      return;
+    drain();
+    if(m_fixed)
+      io_uring_unregister_buffers(&m_ring);
+    io_uring_queue_exit(&m_ring);
+  }
+
+  bool isReady() const { return m_ready; }
+  const char *name() const override { return "io_uring"; }
+
+  void submit() override {
+    if(m_queued == 0)
+      return;
+    io_uring_submit(&m_ring);
+    m_queued = 0;
+  }
+
+protected:
+  void enqueue(const Request &request) override {
+    io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+    while(sqe == nullptr) {
+      submit();
+      sqe = io_uring_get_sqe(&m_ring);
+    }
+
+    const int fd = descriptor(*request.file);
+    if(request.buffer < 0) {
+      // Waits for everything submitted before it
+      io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+      io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+    } else {
+      uint8_t *data = m_buffers[request.buffer] + request.done;
+      const unsigned length = static_cast<unsigned>(request.length - request.done);
+      if(m_fixed) {
+        io_uring_prep_write_fixed(sqe, fd, data, length, request.offset + request.done, request.buffer);
+      } else {
+        io_uring_prep_write(sqe, fd, data, length, request.offset + request.done);
+      }
+    }
+    io_uring_sqe_set_data(sqe, new Request(request));
+    if(++m_queued >= ASYNC_WRITER_BATCH)
+      submit();
+  }
+
+  void reap(bool wait) override {
+    io_uring_cqe *cqe = nullptr;
+    if(wait) {
+      submit();
+      {
+        std::lock_guard<std::mutex> locker(m_lock);
+        if(m_stats.in_flight == 0)
+          return;
+      }
+      if(io_uring_wait_cqe(&m_ring, &cqe) < 0)
+        return;
+    }
+    while(io_uring_peek_cqe(&m_ring, &cqe) == 0) {
+      Request *request = static_cast<Request *>(io_uring_cqe_get_data(cqe));
+      const int result = cqe->res;
+      io_uring_cqe_seen(&m_ring, cqe);
+      handle(request, result);
+    }
+  }
+
+private:
+  void handle(Request *request, int result) {
+    if((result == -EINTR) || (result == -EAGAIN)) {
+      {
+        std::lock_guard<std::mutex> locker(m_lock);
+        m_stats.retries++;
+      }
+      enqueue(*request);
+    } else if((request->buffer >= 0) && (result > 0) &&
+              (request->done + result < request->length)) {
+      // Continue where the kernel stopped
+      request->done += result;
+      {
+        std::lock_guard<std::mutex> locker(m_lock);
+        m_stats.short_writes++;
+      }
+      enqueue(*request);
+    } else if(request->buffer >= 0) {
+      if(result > 0)
+        request->done += result;
+      complete(*request, result > 0);
+    } else {
+      complete(*request, result == 0);
+    }
+    delete request;
+  }
+
+  io_uring m_ring;
+  bool m_ready;
+  bool m_fixed;   ///< Buffers are registered
+  int m_queued;   ///< Prepared but not yet submitted
+};
+#endif
+
+} // namespace
+
+std::unique_ptr<AsyncWriter> AsyncWriter::create(const Options &options) {
+#ifdef HAVE_LIBURING
+  // Kernels before 5.1 or sandboxes without io_uring fall through
+  auto uring = std::make_unique<UringWriter>(options);
+  if(uring->isReady())
+    return uring;
+#endif
+  return std::make_unique<ThreadedWriter>(options);
+}
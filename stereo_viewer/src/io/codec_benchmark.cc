@@ -0,0 +1,187 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file codec_benchmark.cc Throughput of the recording codecs
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/codec_benchmark.hpp"
+#include "io/csv_logger.hpp"
+
+#include <chrono>
+#include <opencv2/imgproc.hpp>
+
+using namespace labforge::io;
+
+static cv::Mat s_synthetic_bgr(const cv::Size &size, cv::RNG &rng) {
+  cv::Mat image(size, CV_8UC3);
+  for(int y = 0; y < size.height; ++y) {
+    cv::Vec3b *row = image.ptr<cv::Vec3b>(y);
+    for(int x = 0; x < size.width; ++x) {
+      row[x] = cv::Vec3b(static_cast<uchar>(x * 255 / size.width), static_cast<uchar>(y * 255 / size.height),
+                         static_cast<uchar>((x + y) * 255 / (size.width + size.height)));
+    }
+  }
+  for(int i = 0; i < 24; ++i) {
+    const cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+    const cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+    const int radius = rng.uniform(size.height / 40, size.height / 6);
+    if(i % 2) {
+      cv::circle(image, center, radius, color, cv::FILLED);
+    } else {
+      cv::rectangle(image, center, center + cv::Point(radius * 2, radius), color, cv::FILLED);
+    }
+  }
+  cv::Mat noise(size, CV_8UC3);
+  rng.fill(noise, cv::RNG::UNIFORM, 0, 6);
+  image += noise;
+  return image;
+}
+
+/**
+ * Pack as YUV 4:2:2, as sent by the camera.
+ */
+static cv::Mat s_yuyv(const cv::Mat &bgr) {
+  cv::Mat yuv;
+  cv::cvtColor(bgr, yuv, cv::COLOR_BGR2YUV);
+  cv::Mat out(bgr.size(), CV_8UC2);
+  for(int y = 0; y < yuv.rows; ++y) {
+    const cv::Vec3b *src = yuv.ptr<cv::Vec3b>(y);
+    cv::Vec2b *dst = out.ptr<cv::Vec2b>(y);
+    for(int x = 0; x + 1 < yuv.cols; x += 2) {
+      dst[x] = cv::Vec2b(src[x][0], static_cast<uchar>((src[x][1] + src[x + 1][1]) / 2));
+      dst[x + 1] = cv::Vec2b(src[x + 1][0], static_cast<uchar>((src[x][2] + src[x + 1][2]) / 2));
+    }
+  }
+  return out;
+}
+
+/**
+ * Ground plane below the horizon, obstacles of constant disparity, noise
+ * in the sub-pixel bits and holes of invalid matches.
+ */
+static cv::Mat s_synthetic_disparity(const cv::Size &size, cv::RNG &rng) {
+  cv::Mat disparity(size, CV_16UC1);
+  const int horizon = size.height / 3;
+  for(int y = 0; y < size.height; ++y) {
+    const int ground = (y > horizon) ? (y - horizon) * 8 : 0;
+    uint16_t *row = disparity.ptr<uint16_t>(y);
+    for(int x = 0; x < size.width; ++x) {
+      row[x] = static_cast<uint16_t>(ground + rng.uniform(0, 4));
+    }
+  }
+  for(int i = 0; i < 8; ++i) {
+    const cv::Rect box(rng.uniform(0, size.width), rng.uniform(horizon / 2, size.height),
+                       rng.uniform(size.width / 20, size.width / 6), rng.uniform(size.height / 10, size.height / 3));
+    disparity(box & cv::Rect(cv::Point(), size)).setTo(rng.uniform(256, 2048));
+  }
+  for(int i = 0; i < 200; ++i) {
+    const cv::Point hole(rng.uniform(0, size.width), rng.uniform(0, size.height));
+    cv::circle(disparity, hole, rng.uniform(2, 12), cv::Scalar(0), cv::FILLED);
+  }
+  return disparity;
+}
+
+std::vector<BenchmarkFrame> labforge::io::syntheticFrames(const cv::Size &size) {
+  const cv::Size even(size.width & ~1, size.height);
+  cv::RNG rng(0xB07713);
+  const cv::Mat bgr = s_synthetic_bgr(even, rng);
+  return {
+    {"synthetic BGR", bgr},
+    {"synthetic YUYV", s_yuyv(bgr)},
+    {"synthetic disparity", s_synthetic_disparity(even, rng)},
+  };
+}
+
+std::vector<CodecSettings> labforge::io::benchmarkCodecs() {
+  const std::vector<CodecSettings> all = {
+    {CODEC_BMP, -1}, {CODEC_PPM, -1}, {CODEC_PNG, 1}, {CODEC_PNG, 6}, {CODEC_JPEG, 90},
+    {CODEC_QOI, -1}, {CODEC_ZSTD, 1}, {CODEC_ZSTD, 3}, {CODEC_LZ4, -1},
+  };
+  std::vector<CodecSettings> codecs;
+  for(const auto &codec : all) {
+    if(codecAvailable(codec.codec))
+      codecs.push_back(codec);
+  }
+  return codecs;
+}
+
+/**
+ * What the decoder is expected to return for the input.
+ */
+static cv::Mat s_reference(const cv::Mat &image, const cv::Mat &decoded) {
+  cv::Mat reference = image;
+  if(image.type() == CV_8UC4) {
+    cv::cvtColor(image, reference, cv::COLOR_BGRA2BGR);
+  } else if((image.type() == CV_8UC1) && (decoded.type() == CV_8UC3)) {
+    cv::cvtColor(image, reference, cv::COLOR_GRAY2BGR);
+  }
+  return reference;
+}
+
+std::vector<BenchmarkResult> labforge::io::runCodecBenchmark(const std::vector<BenchmarkFrame> &frames,
+                                                             int encoders) {
+  std::vector<BenchmarkResult> results;
+  std::vector<uint8_t> encoded;
+  cv::Mat decoded;
+  for(const auto &frame : frames) {
+    const double bytes = static_cast<double>(frame.image.total() * frame.image.elemSize());
+    for(const auto &codec : benchmarkCodecs()) {
+      // Repeat until the time is long enough to measure, the first run also warms up the caches
+      double total_ms = 0;
+      int runs = 0;
+      bool ok = true;
+      while(ok && ((runs < CODEC_BENCHMARK_MIN_RUNS) || (total_ms < CODEC_BENCHMARK_MIN_MS))) {
+        const auto start = std::chrono::steady_clock::now();
+        ok = encodeImage(frame.image, codec, encoded);
+        total_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        runs++;
+      }
+      if(!ok || encoded.empty())
+        continue;
+
+      BenchmarkResult result;
+      result.frame = frame.name;
+      result.codec = codecName(codec.codec);
+      if(codec.level >= 0)
+        result.codec += " " + QString::number(codec.level);
+      result.ms = total_ms / runs;
+      result.mb_per_s = (result.ms > 0) ? bytes / (result.ms * 1000.0) : 0;
+      result.ratio = bytes / static_cast<double>(encoded.size());
+      result.fps = (result.ms > 0) ? encoders * 1000.0 / result.ms : 0;
+      result.lossless = false;
+      if(decodeImage(encoded.data(), encoded.size(), codec.codec, decoded)) {
+        const cv::Mat reference = s_reference(frame.image, decoded);
+        result.lossless = (reference.size() == decoded.size()) && (reference.type() == decoded.type()) &&
+                          (cv::norm(reference, decoded, cv::NORM_INF) == 0);
+      }
+      results.push_back(result);
+    }
+  }
+  return results;
+}
+
+bool labforge::io::exportCodecBenchmark(const std::vector<BenchmarkResult> &results, const QString &filename) {
+  CsvLogger log;
+  if(!log.open(filename, {"frame", "codec", "ms", "mb_per_s", "ratio", "fps", "lossless"}))
+    return false;
+  for(const auto &result : results) {
+    log << result.frame << result.codec << result.ms << result.mb_per_s << result.ratio << result.fps
+        << (result.lossless ? 1 : 0);
+    log.endRow();
+  }
+  log.close();
+  return true;
+}
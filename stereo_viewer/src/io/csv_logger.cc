@@ -0,0 +1,47 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file csv_logger.cc Row based CSV logging of per frame measurements
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/csv_logger.hpp"
+
+using namespace labforge::io;
+
+bool CsvLogger::open(const QString &filename, const QStringList &columns) {
+  close();
+  m_file.setFileName(filename);
+  if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+    return false;
+  }
+  m_stream.setDevice(&m_file);
+  m_stream << columns.join(',') << '\n';
+  m_first = true;
+  return true;
+}
+
+void CsvLogger::close() {
+  if(!m_file.isOpen())
+    return;
+  m_stream.flush();
+  m_stream.setDevice(nullptr);
+  m_file.close();
+}
+
+void CsvLogger::endRow() {
+  m_stream << '\n';
+  m_first = true;
+}
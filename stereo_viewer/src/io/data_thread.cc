@@ -17,21 +17,79 @@
 @file data_thread.cc DataThread implementation
 @author Guy Martin Tchamgoue <martin@labforge.ca>, Thomas Reidemeister <thomas@labforge.ca>
 */
+#include <QBuffer>
 #include <QDir>
 #include <QFile>
-#include <QTextStream>
 #include "io/data_thread.hpp"
+#include "io/image_codec.hpp"
+#include "proc/disparity.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
-#include <ctime>
+#include <cstring>
 
 using namespace labforge::io;
 using namespace std;
 
+#define PLY_VERTEX_SIZE (15)  ///< Packed x y z float, r g b uchar
+#define PLY_BANDS (16)        ///< Row bands of dense clouds packed in parallel
+
+/**
+ * Whether the encoder reads the left or right image, the views show
+ * disparity or confidence for the other layouts and are only saved colormapped.
+ */
+static bool s_uses_left(ImageDataType imtype, bool colormapped) {
+  return (imtype == IMTYPE_IO) || (imtype == IMTYPE_LR) || (imtype == IMTYPE_LD) || colormapped;
+}
+
+static bool s_uses_right(ImageDataType imtype, bool colormapped) {
+  return (imtype == IMTYPE_LR) || (imtype == IMTYPE_DR) ||
+         (colormapped && ((imtype == IMTYPE_LD) || (imtype == IMTYPE_DC)));
+}
+
+/**
+ * Copy into slot storage, only reallocated if the size or format changed.
+ * @return Image sharing the storage, null if src is
+ */
+static QImage s_copy_into(const QImage &src, QImage &storage) {
+  if(src.isNull())
+    return QImage();
+  if((storage.size() != src.size()) || (storage.format() != src.format()))
+    storage = QImage(src.size(), src.format());
+  const int bytes = std::min(src.bytesPerLine(), storage.bytesPerLine());
+  for(int y = 0; y < src.height(); ++y) {
+    memcpy(storage.scanLine(y), src.constScanLine(y), bytes);
+  }
+  return storage;
+}
+
+static cv::Mat s_copy_into(const cv::Mat &src, cv::Mat &storage) {
+  if(src.empty())
+    return cv::Mat();
+  src.copyTo(storage);
+  return storage;
+}
+
+/**
+ * Drop the references of a frame to its slot, the storage must not be
+ * shared when it is written next or writing it detaches a copy.
+ */
+static void s_unshare(ImageData &imdata) {
+  imdata.left = QImage();
+  imdata.right = QImage();
+  imdata.disparity.release();
+  imdata.confidence.release();
+  imdata.pc.clear();
+  imdata.pc_colors.clear();
+}
+
 DataThread::DataThread(QObject *parent)
-    : QThread(parent), m_abort(false), m_imtype(IMTYPE_LR)
+    : QThread(parent), m_next_sequence(0), m_next_write(0), m_encode_ms(0), m_written(0), m_dropped_oldest(0),
+      m_dropped_newest(0), m_blocked(0), m_blocked_ms(0), m_budget(DATA_THREAD_MEMORY_BUDGET), m_slot_bytes(0),
+      m_replan(false), m_policy(QUEUE_DROP_NEWEST), m_abort(false), m_imtype(IMTYPE_LR), m_colormapped(false),
+      m_pointclouds(true)
 {
   m_folder = "";
   m_left_subfolder = "cam0";
@@ -47,32 +105,174 @@ DataThread::~DataThread()
   m_abort = true;
   m_queue.clear();
   m_mutex.unlock();
-  m_condition.wakeOne();
+  m_condition.wakeAll();
+  m_done_condition.wakeAll();
+  m_slot_condition.wakeAll();
+  for(auto &encoder : m_encoders) {
+    encoder.join();
+  }
   wait();
 }
 
-void DataThread::process(uint64_t timestamp, const QImage &left_image,
+bool DataThread::process(uint64_t timestamp, const QImage &left_image,
                          const QImage &right_image, QString format,
-                         const uint16_t *raw, int32_t min_disparity,
-                         const pointcloud_t &pc){
+                         const cv::Mat &disparity, const cv::Mat &confidence, int32_t min_disparity,
+                         const pointcloud_t &pc,
+                         const std::vector<cv::Vec3b> &pc_colors){
   QMutexLocker locker(&m_mutex);
+  if(m_slots.empty() || (m_replan && (m_free.size() == m_slots.size()))) {
+    allocateSlots(left_image, right_image, disparity, confidence, pc.size());
+  }
+  // Bounded by the budget, the policy decides what gives way when encoding falls behind
+  const int slot = acquireSlot();
+  if(slot < 0)
+    return false;
 
-  cv::Mat dmat;
-  if(raw != nullptr){
-    dmat = cv::Mat(left_image.height(),left_image.width(), CV_16UC1, (uint16_t *)raw);
+  // The source buffers are reused by the caller, copy into the slot without holding up the encoders
+  FrameSlot &storage = *m_slots[slot];
+  ImageData &imdata = storage.data;
+  imdata.imtype = m_imtype;
+  imdata.colormapped = m_colormapped;
+  imdata.pointclouds = m_pointclouds;
+  locker.unlock();
+
+  imdata.timestamp = timestamp;
+  imdata.format = format;
+  imdata.left = s_uses_left(imdata.imtype, imdata.colormapped) ? s_copy_into(left_image, storage.left) : QImage();
+  imdata.right = s_uses_right(imdata.imtype, imdata.colormapped) ? s_copy_into(right_image, storage.right) : QImage();
+  imdata.disparity = s_copy_into(disparity, storage.disparity);
+  imdata.confidence = s_copy_into(confidence, storage.confidence);
+  imdata.min_disparity = min_disparity;
+  if(imdata.pointclouds) {
+    imdata.pc.assign(pc.begin(), pc.end());
+    imdata.pc_colors.assign(pc_colors.begin(), pc_colors.end());
   }
 
-  m_queue.enqueue({timestamp, left_image, right_image, format, dmat, min_disparity, pc, m_imtype});
+  locker.relock();
+  imdata.sequence = m_next_sequence++;
+  m_queue.enqueue(slot);
 
   if (!isRunning()) {
     start(HighPriority);
-  } else {
-    m_condition.wakeOne();
   }
+  if(m_encoders.empty()) {
+    // One core is left to the pipeline and the user interface
+    const int count = std::max(1, QThread::idealThreadCount() - 1);
+    for(int i = 0; i < count; ++i) {
+      m_encoders.emplace_back(&DataThread::encodeLoop, this);
+    }
+  }
+  m_condition.wakeOne();
+  return true;
 }
 
 void DataThread::setImageDataType(ImageDataType imtype){
+  QMutexLocker locker(&m_mutex);
   m_imtype = imtype;
+  m_replan = true;
+}
+
+void DataThread::setColormapped(bool colormapped){
+  QMutexLocker locker(&m_mutex);
+  m_colormapped = colormapped;
+  m_replan = true;
+}
+
+void DataThread::setPointClouds(bool enabled){
+  QMutexLocker locker(&m_mutex);
+  m_pointclouds = enabled;
+}
+
+void DataThread::setMemoryBudget(size_t bytes){
+  QMutexLocker locker(&m_mutex);
+  m_budget = bytes;
+  m_replan = true;
+}
+
+void DataThread::setQueuePolicy(QueuePolicy policy){
+  QMutexLocker locker(&m_mutex);
+  m_policy = policy;
+  // A blocked caller re-evaluates under the new policy
+  m_slot_condition.wakeAll();
+}
+
+void DataThread::allocateSlots(const QImage &left, const QImage &right, const cv::Mat &disparity,
+                               const cv::Mat &confidence, size_t points){
+  const bool uses_left = s_uses_left(m_imtype, m_colormapped) && !left.isNull();
+  const bool uses_right = s_uses_right(m_imtype, m_colormapped) && !right.isNull();
+  // Room for twice the points of the first frame, the cloud varies from frame to frame
+  const size_t reserve = 2 * points;
+  size_t bytes = reserve * (sizeof(pointcloud_t::value_type) + sizeof(cv::Vec3b));
+  bytes += uses_left ? static_cast<size_t>(left.bytesPerLine()) * left.height() : 0;
+  bytes += uses_right ? static_cast<size_t>(right.bytesPerLine()) * right.height() : 0;
+  bytes += disparity.total() * disparity.elemSize() + confidence.total() * confidence.elemSize();
+  const size_t count = std::clamp<size_t>(m_budget / std::max<size_t>(bytes, 1), DATA_THREAD_MIN_SLOTS,
+                                          DATA_THREAD_MAX_SLOTS);
+
+  m_slots.clear();
+  m_free.clear();
+  for(size_t i = 0; i < count; ++i) {
+    // Written once so the pages are mapped before recording starts
+    auto slot = std::make_unique<FrameSlot>();
+    if(uses_left) {
+      slot->left = QImage(left.size(), left.format());
+      slot->left.fill(0);
+    }
+    if(uses_right) {
+      slot->right = QImage(right.size(), right.format());
+      slot->right.fill(0);
+    }
+    if(!disparity.empty())
+      slot->disparity = cv::Mat::zeros(disparity.size(), disparity.type());
+    if(!confidence.empty())
+      slot->confidence = cv::Mat::zeros(confidence.size(), confidence.type());
+    slot->data.pc.reserve(reserve);
+    slot->data.pc_colors.reserve(reserve);
+    m_slots.push_back(std::move(slot));
+    m_free.push_back(static_cast<int>(i));
+  }
+  m_slot_bytes = bytes;
+  m_replan = false;
+}
+
+int DataThread::acquireSlot(){
+  if(m_free.empty() && (m_policy == QUEUE_BLOCK)) {
+    auto start = std::chrono::steady_clock::now();
+    m_blocked++;
+    while(m_free.empty() && (m_policy == QUEUE_BLOCK) && !m_abort) {
+      m_slot_condition.wait(&m_mutex);
+    }
+    m_blocked_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+  if(!m_free.empty()) {
+    const int slot = m_free.back();
+    m_free.pop_back();
+    return slot;
+  }
+
+  // Frames being encoded or written are past the point of dropping
+  if((m_policy == QUEUE_DROP_OLDEST) && !m_queue.isEmpty()) {
+    const int slot = m_queue.dequeue();
+    EncodedFrame skipped = {};
+    skipped.sequence = m_slots[slot]->data.sequence;
+    skipped.slot = -1;
+    skipped.skipped = true;
+    m_done.emplace(skipped.sequence, std::move(skipped));
+    m_done_condition.wakeOne();
+    m_dropped_oldest++;
+    s_unshare(m_slots[slot]->data);
+    return slot;
+  }
+  m_dropped_newest++;
+  return -1;
+}
+
+void DataThread::releaseSlot(int slot){
+  if(slot < 0)
+    return;
+  s_unshare(m_slots[slot]->data);
+  m_free.push_back(slot);
+  m_slot_condition.wakeOne();
 }
 
 bool getFilename(QString &fname, const QString &new_folder, const QString &subfolder, QString file_prefix){
@@ -100,18 +300,23 @@ bool DataThread::setFolder(QString new_folder){
     status = getFilename(m_left_fname, m_folder, m_left_subfolder, "mono_");
   } else if (m_imtype == IMTYPE_DO){
     status = status && getFilename(m_disparity_fname, m_folder, m_disparity_subfolder, "disparity_");
+    status = status && getFilename(m_disparity_color_fname, m_folder, m_disparity_subfolder, "disparity_color_");
   } else if (m_imtype == IMTYPE_LR){
     status = status && getFilename(m_left_fname, m_folder, m_left_subfolder, "left_");
     status = status && getFilename(m_right_fname, m_folder, m_right_subfolder, "right_");
   } else if (m_imtype == IMTYPE_LD){
     status = status && getFilename(m_left_fname, m_folder, m_left_subfolder, "left_");
     status = status && getFilename(m_disparity_fname, m_folder, m_disparity_subfolder, "disparity_");
+    status = status && getFilename(m_disparity_color_fname, m_folder, m_disparity_subfolder, "disparity_color_");
   } else if (m_imtype == IMTYPE_DR){
     status = status && getFilename(m_right_fname, m_folder, m_right_subfolder, "right_");
     status = status && getFilename(m_disparity_fname, m_folder, m_disparity_subfolder, "disparity_");
+    status = status && getFilename(m_disparity_color_fname, m_folder, m_disparity_subfolder, "disparity_color_");
   } else if (m_imtype == IMTYPE_DC){
     status = status && getFilename(m_disparity_fname, m_folder, m_disparity_subfolder, "disparity_");
     status = status && getFilename(m_conf_fname, m_folder, m_disparity_subfolder, "conf_");
+    status = status && getFilename(m_disparity_color_fname, m_folder, m_disparity_subfolder, "disparity_color_");
+    status = status && getFilename(m_conf_color_fname, m_folder, m_disparity_subfolder, "conf_color_");
   }
 
   return status;
@@ -119,137 +324,148 @@ bool DataThread::setFolder(QString new_folder){
 
 void DataThread::stop(){
   QMutexLocker locker(&m_mutex);
+  // Skip everything submitted so far, frames still being encoded are discarded when done
+  for(int slot : m_queue) {
+    releaseSlot(slot);
+  }
   m_queue.clear();
-  m_condition.wakeOne();
+  for(auto &done : m_done) {
+    releaseSlot(done.second.slot);
+  }
+  m_done.clear();
+  m_next_write = m_next_sequence;
+  // The next recording may have a different layout
+  m_replan = true;
 }
 
-static inline bool invalid(cv::Point3f &pt){
+static inline bool invalid(const cv::Point3f &pt){
   return (std::isnan(pt.x) || std::isnan(pt.y) || std::isnan(pt.z) ||
           std::isinf(pt.x) || std::isinf(pt.y) || std::isinf(pt.z));
 }
 
-static uint32_t countNaN(const cv::Mat& pointCloud){
-  uint32_t count = 0;
-  for (int y = 0; y < pointCloud.rows; ++y) {
-      for (int x = 0; x < pointCloud.cols; ++x) {
-        cv::Point3f pt = pointCloud.at<cv::Point3f>(y, x);
-        if(invalid(pt)) count++;
-      }
+/**
+ * Image with direct access to 32-bit pixels, converted only if needed.
+ */
+static QImage s_rgb32(const QImage &image){
+  if((image.format() == QImage::Format_RGB32) || (image.format() == QImage::Format_ARGB32)){
+    return image;
   }
-  return count;
+  return image.convertToFormat(QImage::Format_RGB32);
 }
 
-static uint32_t countNaN(const pointcloud_t& pointCloud){
-  uint32_t count = 0;
-  for (uint32_t i = 0; i < pointCloud.size(); ++i) {
-    cv::Point3f pt(pointCloud[i].x, pointCloud[i].y, pointCloud[i].z);
-    if(invalid(pt)) count++;
-  }
-  return count;
+/**
+ * Append a vertex in the binary PLY layout, x y z as float and r g b as uchar.
+ * All supported hosts are little endian, floats are copied as is.
+ */
+static inline uint8_t *s_pack_vertex(uint8_t *out, const float *xyz, QRgb color){
+  memcpy(out, xyz, 3 * sizeof(float));
+  out[12] = static_cast<uint8_t>(qRed(color));
+  out[13] = static_cast<uint8_t>(qGreen(color));
+  out[14] = static_cast<uint8_t>(qBlue(color));
+  return out + PLY_VERTEX_SIZE;
 }
 
-static void saveColoredPLYFile(const cv::Mat& pointCloud, const QImage &image, const QString& filename) {
-  QFile file(filename);
-
-  if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-    return;
+/**
+ * Write a binary PLY of colored vertices that are already packed.
+ * @param packed Bands of packed vertices
+ * @param used Bytes used at the start of each band
+ */
+static void s_write_ply(QIODevice &file, const std::vector<std::vector<uint8_t>> &packed,
+                        const std::vector<size_t> &used){
+  size_t count = 0;
+  for(size_t band = 0; band < packed.size(); ++band){
+    count += used[band] / PLY_VERTEX_SIZE;
   }
 
-  // Create a QTextStream to write to the file
-  QTextStream plyFile(&file);
-
-  uint32_t nan_counts = countNaN(pointCloud);
-  uint32_t pc_size = pointCloud.rows * pointCloud.cols - nan_counts;
-
-  // Write PLY header
-  plyFile << "ply\n";
-  plyFile << "format ascii 1.0\n";
-  plyFile << "element vertex " << pc_size << "\n";
-  plyFile << "property float x\n";
-  plyFile << "property float y\n";
-  plyFile << "property float z\n";
-  plyFile << "property uchar red\n";
-  plyFile << "property uchar green\n";
-  plyFile << "property uchar blue\n";
-  plyFile << "end_header\n";
-
-  // Write point cloud data
-  for (int y = 0; y < pointCloud.rows; ++y) {
-    for (int x = 0; x < pointCloud.cols; ++x) {
-        cv::Point3f pt = pointCloud.at<cv::Point3f>(y, x);
-        if(invalid(pt)) continue;
-
-        QColor color = image.pixelColor(x, y);
-
-        plyFile << pt.x << " " << pt.y << " " << pt.z << " "
-                << color.red() << " "  // Red
-                << color.green() << " "  // Green
-                << color.blue() << "\n"; // Blue
-    }
-    plyFile.flush();
+  QByteArray header;
+  header += "ply\n";
+  header += "format binary_little_endian 1.0\n";
+  header += "element vertex " + QByteArray::number(static_cast<qulonglong>(count)) + "\n";
+  header += "property float x\n";
+  header += "property float y\n";
+  header += "property float z\n";
+  header += "property uchar red\n";
+  header += "property uchar green\n";
+  header += "property uchar blue\n";
+  header += "end_header\n";
+  file.write(header);
+  for(size_t band = 0; band < packed.size(); ++band){
+    file.write(reinterpret_cast<const char *>(packed[band].data()), used[band]);
   }
-
-  file.close();
 }
 
-static void saveColoredSparsePLYFile(const pointcloud_t &pointCloud, QImage &image, const QString& filename) {
-  QFile file(filename);
-
-  if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-    return;
-  }
-
-  // Create a QTextStream to write to the file
-  QTextStream plyFile(&file);
-
-  uint32_t nan_counts = countNaN(pointCloud);
-  uint32_t pc_size = pointCloud.size() - nan_counts;
+static void saveColoredPLYFile(const cv::Mat &pointCloud, const cv::Mat &disparity, const QImage &image,
+                               QIODevice &file) {
+  const QImage rgb = s_rgb32(image);
+  const bool colored = (rgb.width() == pointCloud.cols) && (rgb.height() == pointCloud.rows);
+  const int bands = std::max(1, std::min(PLY_BANDS, pointCloud.rows));
+
+  // Vertices are packed per band in parallel, counted while packing and written in row order.
+  // The bands are kept by each encoder and only grow, they are never zeroed again. Bound here,
+  // the workers packing them have thread locals of their own
+  thread_local std::vector<std::vector<uint8_t>> s_packed;
+  thread_local std::vector<size_t> s_used;
+  std::vector<std::vector<uint8_t>> &packed = s_packed;
+  std::vector<size_t> &used = s_used;
+  packed.resize(bands);
+  used.assign(bands, 0);
+  cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range) {
+    for(int band = range.start; band < range.end; ++band) {
+      const int y0 = (pointCloud.rows * band) / bands;
+      const int y1 = (pointCloud.rows * (band + 1)) / bands;
+      std::vector<uint8_t> &out = packed[band];
+      const size_t worst = static_cast<size_t>(y1 - y0) * pointCloud.cols * PLY_VERTEX_SIZE;
+      if(out.size() < worst)
+        out.resize(worst);
+      uint8_t *dst = out.data();
+      for(int y = y0; y < y1; ++y) {
+        const cv::Point3f *points = pointCloud.ptr<cv::Point3f>(y);
+        const uint16_t *disp = disparity.ptr<uint16_t>(y);
+        const QRgb *colors = colored ? reinterpret_cast<const QRgb *>(rgb.constScanLine(y)) : nullptr;
+        for(int x = 0; x < pointCloud.cols; ++x) {
+          if((disp[x] == 0) || !isValidDisparity(disp[x]) || invalid(points[x]))
+            continue;
+          dst = s_pack_vertex(dst, &points[x].x, colors ? colors[x] : qRgb(255, 255, 255));
+        }
+      }
+      used[band] = dst - out.data();
+    }
+  });
 
-  // Write PLY header
-  plyFile << "ply\n";
-  plyFile << "format ascii 1.0\n";
-  plyFile << "element vertex " << pc_size << "\n";
-  plyFile << "property float x\n";
-  plyFile << "property float y\n";
-  plyFile << "property float z\n";
-  plyFile << "property uchar red\n";
-  plyFile << "property uchar green\n";
-  plyFile << "property uchar blue\n";
-  plyFile << "end_header\n";
+  s_write_ply(file, packed, used);
+}
 
-  std::srand(std::time(nullptr));
+static void saveColoredSparsePLYFile(const pointcloud_t &pointCloud, const std::vector<cv::Vec3b> &colors,
+                                     const QImage &image, QIODevice &file) {
+  const QImage rgb = s_rgb32(image);
+  const bool sampled = (colors.size() != pointCloud.size()) && !rgb.isNull();
+  // Local to the call, encoders save point clouds concurrently
+  cv::RNG rng(static_cast<uint64_t>(pointCloud.size()));
 
-  // Write point cloud data
+  std::vector<std::vector<uint8_t>> packed(1);
+  packed[0].resize(pointCloud.size() * PLY_VERTEX_SIZE);
+  uint8_t *dst = packed[0].data();
   for (uint32_t i = 0; i < pointCloud.size(); ++i){
     cv::Point3f pt(pointCloud[i].x, pointCloud[i].y, pointCloud[i].z);
     if(invalid(pt)) continue;
 
-    uint32_t x = std::rand() % image.width();
-    uint32_t y = std::rand() % image.height();
-    QColor color = image.pixelColor(x, y);
-
-    plyFile << pt.x << " " << pt.y << " " << pt.z << " "
-            << color.red() << " "  // Red
-            << color.green() << " "  // Green
-            << color.blue() << "\n"; // Blue
-  }
-
-  file.close();
-}
-
-static void filterPointCloud(cv::Mat &pc, const cv::Mat &disp){
-  for (int y = 0; y < disp.rows; ++y) {
-    for (int x = 0; x < disp.cols; ++x) {
-      if((disp.at<ushort>(y, x) > 0) && (disp.at<ushort>(y, x) < 65535)) continue;
-      pc.at<cv::Point3f>(y, x).z = NAN;
+    QRgb color = qRgb(255, 255, 255);
+    if(colors.size() == pointCloud.size()) {
+      color = qRgb(colors[i][0], colors[i][1], colors[i][2]);
+    } else if(sampled) {
+      int x = rng.uniform(0, rgb.width());
+      int y = rng.uniform(0, rgb.height());
+      color = reinterpret_cast<const QRgb *>(rgb.constScanLine(y))[x];
     }
+    dst = s_pack_vertex(dst, &pt.x, color);
   }
+
+  s_write_ply(file, packed, {static_cast<size_t>(dst - packed[0].data())});
 }
 
-static void saveProjected3D(const cv::Mat &disparity, QImage &qimage,
-                            int32_t min_disparity, cv::Mat &matQ, QString &dfname){
+static void saveProjected3D(const cv::Mat &disparity, const QImage &qimage,
+                            int32_t min_disparity, const cv::Mat &matQ, QIODevice &file){
   if(disparity.empty()) return;
-  if(dfname.isEmpty()) return;
 
   cv::Mat pc(qimage.height(), qimage.width(), CV_32FC3);
   cv::Mat dispf32;
@@ -259,62 +475,205 @@ static void saveProjected3D(const cv::Mat &disparity, QImage &qimage,
 
   if(!matQ.empty()){
     cv::reprojectImageTo3D(dispf32, pc, matQ, false, CV_32F);
-    filterPointCloud(pc, disparity);
-    saveColoredPLYFile(pc, qimage, dfname);
+    // Invalid disparities are skipped while packing
+    saveColoredPLYFile(pc, disparity, qimage, file);
   }
 }
 
-void DataThread::run() {
-  while(!m_abort) {
+static QByteArray s_bytes(const std::vector<uint8_t> &buffer) {
+  return QByteArray(reinterpret_cast<const char *>(buffer.data()), static_cast<int>(buffer.size()));
+}
+
+/**
+ * Encode an image in memory.
+ */
+static QByteArray s_encode(const QImage &image, const CodecSettings &codec) {
+  std::vector<uint8_t> buffer;
+  if(image.format() == QImage::Format_Grayscale8) {
+    const cv::Mat view(image.height(), image.width(), CV_8UC1, const_cast<uchar *>(image.constBits()),
+                       image.bytesPerLine());
+    encodeImage(view, codec, buffer);
+  } else {
+    // RGB32 is BGRA in memory
+    const QImage rgb = s_rgb32(image);
+    const cv::Mat view(rgb.height(), rgb.width(), CV_8UC4, const_cast<uchar *>(rgb.constBits()), rgb.bytesPerLine());
+    encodeImage(view, codec, buffer);
+  }
+  return s_bytes(buffer);
+}
+
+/**
+ * Codec of 16-bit values, lossless and favoring speed over size unless
+ * the selection takes them or sets a PNG level.
+ */
+static CodecSettings s_codec16(const CodecSettings &codec) {
+  if((codec.codec == CODEC_ZSTD) || (codec.codec == CODEC_LZ4) || ((codec.codec == CODEC_PNG) && (codec.level >= 0)))
+    return codec;
+  return {CODEC_PNG, 1};
+}
+
+static QByteArray s_encode16(const cv::Mat &raw, const CodecSettings &codec) {
+  std::vector<uint8_t> buffer;
+  encodeImage(raw, codec, buffer);
+  return s_bytes(buffer);
+}
+
+EncodedFrame DataThread::encode(const ImageData &imdata, const cv::Mat &matQ) {
+  auto start = std::chrono::steady_clock::now();
+  EncodedFrame frame;
+  frame.sequence = imdata.sequence;
+  frame.timestamp = imdata.timestamp;
+  frame.slot = -1;
+  frame.skipped = false;
+
+  const CodecSettings codec = parseCodec(imdata.format);
+  const CodecSettings codec16 = s_codec16(codec);
+  const QString ext = codecExtension(codec.codec);
+  auto add = [&frame, &ext](OutputStream stream, QByteArray data) {
+    frame.files.push_back({stream, ext, std::move(data)});
+  };
+  // Values for metrology, the colormapped images are optional and only for viewing
+  auto add16 = [&frame, &codec16](OutputStream stream, const cv::Mat &raw) {
+    if(!raw.empty())
+      frame.files.push_back({stream, codecExtension(codec16.codec), s_encode16(raw, codec16)});
+  };
+  auto addColor = [&add, &imdata, &codec](OutputStream stream, const QImage &image) {
+    if(imdata.colormapped)
+      add(stream, s_encode(image, codec));
+  };
+
+  if(imdata.imtype == IMTYPE_IO){
+    add(OUTPUT_LEFT, s_encode(imdata.left, codec));
+  } else if (imdata.imtype == IMTYPE_DO){
+    add16(OUTPUT_DISPARITY, imdata.disparity);
+    addColor(OUTPUT_DISPARITY_COLOR, imdata.left);
+  } else if (imdata.imtype == IMTYPE_LR){
+    add(OUTPUT_LEFT, s_encode(imdata.left, codec));
+    add(OUTPUT_RIGHT, s_encode(imdata.right, codec));
+  } else if (imdata.imtype == IMTYPE_LD){
+    add(OUTPUT_LEFT, s_encode(imdata.left, codec));
+    add16(OUTPUT_DISPARITY, imdata.disparity);
+    addColor(OUTPUT_DISPARITY_COLOR, imdata.right);
+    if(imdata.pointclouds && !imdata.disparity.empty() && !matQ.empty()) {
+      QByteArray data;
+      QBuffer buffer(&data);
+      buffer.open(QIODevice::WriteOnly);
+      saveProjected3D(imdata.disparity, imdata.left, imdata.min_disparity, matQ, buffer);
+      frame.files.push_back({OUTPUT_DISPARITY, "ply", data});
+    }
+  } else if (imdata.imtype == IMTYPE_DR){
+    add16(OUTPUT_DISPARITY, imdata.disparity);
+    addColor(OUTPUT_DISPARITY_COLOR, imdata.left);
+    add(OUTPUT_RIGHT, s_encode(imdata.right, codec));
+  } else if (imdata.imtype == IMTYPE_DC){
+    add16(OUTPUT_DISPARITY, imdata.disparity);
+    add16(OUTPUT_CONFIDENCE, imdata.confidence);
+    addColor(OUTPUT_DISPARITY_COLOR, imdata.left);
+    addColor(OUTPUT_CONFIDENCE_COLOR, imdata.right);
+  }
+  if(imdata.pointclouds && (imdata.pc.size() > 0) && (imdata.imtype == IMTYPE_LR)){
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    saveColoredSparsePLYFile(imdata.pc, imdata.pc_colors, imdata.left, buffer);
+    frame.files.push_back({OUTPUT_POINTCLOUD, "ply", data});
+  }
+
+  frame.encode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  return frame;
+}
+
+void DataThread::encodeLoop() {
+  while(true) {
     m_mutex.lock();
     while(m_queue.isEmpty() && !m_abort){
       m_condition.wait(&m_mutex);
     }
     if(m_abort){
       m_mutex.unlock();
-      break;
+      return;
     }
-    ImageData imdata = m_queue.dequeue();
+    const int slot = m_queue.dequeue();
+    // Owned by this encoder until handed to the writer, the slots are not reallocated while in use
+    const ImageData &imdata = m_slots[slot]->data;
+    cv::Mat matQ = m_matQ;
     m_mutex.unlock();
 
-    QString ext = imdata.format.toUpper();
-    QString padded_cntr = QString("%1").arg(m_frame_counter, 4, 10, QChar('0'));
-    QString suffix =  padded_cntr + "_" + QString::number(imdata.timestamp)  + "." + ext.toLower();
-    int32_t quality = (ext == "JPG") ? 90 : -1;
-
-    if(imdata.imtype == IMTYPE_IO){
-      imdata.left.save(m_left_fname + suffix, ext.toStdString().c_str(), quality);
-    } else if (imdata.imtype == IMTYPE_DO){
-      imdata.left.save(m_disparity_fname + suffix, ext.toStdString().c_str(), quality);
-    } else if (imdata.imtype == IMTYPE_LR){
-      imdata.left.save(m_left_fname + suffix, ext.toStdString().c_str(), quality);
-      imdata.right.save(m_right_fname + suffix, ext.toStdString().c_str(), quality);
-    } else if (imdata.imtype == IMTYPE_LD){
-      imdata.left.save(m_left_fname + suffix, ext.toStdString().c_str(), quality);
-      imdata.right.save(m_disparity_fname + suffix, ext.toStdString().c_str(), quality);
-      QString fname = m_disparity_fname + suffix.replace(ext.toLower(), "ply");
-      saveProjected3D(imdata.disparity, imdata.left, imdata.min_disparity, m_matQ, fname);
-    } else if (imdata.imtype == IMTYPE_DR){
-      imdata.left.save(m_disparity_fname + suffix, ext.toStdString().c_str(), quality);
-      imdata.right.save(m_right_fname + suffix, ext.toStdString().c_str(), quality);
-      //QString fname = m_disparity_fname + suffix.replace(ext.toLower(), "ply");
-      //saveProjected3D(imdata.disparity, imdata.rig, imdata.min_disparity, m_matQ, fname);
-    } else if (imdata.imtype == IMTYPE_DC){
-      imdata.left.save(m_disparity_fname + suffix, ext.toStdString().c_str(), quality);
-      imdata.right.save(m_conf_fname + suffix, ext.toStdString().c_str(), quality);
-      //QString fname = m_disparity_fname + suffix.replace(ext.toLower(), "ply");
-      //saveProjected3D(imdata, m_matQ, fname);
+    EncodedFrame frame = encode(imdata, matQ);
+    frame.slot = slot;
+
+    QMutexLocker locker(&m_mutex);
+    m_encode_ms = (m_encode_ms == 0) ? frame.encode_ms : (0.9 * m_encode_ms + 0.1 * frame.encode_ms);
+    // Frames dropped by stop() are not written
+    if(frame.sequence >= m_next_write) {
+      m_done.emplace(frame.sequence, std::move(frame));
+      m_done_condition.wakeOne();
+    } else {
+      releaseSlot(slot);
+    }
+  }
+}
+
+void DataThread::run() {
+  // Completion stage, files are named and written in submission order
+  while(true) {
+    m_mutex.lock();
+    auto next = m_done.find(m_next_write);
+    while((next == m_done.end()) && !m_abort){
+      m_done_condition.wait(&m_mutex);
+      next = m_done.find(m_next_write);
+    }
+    if(m_abort){
+      m_mutex.unlock();
+      break;
     }
-    if((imdata.pc.size() > 0) && (imdata.imtype == IMTYPE_LR)){
-      getFilename(m_pc_fname, m_folder, m_pc_subfolder, "spc_");
-      QString fname = m_pc_fname + suffix.replace(ext.toLower(), "ply");
-      saveColoredSparsePLYFile(imdata.pc, imdata.left, fname);
+    EncodedFrame frame = std::move(next->second);
+    m_done.erase(next);
+    m_next_write++;
+    if(frame.skipped) {
+      m_mutex.unlock();
+      continue;
     }
 
+    QString prefixes[OUTPUT_COUNT];
+    prefixes[OUTPUT_LEFT] = m_left_fname;
+    prefixes[OUTPUT_RIGHT] = m_right_fname;
+    prefixes[OUTPUT_DISPARITY] = m_disparity_fname;
+    prefixes[OUTPUT_CONFIDENCE] = m_conf_fname;
+    prefixes[OUTPUT_DISPARITY_COLOR] = m_disparity_color_fname;
+    prefixes[OUTPUT_CONFIDENCE_COLOR] = m_conf_color_fname;
+    const bool sparse = std::any_of(frame.files.begin(), frame.files.end(),
+                                    [](const EncodedFile &file){ return file.stream == OUTPUT_POINTCLOUD; });
+    if(sparse && getFilename(m_pc_fname, m_folder, m_pc_subfolder, "spc_")) {
+      prefixes[OUTPUT_POINTCLOUD] = m_pc_fname;
+    }
+    QString padded_cntr = QString("%1").arg(m_frame_counter, 4, 10, QChar('0'));
     m_frame_counter += 1;
+    m_mutex.unlock();
+
+    for(const EncodedFile &file : frame.files) {
+      if(prefixes[file.stream].isEmpty())
+        continue;
+      QFile out(prefixes[file.stream] + padded_cntr + "_" + QString::number(frame.timestamp) + "." + file.ext);
+      if(out.open(QIODevice::WriteOnly)) {
+        out.write(file.data);
+      }
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_written++;
+    releaseSlot(frame.slot);
   }
 }
 
+DataThread::Stats DataThread::stats() {
+  QMutexLocker locker(&m_mutex);
+  return {static_cast<int>(m_slots.size() - m_free.size()), static_cast<int>(m_slots.size()),
+          static_cast<int>(m_encoders.size()), m_encode_ms, m_written, m_dropped_oldest + m_dropped_newest,
+          m_dropped_oldest, m_dropped_newest, m_blocked, m_blocked_ms, m_slot_bytes};
+}
+
 void  DataThread::setDepthMatrix(cv::Mat& qmat){
+  QMutexLocker locker(&m_mutex);
   m_matQ = qmat.clone();
 }
\ No newline at end of file
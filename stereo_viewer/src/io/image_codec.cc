@@ -0,0 +1,365 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file image_codec.cc Still image codecs used for recording
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/image_codec.hpp"
+
+#include <cstring>
+#include <memory>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+using namespace labforge::io;
+
+#define PNG_DEFAULT_LEVEL (6)     ///< zlib default, what the image files were written with so far
+#define JPEG_DEFAULT_QUALITY (90)
+#define ZSTD_DEFAULT_LEVEL (1)
+#define QOI_HEADER_SIZE (14)
+#define QOI_END_SIZE (8)
+
+CodecSettings labforge::io::parseCodec(const QString &format) {
+  const QString key = format.toUpper();
+  if(key.startsWith("PNG")) {
+    bool ok;
+    const int level = key.mid(3).toInt(&ok);
+    return {CODEC_PNG, ok ? level : -1};
+  }
+  if((key == "JPG") || (key == "JPEG"))
+    return {CODEC_JPEG, -1};
+  if(key == "PPM")
+    return {CODEC_PPM, -1};
+  if(key == "QOI")
+    return {CODEC_QOI, -1};
+  if(key == "ZSTD")
+    return {CODEC_ZSTD, -1};
+  if(key == "LZ4")
+    return {CODEC_LZ4, -1};
+  return {CODEC_BMP, -1};
+}
+
+const char *labforge::io::codecExtension(ImageCodec codec) {
+  static const char *s_extensions[CODEC_COUNT] = {"bmp", "png", "jpg", "ppm", "qoi", "zst", "lz4"};
+  return s_extensions[codec];
+}
+
+const char *labforge::io::codecName(ImageCodec codec) {
+  static const char *s_names[CODEC_COUNT] = {"BMP", "PNG", "JPEG", "PPM", "QOI", "zstd", "LZ4"};
+  return s_names[codec];
+}
+
+bool labforge::io::codecLossless(ImageCodec codec) {
+  return codec != CODEC_JPEG;
+}
+
+bool labforge::io::codecAvailable(ImageCodec codec) {
+  switch(codec) {
+    case CODEC_ZSTD:
+#ifdef HAVE_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    case CODEC_LZ4:
+#ifdef HAVE_LZ4
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return true;
+  }
+}
+
+static void s_put32(std::vector<uint8_t> &out, uint32_t value) {
+  out.push_back(static_cast<uint8_t>(value >> 24));
+  out.push_back(static_cast<uint8_t>(value >> 16));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+static uint32_t s_get32(const uint8_t *data) {
+  return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+         (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+namespace {
+struct QoiPixel {
+  uint8_t r, g, b, a;
+  bool operator==(const QoiPixel &other) const {
+    return (r == other.r) && (g == other.g) && (b == other.b) && (a == other.a);
+  }
+  int hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+};
+}
+
+/**
+ * QOI with 3 channels, see https://qoiformat.org/qoi-specification.pdf
+ */
+static void s_encode_qoi(const cv::Mat &bgr, std::vector<uint8_t> &out) {
+  out.clear();
+  // Worst case is a tagged RGB triple per pixel
+  out.reserve(QOI_HEADER_SIZE + bgr.total() * 4 + QOI_END_SIZE);
+  out.insert(out.end(), {'q', 'o', 'i', 'f'});
+  s_put32(out, bgr.cols);
+  s_put32(out, bgr.rows);
+  out.push_back(3);
+  out.push_back(0);
+
+  QoiPixel index[64] = {};
+  QoiPixel prev = {0, 0, 0, 255};
+  int run = 0;
+  for(int y = 0; y < bgr.rows; ++y) {
+    const uint8_t *row = bgr.ptr<uint8_t>(y);
+    for(int x = 0; x < bgr.cols; ++x) {
+      const QoiPixel px = {row[3 * x + 2], row[3 * x + 1], row[3 * x], 255};
+      if(px == prev) {
+        if(++run == 62) {
+          out.push_back(0xc0 | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+      if(run > 0) {
+        out.push_back(0xc0 | (run - 1));
+        run = 0;
+      }
+
+      const int slot = px.hash();
+      if(index[slot] == px) {
+        out.push_back(static_cast<uint8_t>(slot));
+      } else {
+        index[slot] = px;
+        const int8_t vr = static_cast<int8_t>(px.r - prev.r);
+        const int8_t vg = static_cast<int8_t>(px.g - prev.g);
+        const int8_t vb = static_cast<int8_t>(px.b - prev.b);
+        const int8_t vg_r = static_cast<int8_t>(vr - vg);
+        const int8_t vg_b = static_cast<int8_t>(vb - vg);
+        if((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) && (vb > -3) && (vb < 2)) {
+          out.push_back(0x40 | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+        } else if((vg_r > -9) && (vg_r < 8) && (vg > -33) && (vg < 32) && (vg_b > -9) && (vg_b < 8)) {
+          out.push_back(0x80 | (vg + 32));
+          out.push_back(((vg_r + 8) << 4) | (vg_b + 8));
+        } else {
+          out.insert(out.end(), {0xfe, px.r, px.g, px.b});
+        }
+      }
+      prev = px;
+    }
+  }
+  if(run > 0)
+    out.push_back(0xc0 | (run - 1));
+  out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+}
+
+static bool s_decode_qoi(const uint8_t *data, size_t size, cv::Mat &out) {
+  if((size < QOI_HEADER_SIZE + QOI_END_SIZE) || (memcmp(data, "qoif", 4) != 0))
+    return false;
+  const uint32_t width = s_get32(data + 4);
+  const uint32_t height = s_get32(data + 8);
+  if((width == 0) || (height == 0) || (width > 65535) || (height > 65535))
+    return false;
+  out.create(height, width, CV_8UC3);
+
+  QoiPixel index[64] = {};
+  QoiPixel px = {0, 0, 0, 255};
+  int run = 0;
+  size_t pos = QOI_HEADER_SIZE;
+  const size_t end = size - QOI_END_SIZE;
+  for(int y = 0; y < out.rows; ++y) {
+    uint8_t *row = out.ptr<uint8_t>(y);
+    for(int x = 0; x < out.cols; ++x) {
+      if(run > 0) {
+        run--;
+      } else if(pos < end) {
+        const uint8_t b1 = data[pos++];
+        if(b1 == 0xfe) {
+          if(pos + 3 > end)
+            return false;
+          px.r = data[pos];
+          px.g = data[pos + 1];
+          px.b = data[pos + 2];
+          pos += 3;
+        } else if(b1 == 0xff) {
+          if(pos + 4 > end)
+            return false;
+          px = {data[pos], data[pos + 1], data[pos + 2], data[pos + 3]};
+          pos += 4;
+        } else if((b1 & 0xc0) == 0x00) {
+          px = index[b1];
+        } else if((b1 & 0xc0) == 0x40) {
+          px.r += ((b1 >> 4) & 0x03) - 2;
+          px.g += ((b1 >> 2) & 0x03) - 2;
+          px.b += (b1 & 0x03) - 2;
+        } else if((b1 & 0xc0) == 0x80) {
+          if(pos >= end)
+            return false;
+          const uint8_t b2 = data[pos++];
+          const int vg = (b1 & 0x3f) - 32;
+          px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+          px.g += vg;
+          px.b += vg - 8 + (b2 & 0x0f);
+        } else {
+          run = b1 & 0x3f;
+        }
+        index[px.hash()] = px;
+      }
+      row[3 * x] = px.b;
+      row[3 * x + 1] = px.g;
+      row[3 * x + 2] = px.r;
+    }
+  }
+  return true;
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * One context per thread, allocating it per frame costs more than compressing small frames.
+ */
+static ZSTD_CCtx *s_zstd_context() {
+  thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+  return context.get();
+}
+#endif
+
+static bool s_encode_raw(const cv::Mat &image, const CodecSettings &settings, std::vector<uint8_t> &out) {
+  const cv::Mat packed = image.isContinuous() ? image : image.clone();
+  const size_t size = packed.total() * packed.elemSize();
+  RawImageHeader header = {};
+  memcpy(header.magic, IMAGE_CODEC_MAGIC, sizeof(header.magic));
+  header.width = packed.cols;
+  header.height = packed.rows;
+  header.type = packed.type();
+  header.codec = settings.codec;
+  header.size = size;
+
+  size_t compressed = 0;
+  switch(settings.codec) {
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD: {
+      const size_t bound = ZSTD_compressBound(size);
+      out.resize(sizeof(header) + bound);
+      const int level = (settings.level < 0) ? ZSTD_DEFAULT_LEVEL : settings.level;
+      compressed = ZSTD_compressCCtx(s_zstd_context(), out.data() + sizeof(header), bound, packed.data, size, level);
+      if(ZSTD_isError(compressed))
+        return false;
+      break;
+    }
+#endif
+#ifdef HAVE_LZ4
+    case CODEC_LZ4: {
+      if(size > LZ4_MAX_INPUT_SIZE)
+        return false;
+      const int bound = LZ4_compressBound(static_cast<int>(size));
+      out.resize(sizeof(header) + bound);
+      const int written = LZ4_compress_default(reinterpret_cast<const char *>(packed.data),
+                                               reinterpret_cast<char *>(out.data() + sizeof(header)),
+                                               static_cast<int>(size), bound);
+      if(written <= 0)
+        return false;
+      compressed = written;
+      break;
+    }
+#endif
+    default:
+      return false;
+  }
+  out.resize(sizeof(header) + compressed);
+  memcpy(out.data(), &header, sizeof(header));
+  return true;
+}
+
+static bool s_decode_raw(const uint8_t *data, size_t size, cv::Mat &out) {
+  RawImageHeader header;
+  if(size < sizeof(header))
+    return false;
+  memcpy(&header, data, sizeof(header));
+  if(memcmp(header.magic, IMAGE_CODEC_MAGIC, sizeof(header.magic)) != 0)
+    return false;
+  out.create(header.height, header.width, header.type);
+  if(out.total() * out.elemSize() != header.size)
+    return false;
+
+  const uint8_t *src = data + sizeof(header);
+  const size_t length = size - sizeof(header);
+  switch(header.codec) {
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+      return ZSTD_decompress(out.data, header.size, src, length) == header.size;
+#endif
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:
+      return LZ4_decompress_safe(reinterpret_cast<const char *>(src), reinterpret_cast<char *>(out.data),
+                                 static_cast<int>(length), static_cast<int>(header.size)) ==
+             static_cast<int>(header.size);
+#endif
+    default:
+      return false;
+  }
+}
+
+bool labforge::io::encodeImage(const cv::Mat &image, const CodecSettings &settings, std::vector<uint8_t> &out) {
+  if(image.empty() || !codecAvailable(settings.codec))
+    return false;
+  cv::Mat bgr = image;
+  if(image.type() == CV_8UC4) {
+    cv::cvtColor(image, bgr, cv::COLOR_BGRA2BGR);
+  }
+  if((settings.codec == CODEC_ZSTD) || (settings.codec == CODEC_LZ4))
+    return s_encode_raw(bgr, settings, out);
+
+  // Unpacked layouts are left to the raw codecs, 16-bit values to PNG
+  const int type = image.type();
+  if((type == CV_8UC2) || ((type == CV_16UC1) && (settings.codec != CODEC_PNG)))
+    return false;
+
+  if(settings.codec == CODEC_QOI) {
+    if(bgr.type() == CV_8UC1) {
+      cv::cvtColor(image, bgr, cv::COLOR_GRAY2BGR);
+    }
+    s_encode_qoi(bgr, out);
+    return true;
+  }
+
+  std::vector<int> params;
+  if(settings.codec == CODEC_PNG) {
+    params = {cv::IMWRITE_PNG_COMPRESSION, (settings.level < 0) ? PNG_DEFAULT_LEVEL : settings.level};
+  } else if(settings.codec == CODEC_JPEG) {
+    params = {cv::IMWRITE_JPEG_QUALITY, (settings.level < 0) ? JPEG_DEFAULT_QUALITY : settings.level};
+  }
+  return cv::imencode(std::string(".") + codecExtension(settings.codec), bgr, out, params);
+}
+
+bool labforge::io::decodeImage(const uint8_t *data, size_t size, ImageCodec codec, cv::Mat &out) {
+  switch(codec) {
+    case CODEC_QOI:
+      return s_decode_qoi(data, size, out);
+    case CODEC_ZSTD:
+    case CODEC_LZ4:
+      return s_decode_raw(data, size, out);
+    default:
+      out = cv::imdecode(cv::Mat(1, static_cast<int>(size), CV_8UC1, const_cast<uint8_t *>(data)),
+                         cv::IMREAD_UNCHANGED);
+      return !out.empty();
+  }
+}
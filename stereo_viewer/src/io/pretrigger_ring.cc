@@ -0,0 +1,177 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file pretrigger_ring.cc In-memory history of raw frames ahead of a trigger
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/pretrigger_ring.hpp"
+
+#include <cstring>
+#include <new>
+
+using namespace labforge::io;
+
+/**
+ * Payloads start on cache lines.
+ */
+static size_t s_pad(size_t size) {
+  return (size + 63) & ~static_cast<size_t>(63);
+}
+
+PreTriggerRing::PreTriggerRing()
+: m_span_ms(0), m_head(0), m_count(0), m_begin(0), m_end(0), m_used(0) {
+}
+
+bool PreTriggerRing::allocate(int seconds, size_t budget) {
+  m_span_ms = static_cast<uint64_t>(seconds) * 1000;
+  clear();
+  if(m_memory.size() == budget)
+    return true;
+  release();
+  try {
+    // Value initialized, every page is written once here rather than while streaming
+    m_memory.resize(budget);
+    m_slots.resize(PRETRIGGER_MAX_FRAMES);
+  } catch(const std::bad_alloc &) {
+    release();
+    return false;
+  }
+  return true;
+}
+
+void PreTriggerRing::release() {
+  std::vector<uint8_t>().swap(m_memory);
+  std::vector<Slot>().swap(m_slots);
+  clear();
+}
+
+void PreTriggerRing::clear() {
+  m_head = 0;
+  m_count = 0;
+  m_begin = 0;
+  m_end = 0;
+  m_used = 0;
+}
+
+uint64_t PreTriggerRing::span() const {
+  if(m_count < 2)
+    return 0;
+  return slot(m_count - 1).real_time - slot(0).real_time;
+}
+
+void PreTriggerRing::pop() {
+  m_used -= slot(0).total;
+  m_head = (m_head + 1) % m_slots.size();
+  m_count--;
+  if(m_count == 0) {
+    m_begin = 0;
+    m_end = 0;
+  } else {
+    m_begin = slot(0).offset;
+  }
+}
+
+bool PreTriggerRing::push(const RawFrame &frame) {
+  if(!isAllocated())
+    return false;
+
+  Slot entry = {};
+  entry.counter = frame.counter;
+  entry.real_time = frame.real_time;
+  entry.min_disparity = frame.min_disparity;
+  for(int part = 0; part < 2; ++part) {
+    const cv::Mat &image = frame.images[part];
+    entry.formats[part] = image.empty() ? RAW_FORMAT_NONE : frame.formats[part];
+    entry.rows[part] = image.rows;
+    entry.cols[part] = image.cols;
+    entry.types[part] = image.type();
+    entry.sizes[part] = image.total() * image.elemSize();
+    entry.total += s_pad(entry.sizes[part]);
+  }
+  entry.sizes[RAW_SESSION_CHUNKS] = frame.chunks.size();
+  entry.total += s_pad(frame.chunks.size());
+  if(entry.total > m_memory.size())
+    return false;
+
+  // Free the oldest frames until there is a contiguous gap, wrapping to the start if the tail is too short
+  while(true) {
+    if(m_count == 0) {
+      entry.offset = 0;
+      break;
+    }
+    if(m_count < m_slots.size()) {
+      if(m_end > m_begin) {
+        if(m_memory.size() - m_end >= entry.total) {
+          entry.offset = m_end;
+          break;
+        }
+        if(m_begin >= entry.total) {
+          entry.offset = 0;
+          break;
+        }
+      } else if(m_begin - m_end >= entry.total) {
+        entry.offset = m_end;
+        break;
+      }
+    }
+    pop();
+  }
+
+  uint8_t *data = m_memory.data() + entry.offset;
+  for(int part = 0; part < 2; ++part) {
+    if(entry.sizes[part] > 0) {
+      // Header over ring memory of the same size and type, copyTo does not reallocate
+      cv::Mat packed(entry.rows[part], entry.cols[part], entry.types[part], data);
+      frame.images[part].copyTo(packed);
+    }
+    data += s_pad(entry.sizes[part]);
+  }
+  if(!frame.chunks.empty())
+    memcpy(data, frame.chunks.data(), frame.chunks.size());
+
+  if(m_count == 0)
+    m_begin = entry.offset;
+  m_end = entry.offset + entry.total;
+  m_slots[(m_head + m_count) % m_slots.size()] = entry;
+  m_count++;
+  m_used += entry.total;
+
+  while((m_count > 1) && (span() > m_span_ms)) {
+    pop();
+  }
+  return true;
+}
+
+void PreTriggerRing::frame(size_t i, RawFrame &out, const uint8_t **chunks, size_t *chunk_size) const {
+  const Slot &entry = slot(i);
+  out.counter = entry.counter;
+  out.real_time = entry.real_time;
+  out.min_disparity = entry.min_disparity;
+  out.chunks.clear();
+
+  uint8_t *data = const_cast<uint8_t *>(m_memory.data()) + entry.offset;
+  for(int part = 0; part < 2; ++part) {
+    out.formats[part] = entry.formats[part];
+    if(entry.sizes[part] > 0) {
+      out.images[part] = cv::Mat(entry.rows[part], entry.cols[part], entry.types[part], data);
+    } else {
+      out.images[part] = cv::Mat();
+    }
+    data += s_pad(entry.sizes[part]);
+  }
+  *chunks = data;
+  *chunk_size = entry.sizes[RAW_SESSION_CHUNKS];
+}
@@ -0,0 +1,486 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file raw_session.cc Append-only container for unencoded recordings
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/raw_session.hpp"
+#include "io/pretrigger_ring.hpp"
+
+#include <QDir>
+#include <algorithm>
+#include <cstring>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace labforge::io;
+
+static QString s_segment_name(const QString &folder, int number) {
+  return QDir(folder).filePath(QString("segment_%1.bin").arg(number, 4, 10, QChar('0')));
+}
+
+static QString s_index_name(const QString &folder) {
+  return QDir(folder).filePath("index.bin");
+}
+
+RawSessionWriter::RawSessionWriter()
+: m_segment(-1), m_last_ticket(0), m_segment_size(RAW_SESSION_SEGMENT_SIZE), m_segment_number(-1), m_offset(0),
+  m_frames(0), m_bytes(0) {
+}
+
+bool RawSessionWriter::open(const QString &folder, int64_t segment_size) {
+  close();
+  if(!QDir().mkpath(folder))
+    return false;
+  m_folder = folder;
+  m_segment_size = segment_size;
+  m_segment_number = -1;
+  m_frames = 0;
+  m_bytes = 0;
+
+  m_index_synced = std::chrono::steady_clock::now();
+  m_index.setFileName(s_index_name(folder));
+  if(!m_index.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  // Large payloads bypass the page cache, it would only be evicted again
+  m_io = AsyncWriter::create();
+  RawIndexHeader header = {};
+  memcpy(header.magic, RAW_SESSION_MAGIC, sizeof(header.magic));
+  header.version = RAW_SESSION_VERSION;
+  header.entry_size = sizeof(RawIndexEntry);
+  header.segment_size = segment_size;
+  if((m_index.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header)) || !nextSegment()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void RawSessionWriter::close() {
+  if(m_io) {
+    m_io->drain();
+    if(m_index.isOpen())
+      writeIndex();
+    closeSegment();
+    m_io.reset();
+  }
+  m_entries.clear();
+  if(m_index.isOpen())
+    m_index.close();
+}
+
+bool RawSessionWriter::closeSegment() {
+  if(m_segment < 0)
+    return true;
+  // Gives back the unused preallocation
+  const bool closed = m_io->close(m_segment, m_offset);
+  m_segment = -1;
+  return closed;
+}
+
+bool RawSessionWriter::nextSegment() {
+  if(!closeSegment())
+    return false;
+  if(m_segment_number >= UINT16_MAX)
+    return false;
+  m_segment_number++;
+  m_offset = 0;
+
+  // Reserve the segment up front, keeps it contiguous and fails early on a full disk
+  m_segment = m_io->open(s_segment_name(m_folder, m_segment_number), m_segment_size);
+  return m_segment >= 0;
+}
+
+bool RawSessionWriter::writePayload(RawFormat format, const uint8_t *data, size_t size, int width, int height,
+                                    RawPayload &out) {
+  out = {};
+  if(size == 0)
+    return true;
+  if(size > UINT32_MAX)
+    return false;
+
+  int64_t offset = ((m_offset + RAW_SESSION_ALIGNMENT - 1) / RAW_SESSION_ALIGNMENT) * RAW_SESSION_ALIGNMENT;
+  // Payloads larger than a segment get one of their own and grow it
+  if((offset + static_cast<int64_t>(size) > m_segment_size) && (m_offset > 0)) {
+    if(!nextSegment())
+      return false;
+    offset = 0;
+  }
+  // Split into pool buffers, each piece starts aligned as the buffer size is
+  for(size_t done = 0; done < size;) {
+    AsyncWriter::Buffer buffer = m_io->acquire();
+    if(buffer.data == nullptr)
+      return false;
+    const size_t length = std::min(size - done, m_io->bufferSize());
+    memcpy(buffer.data, data + done, length);
+    m_last_ticket = m_io->write(m_segment, offset + done, buffer, length);
+    done += length;
+  }
+  if(m_io->failed())
+    return false;
+
+  m_offset = offset + size;
+  m_bytes += size;
+  out.offset = offset;
+  out.size = static_cast<uint32_t>(size);
+  out.format = format;
+  out.segment = static_cast<uint16_t>(m_segment_number);
+  out.width = static_cast<uint16_t>(width);
+  out.height = static_cast<uint16_t>(height);
+  return true;
+}
+
+bool RawSessionWriter::writeIndex() {
+  const uint64_t completed = m_io->completed();
+  bool written = false;
+  while(!m_entries.empty() && (m_entries.front().first <= completed)) {
+    const RawIndexEntry &entry = m_entries.front().second;
+    if(m_index.write(reinterpret_cast<const char *>(&entry), sizeof(entry)) != sizeof(entry))
+      return false;
+    m_entries.pop_front();
+    m_frames++;
+    written = true;
+  }
+  if(!written)
+    return true;
+  // Out of the write buffer, survives the application being killed
+  if(!m_index.flush())
+    return false;
+  // On the disk, survives a power loss, completed payloads were written past the page cache
+  const auto now = std::chrono::steady_clock::now();
+  if(now - m_index_synced >= std::chrono::milliseconds(RAW_SESSION_INDEX_SYNC_MS)) {
+    m_index_synced = now;
+#ifdef __linux__
+    return fdatasync(m_index.handle()) == 0;
+#endif
+  }
+  return true;
+}
+
+bool RawSessionWriter::append(const RawFrame &frame, const uint8_t *chunks, size_t chunk_size) {
+  if(!isOpen() || m_io->failed())
+    return false;
+
+  RawIndexEntry entry = {};
+  entry.counter = frame.counter;
+  entry.real_time = frame.real_time;
+  entry.min_disparity = frame.min_disparity;
+  for(int part = 0; part < 2; ++part) {
+    const cv::Mat &image = frame.images[part];
+    if(image.empty())
+      continue;
+    const uint8_t *data = image.data;
+    const size_t size = image.total() * image.elemSize();
+    if(!image.isContinuous()) {
+      m_staging.resize(size);
+      cv::Mat packed(image.rows, image.cols, image.type(), m_staging.data());
+      image.copyTo(packed);
+      data = m_staging.data();
+    }
+    if(!writePayload(frame.formats[part], data, size, image.cols, image.rows, entry.payloads[part]))
+      return false;
+  }
+  if(!writePayload(RAW_FORMAT_CHUNKS, chunks, chunk_size, 0, 0,
+                   entry.payloads[RAW_SESSION_CHUNKS]))
+    return false;
+
+  // The entry only becomes visible once the payloads are complete
+  m_entries.emplace_back(m_last_ticket, entry);
+  m_io->submit();
+  return writeIndex();
+}
+
+RawSessionReader::RawSessionReader() {
+}
+
+bool RawSessionReader::open(const QString &folder) {
+  close();
+  QFile index(s_index_name(folder));
+  if(!index.open(QIODevice::ReadOnly))
+    return false;
+
+  RawIndexHeader header;
+  if((index.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)) ||
+     (memcmp(header.magic, RAW_SESSION_MAGIC, sizeof(header.magic)) != 0) ||
+     (header.version != RAW_SESSION_VERSION) || (header.entry_size != sizeof(RawIndexEntry)))
+    return false;
+
+  // A partial entry at the end of an interrupted session is ignored
+  const qint64 count = (index.size() - static_cast<qint64>(sizeof(header))) / sizeof(RawIndexEntry);
+  const qint64 bytes = count * sizeof(RawIndexEntry);
+  m_entries.resize(count);
+  if(index.read(reinterpret_cast<char *>(m_entries.data()), bytes) != bytes) {
+    m_entries.clear();
+    return false;
+  }
+  m_folder = folder;
+  return true;
+}
+
+void RawSessionReader::close() {
+  m_segments.clear();
+  m_entries.clear();
+  m_folder.clear();
+}
+
+size_t RawSessionReader::findFrame(uint64_t counter) const {
+  auto it = std::lower_bound(m_entries.begin(), m_entries.end(), counter,
+                             [](const RawIndexEntry &entry, uint64_t value) { return entry.counter < value; });
+  return it - m_entries.begin();
+}
+
+size_t RawSessionReader::findTime(uint64_t real_time) const {
+  auto it = std::lower_bound(m_entries.begin(), m_entries.end(), real_time,
+                             [](const RawIndexEntry &entry, uint64_t value) { return entry.real_time < value; });
+  return it - m_entries.begin();
+}
+
+bool RawSessionReader::readPayload(const RawPayload &payload, uint8_t *out) {
+  std::unique_ptr<QFile> &file = m_segments[payload.segment];
+  if(!file) {
+    file = std::make_unique<QFile>(s_segment_name(m_folder, payload.segment));
+    if(!file->open(QIODevice::ReadOnly)) {
+      m_segments.erase(payload.segment);
+      return false;
+    }
+  }
+  return file->seek(payload.offset) &&
+         (file->read(reinterpret_cast<char *>(out), payload.size) == static_cast<qint64>(payload.size));
+}
+
+bool RawSessionReader::readImage(size_t i, int part, cv::Mat &out) {
+  if((i >= m_entries.size()) || (part < 0) || (part > 1))
+    return false;
+  const RawPayload &payload = m_entries[i].payloads[part];
+  int type;
+  switch(payload.format) {
+    case RAW_FORMAT_YUYV:
+      type = CV_8UC2;
+      break;
+    case RAW_FORMAT_DISPARITY:
+    case RAW_FORMAT_CONFIDENCE:
+      type = CV_16UC1;
+      break;
+    default:
+      return false;
+  }
+  out.create(payload.height, payload.width, type);
+  if(out.total() * out.elemSize() != payload.size)
+    return false;
+  return readPayload(payload, out.data);
+}
+
+bool RawSessionReader::readChunks(size_t i, std::vector<uint8_t> &out) {
+  out.clear();
+  if(i >= m_entries.size())
+    return false;
+  const RawPayload &payload = m_entries[i].payloads[RAW_SESSION_CHUNKS];
+  if(payload.format != RAW_FORMAT_CHUNKS)
+    return false;
+  out.resize(payload.size);
+  return readPayload(payload, out.data());
+}
+
+RawRecorder::RawRecorder(QObject *parent)
+: QThread(parent), m_ring(std::make_unique<PreTriggerRing>()), m_open(false), m_armed(false), m_flushing(false),
+  m_writing(false), m_failed(false), m_abort(false), m_dropped(0), m_written(0), m_bytes(0) {
+}
+
+RawRecorder::~RawRecorder() {
+  close();
+  m_mutex.lock();
+  m_abort = true;
+  m_mutex.unlock();
+  m_condition.wakeAll();
+  wait();
+}
+
+bool RawRecorder::open(const QString &folder) {
+  close();
+  // The thread is idle, it only touches the writer while frames are queued
+  QMutexLocker locker(&m_mutex);
+  if(!m_writer.open(folder))
+    return false;
+  m_open = true;
+  m_failed = false;
+  m_written = 0;
+  m_dropped = 0;
+  m_bytes = 0;
+  if(!isRunning())
+    start(HighPriority);
+  return true;
+}
+
+bool RawRecorder::arm(int seconds) {
+  close();
+  QMutexLocker locker(&m_mutex);
+  if(!m_ring->allocate(seconds))
+    return false;
+  m_armed = true;
+  m_failed = false;
+  m_written = 0;
+  m_dropped = 0;
+  m_bytes = 0;
+  if(!isRunning())
+    start(HighPriority);
+  return true;
+}
+
+bool RawRecorder::trigger(const QString &folder) {
+  QMutexLocker locker(&m_mutex);
+  if(!m_armed || !m_writer.open(folder))
+    return false;
+  // The history is no longer written to, the thread reads it without the lock
+  m_armed = false;
+  m_open = true;
+  m_flushing = (m_ring->size() > 0);
+  m_condition.wakeOne();
+  return true;
+}
+
+void RawRecorder::close() {
+  QMutexLocker locker(&m_mutex);
+  if(m_armed) {
+    m_armed = false;
+    m_ring->release();
+    return;
+  }
+  if(!m_open)
+    return;
+  m_open = false;
+  while(!m_queue.isEmpty() || m_writing || m_flushing)
+    m_drained.wait(&m_mutex);
+  m_writer.close();
+  m_ring->release();
+}
+
+bool RawRecorder::isOpen() {
+  QMutexLocker locker(&m_mutex);
+  return m_open || m_armed;
+}
+
+bool RawRecorder::isArmed() {
+  QMutexLocker locker(&m_mutex);
+  return m_armed;
+}
+
+bool RawRecorder::process(const RawFrame &frame) {
+  {
+    QMutexLocker locker(&m_mutex);
+    if(m_armed) {
+      if(!m_ring->push(frame)) {
+        m_dropped++;
+        return false;
+      }
+      return true;
+    }
+    if(!m_open || m_failed)
+      return false;
+    if(m_queue.size() >= RAW_SESSION_MAX_PENDING) {
+      m_dropped++;
+      return false;
+    }
+  }
+
+  // The stream buffers are requeued once the frame is handled
+  RawFrame queued;
+  queued.counter = frame.counter;
+  queued.real_time = frame.real_time;
+  queued.min_disparity = frame.min_disparity;
+  for(int part = 0; part < 2; ++part) {
+    queued.formats[part] = frame.images[part].empty() ? RAW_FORMAT_NONE : frame.formats[part];
+    queued.images[part] = frame.images[part].clone();
+  }
+  queued.chunks = frame.chunks;
+
+  QMutexLocker locker(&m_mutex);
+  m_queue.enqueue(std::move(queued));
+  m_condition.wakeOne();
+  return true;
+}
+
+RawRecorder::Stats RawRecorder::stats() {
+  QMutexLocker locker(&m_mutex);
+  const bool history = m_armed || m_flushing;
+  return {static_cast<int>(m_queue.size()) + (m_writing ? 1 : 0), RAW_SESSION_MAX_PENDING, m_written, m_dropped,
+          m_bytes, m_failed, m_writer.backend(), m_armed, history ? m_ring->size() : 0,
+          history ? m_ring->span() : 0, history ? m_ring->bytes() : 0};
+}
+
+void RawRecorder::flush() {
+  RawFrame frame;
+  const uint8_t *chunks;
+  size_t chunk_size;
+  for(size_t i = 0; i < m_ring->size(); ++i) {
+    m_ring->frame(i, frame, &chunks, &chunk_size);
+    const bool written = m_writer.append(frame, chunks, chunk_size);
+
+    QMutexLocker locker(&m_mutex);
+    if(!written) {
+      m_failed = true;
+      m_dropped += m_ring->size() - i + m_queue.size();
+      m_queue.clear();
+      break;
+    }
+    m_written++;
+    m_bytes = m_writer.bytes();
+  }
+
+  QMutexLocker locker(&m_mutex);
+  m_ring->clear();
+  m_flushing = false;
+  if(m_queue.isEmpty())
+    m_drained.wakeAll();
+}
+
+void RawRecorder::run() {
+  while(true) {
+    m_mutex.lock();
+    while(m_queue.isEmpty() && !m_flushing && !m_abort) {
+      m_condition.wait(&m_mutex);
+    }
+    if(m_abort) {
+      m_mutex.unlock();
+      break;
+    }
+    if(m_flushing) {
+      // History first, frames received since the trigger wait in the queue
+      m_mutex.unlock();
+      flush();
+      continue;
+    }
+    RawFrame frame = m_queue.dequeue();
+    m_writing = true;
+    m_mutex.unlock();
+
+    const bool written = m_writer.append(frame);
+
+    QMutexLocker locker(&m_mutex);
+    m_writing = false;
+    if(written) {
+      m_written++;
+      m_bytes = m_writer.bytes();
+    } else {
+      // Most likely out of space, the session stays readable up to here
+      m_failed = true;
+      m_dropped += 1 + m_queue.size();
+      m_queue.clear();
+    }
+    if(m_queue.isEmpty())
+      m_drained.wakeAll();
+  }
+}
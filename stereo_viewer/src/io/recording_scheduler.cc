@@ -0,0 +1,239 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file recording_scheduler.cc Adapts recordings to the bandwidth and space of the disk
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/recording_scheduler.hpp"
+#include "io/image_codec.hpp"
+
+#include <QDir>
+#include <QFile>
+#include <QStorageInfo>
+#include <algorithm>
+#include <vector>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace labforge::io;
+
+#define MB (1024.0 * 1024.0)
+
+/**
+ * Factor the data rate grows by when restoring the level before this one.
+ */
+static double s_restore_factor(RecordingLevel level) {
+  return ((level == RECORD_HALF_RATE) || (level == RECORD_QUARTER_RATE)) ? 2.0 : 1.0;
+}
+
+RecordingScheduler::RecordingScheduler()
+: m_active(false), m_adaptive(true), m_level(RECORD_FULL), m_probe_mb_s(0), m_cancel(false), m_free_bytes(0),
+  m_free_known(false), m_rebase(false), m_write_mb_s(0), m_fill(0), m_dropped(0), m_pressure_ms(0), m_headroom_ms(0), m_changes(0),
+  m_frames(0) {
+}
+
+RecordingScheduler::~RecordingScheduler() {
+  stop();
+}
+
+void RecordingScheduler::start(const QString &folder, bool adaptive) {
+  stop();
+  m_folder = folder;
+  m_adaptive = adaptive;
+  m_level = RECORD_FULL;
+  m_probe_mb_s = 0;
+  m_cancel = false;
+  const QStorageInfo storage(folder);
+  m_free_known = storage.isValid();
+  m_free_bytes = m_free_known ? static_cast<uint64_t>(storage.bytesAvailable()) : 0;
+  m_rebase = false;
+  m_write_mb_s = 0;
+  m_fill = 0;
+  m_dropped = 0;
+  m_pressure_ms = 0;
+  m_headroom_ms = 0;
+  m_changes = 0;
+  m_frames = 0;
+  m_last_update = std::chrono::steady_clock::now();
+  m_active = true;
+  // Competes with the first seconds of the recording, the queue absorbs that
+  m_probe = std::thread(&RecordingScheduler::probe, this, folder);
+}
+
+void RecordingScheduler::stop() {
+  m_cancel = true;
+  if(m_probe.joinable())
+    m_probe.join();
+  m_active = false;
+  m_level = RECORD_FULL;
+}
+
+void RecordingScheduler::setAdaptive(bool adaptive) {
+  m_adaptive = adaptive;
+  if(!adaptive) {
+    m_level = RECORD_FULL;
+    m_pressure_ms = 0;
+    m_headroom_ms = 0;
+  }
+}
+
+void RecordingScheduler::probe(QString folder) {
+  // Never the write that fills the disk
+  const QStorageInfo storage(folder);
+  if(!storage.isValid() || (storage.bytesAvailable() < RECORDING_PROBE_BYTES + RECORDING_RESERVE_BYTES)) {
+    m_probe_mb_s = -1;
+    return;
+  }
+  // Written through to the disk, the page cache would report memory bandwidth
+  QFile file(QDir(folder).filePath(".write_probe"));
+  if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+    m_probe_mb_s = -1;
+    return;
+  }
+  std::vector<char> block(RECORDING_PROBE_BLOCK);
+  for(size_t i = 0; i < block.size(); ++i) {
+    // Not zeros, compressing file systems would skip them
+    block[i] = static_cast<char>(i * 2654435761U >> 24);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  int64_t written = 0;
+  bool ok = true;
+  while(ok && (written < RECORDING_PROBE_BYTES) && !m_cancel) {
+    ok = file.write(block.data(), static_cast<qint64>(block.size())) == static_cast<qint64>(block.size());
+    written += static_cast<int64_t>(block.size());
+  }
+#ifdef __linux__
+  ok = ok && (fdatasync(file.handle()) == 0);
+#else
+  ok = ok && file.flush();
+#endif
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  file.close();
+  file.remove();
+  if(m_cancel)
+    return;
+  m_probe_mb_s = (ok && (seconds > 0)) ? (written / MB) / seconds : -1;
+}
+
+bool RecordingScheduler::update(const Sample &sample) {
+  if(!m_active)
+    return false;
+  const auto now = std::chrono::steady_clock::now();
+  const double elapsed_ms = std::chrono::duration<double, std::milli>(now - m_last_update).count();
+  m_last_update = now;
+
+  // The live data rate is what leaves the folder, whichever recorder writes to it
+  const QStorageInfo storage(m_folder);
+  if(storage.isValid()) {
+    const uint64_t free_bytes = static_cast<uint64_t>(storage.bytesAvailable());
+    // The probe file takes space while it exists, skip until one sample after it was removed
+    const bool probing = (m_probe_mb_s == 0);
+    if(m_free_known && !probing && !m_rebase && (elapsed_ms > 0)) {
+      // Space freed by others counts as idle
+      const double written = (m_free_bytes > free_bytes) ? static_cast<double>(m_free_bytes - free_bytes) : 0.0;
+      const double rate = (written / MB) / (elapsed_ms / 1000.0);
+      m_write_mb_s = (m_write_mb_s == 0) ? rate : (0.8 * m_write_mb_s + 0.2 * rate);
+    }
+    m_free_bytes = free_bytes;
+    m_free_known = true;
+    m_rebase = probing;
+  }
+  m_fill = (sample.capacity > 0) ? static_cast<double>(sample.pending) / sample.capacity : 0.0;
+  const bool dropping = sample.dropped > m_dropped;
+  m_dropped = sample.dropped;
+  if(!m_adaptive)
+    return false;
+
+  const double probed = m_probe_mb_s;
+  const bool pressure = dropping || (m_fill > RECORDING_HIGH_FILL) ||
+                        ((probed > 0) && (m_write_mb_s > RECORDING_HIGH_LOAD * probed));
+  // Restoring a level must fit the headroom, or the next one would only undo it
+  const bool headroom = !dropping && (m_fill < RECORDING_LOW_FILL) &&
+                        ((probed <= 0) || (m_write_mb_s * s_restore_factor(m_level) < RECORDING_LOW_LOAD * probed));
+
+  // A late sample, e.g. behind a modal dialog, does not count as more than one missed period
+  const double step_ms = std::min(elapsed_ms, 2.0 * RECORDING_UPDATE_MS);
+  const RecordingLevel previous = m_level;
+  if(pressure) {
+    m_headroom_ms = 0;
+    m_pressure_ms += step_ms;
+    if((m_pressure_ms >= RECORDING_ESCALATE_MS) && (m_level + 1 < RECORD_LEVEL_COUNT)) {
+      m_level = static_cast<RecordingLevel>(m_level + 1);
+      m_pressure_ms = 0;
+    }
+  } else if(headroom) {
+    m_pressure_ms = 0;
+    m_headroom_ms += step_ms;
+    if((m_headroom_ms >= RECORDING_RELAX_MS) && (m_level > RECORD_FULL)) {
+      m_level = static_cast<RecordingLevel>(m_level - 1);
+      m_headroom_ms = 0;
+    }
+  } else {
+    m_pressure_ms = 0;
+    m_headroom_ms = 0;
+  }
+  if(m_level == previous)
+    return false;
+  m_changes++;
+  return true;
+}
+
+bool RecordingScheduler::admit() {
+  if(!m_active)
+    return true;
+  const uint64_t frame = m_frames++;
+  switch(m_level) {
+    case RECORD_HALF_RATE:
+      return (frame % 2) == 0;
+    case RECORD_QUARTER_RATE:
+      return (frame % 4) == 0;
+    default:
+      return true;
+  }
+}
+
+QString RecordingScheduler::format(const QString &selected) const {
+  if(m_level < RECORD_FAST_CODEC)
+    return selected;
+  // The other formats have no effort to lower, zstd already defaults to its fastest level
+  return (parseCodec(selected).codec == CODEC_PNG) ? QString("PNG1") : selected;
+}
+
+RecordingScheduler::Stats RecordingScheduler::stats() const {
+  Stats stats;
+  stats.level = m_level;
+  stats.probe_mb_s = m_probe_mb_s;
+  stats.write_mb_s = m_write_mb_s;
+  stats.free_bytes = m_free_bytes;
+  stats.fill = m_fill;
+  stats.changes = m_changes;
+  stats.full = m_free_known && (m_free_bytes < static_cast<uint64_t>(RECORDING_RESERVE_BYTES));
+  stats.seconds_to_full = -1;
+  if(m_free_known && (m_write_mb_s > 0.01)) {
+    const double left = stats.full ? 0.0 : static_cast<double>(m_free_bytes - RECORDING_RESERVE_BYTES);
+    stats.seconds_to_full = (left / MB) / m_write_mb_s;
+  }
+  return stats;
+}
+
+const char *RecordingScheduler::levelName(RecordingLevel level) {
+  static const char *s_names[RECORD_LEVEL_COUNT] = {
+    "full", "no point clouds", "fast codec", "half rate", "quarter rate"
+  };
+  return s_names[level];
+}
@@ -0,0 +1,297 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file video_recorder.cc Recording of output streams into video containers
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "io/video_recorder.hpp"
+#include "io/csv_logger.hpp"
+
+#include <QDir>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+using namespace labforge::io;
+
+static const char *s_stream_names[OUTPUT_COUNT] = {
+  "left", "right", "disparity", "confidence", "pointcloud", "disparity_color", "confidence_color"
+};
+
+static int s_fourcc(VideoCodec codec) {
+  switch(codec) {
+    case VIDEO_FFV1:
+      return cv::VideoWriter::fourcc('F', 'F', 'V', '1');
+    case VIDEO_MJPEG:
+      return cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+    case VIDEO_H264:
+      return cv::VideoWriter::fourcc('a', 'v', 'c', '1');
+    default:
+      return 0;
+  }
+}
+
+static const char *s_extension(VideoCodec codec) {
+  switch(codec) {
+    case VIDEO_MJPEG:
+      return ".avi";
+    case VIDEO_H264:
+      return ".mp4";
+    default:
+      return ".mkv";
+  }
+}
+
+namespace labforge::io {
+
+/**
+ * One container with its sidecar, encoded on its own thread.
+ */
+class VideoStream {
+public:
+  VideoStream(const QString &base, VideoCodec codec)
+  : m_base(base), m_codec(codec), m_native16(false), m_stop(false), m_written(0), m_dropped(0), m_failed(false) {
+    m_slots.resize(VIDEO_STREAM_SLOTS);
+    for(int i = 0; i < VIDEO_STREAM_SLOTS; ++i) {
+      m_free.push_back(i);
+    }
+    m_thread = std::thread(&VideoStream::run, this);
+  }
+
+  ~VideoStream() {
+    {
+      std::lock_guard<std::mutex> locker(m_lock);
+      m_stop = true;
+    }
+    m_queued.notify_one();
+    m_thread.join();
+  }
+
+  bool push(uint64_t counter, uint64_t real_time, const cv::Mat &image) {
+    int slot;
+    {
+      std::lock_guard<std::mutex> locker(m_lock);
+      if(m_failed || m_free.empty()) {
+        m_dropped++;
+        return false;
+      }
+      slot = m_free.back();
+      m_free.pop_back();
+    }
+
+    // Slot storage is reused while the size stays the same
+    Frame &frame = m_slots[slot];
+    frame.counter = counter;
+    frame.real_time = real_time;
+    image.copyTo(frame.image);
+
+    {
+      std::lock_guard<std::mutex> locker(m_lock);
+      m_queue.push_back(slot);
+    }
+    m_queued.notify_one();
+    return true;
+  }
+
+  void stats(VideoRecorder::Stats &stats) {
+    std::lock_guard<std::mutex> locker(m_lock);
+    stats.streams++;
+    stats.pending += static_cast<int>(VIDEO_STREAM_SLOTS - m_free.size());
+    stats.written += m_written;
+    stats.dropped += m_dropped;
+    stats.failed = stats.failed || m_failed;
+  }
+
+private:
+  struct Frame {
+    uint64_t counter;
+    uint64_t real_time;
+    cv::Mat image;
+  };
+
+  bool openWriter(const cv::Mat &first) {
+    const int fourcc = s_fourcc(m_codec);
+    QString name = m_base;
+    if(first.type() == CV_16UC1) {
+#if (CV_VERSION_MAJOR > 4) || ((CV_VERSION_MAJOR == 4) && (CV_VERSION_MINOR >= 8))
+      m_native16 = m_writer.open((m_base + s_extension(m_codec)).toStdString(), cv::CAP_FFMPEG, fourcc,
+                                 VIDEO_RECORDER_FPS, first.size(),
+                                 {cv::VIDEOWRITER_PROP_DEPTH, CV_16U, cv::VIDEOWRITER_PROP_IS_COLOR, 0});
+      if(m_native16)
+        return openSidecar(m_base);
+#endif
+      name += "_packed";
+    }
+    if(!m_writer.open((name + s_extension(m_codec)).toStdString(), fourcc, VIDEO_RECORDER_FPS, first.size(), true))
+      return false;
+    return openSidecar(name);
+  }
+
+  bool openSidecar(const QString &name) {
+    return m_timestamps.open(name + "_timestamps.csv", {"frame", "counter", "real_time"});
+  }
+
+  /**
+   * Convert to what the writer takes, BGR or 16-bit grayscale.
+   */
+  void convert(const cv::Mat &image, cv::Mat &out) {
+    switch(image.type()) {
+      case CV_8UC4:
+        cv::cvtColor(image, out, cv::COLOR_BGRA2BGR);
+        break;
+      case CV_8UC1:
+        cv::cvtColor(image, out, cv::COLOR_GRAY2BGR);
+        break;
+      case CV_16UC1:
+        if(m_native16) {
+          out = image;
+          break;
+        }
+        // Lossless with FFV1, the red channel stays empty
+        out.create(image.size(), CV_8UC3);
+        for(int y = 0; y < image.rows; ++y) {
+          const uint16_t *src = image.ptr<uint16_t>(y);
+          cv::Vec3b *dst = out.ptr<cv::Vec3b>(y);
+          for(int x = 0; x < image.cols; ++x) {
+            dst[x] = cv::Vec3b(static_cast<uchar>(src[x] & 0xFF), static_cast<uchar>(src[x] >> 8), 0);
+          }
+        }
+        break;
+      default:
+        out = image;
+        break;
+    }
+  }
+
+  void run() {
+    cv::Mat converted;
+    uint64_t index = 0;
+    while(true) {
+      int slot;
+      {
+        std::unique_lock<std::mutex> locker(m_lock);
+        m_queued.wait(locker, [this]() { return m_stop || !m_queue.empty(); });
+        if(m_queue.empty())
+          break;
+        slot = m_queue.front();
+        m_queue.pop_front();
+      }
+
+      Frame &frame = m_slots[slot];
+      bool ok = m_writer.isOpened() || openWriter(frame.image);
+      if(ok) {
+        convert(frame.image, converted);
+        m_writer.write(converted);
+        m_timestamps << index++ << frame.counter << frame.real_time;
+        m_timestamps.endRow();
+      }
+
+      std::lock_guard<std::mutex> locker(m_lock);
+      m_free.push_back(slot);
+      if(ok) {
+        m_written++;
+      } else {
+        m_failed = true;
+        m_dropped++;
+      }
+    }
+    m_writer.release();
+    m_timestamps.close();
+  }
+
+  QString m_base;        ///< Path without extension
+  VideoCodec m_codec;
+  cv::VideoWriter m_writer;
+  CsvLogger m_timestamps;
+  bool m_native16;       ///< 16-bit frames are written as they are
+
+  std::mutex m_lock;
+  std::condition_variable m_queued;
+  std::vector<Frame> m_slots;
+  std::vector<int> m_free;
+  std::deque<int> m_queue;
+  std::thread m_thread;
+  bool m_stop;
+  uint64_t m_written;
+  uint64_t m_dropped;
+  bool m_failed;
+};
+
+} // namespace labforge::io
+
+VideoRecorder::VideoRecorder() : m_codec(VIDEO_NONE) {
+}
+
+VideoRecorder::~VideoRecorder() {
+  close();
+}
+
+bool VideoRecorder::open(const QString &folder, VideoCodec codec) {
+  close();
+  if(!QDir().mkpath(folder))
+    return false;
+  m_folder = folder;
+  m_codec = codec;
+  return true;
+}
+
+void VideoRecorder::close() {
+  // Each stream drains its queue before its thread ends
+  for(auto &stream : m_streams) {
+    stream.reset();
+  }
+  m_codec = VIDEO_NONE;
+}
+
+bool VideoRecorder::write(OutputStream stream, uint64_t counter, uint64_t real_time, const QImage &image) {
+  if(image.isNull())
+    return false;
+  if(image.format() == QImage::Format_Grayscale8) {
+    const cv::Mat view(image.height(), image.width(), CV_8UC1, const_cast<uchar *>(image.constBits()),
+                       image.bytesPerLine());
+    return write(stream, counter, real_time, view);
+  }
+  // RGB32 is BGRA in memory
+  const QImage rgb = ((image.format() == QImage::Format_RGB32) || (image.format() == QImage::Format_ARGB32)) ?
+                     image : image.convertToFormat(QImage::Format_RGB32);
+  const cv::Mat view(rgb.height(), rgb.width(), CV_8UC4, const_cast<uchar *>(rgb.constBits()), rgb.bytesPerLine());
+  return write(stream, counter, real_time, view);
+}
+
+bool VideoRecorder::write(OutputStream stream, uint64_t counter, uint64_t real_time, const cv::Mat &image) {
+  if(!isOpen() || image.empty())
+    return false;
+  // Lossy codecs would destroy the values, those streams are recorded colormapped
+  if((image.type() == CV_16UC1) && !isLossless())
+    return false;
+  std::unique_ptr<VideoStream> &target = m_streams[stream];
+  if(!target)
+    target = std::make_unique<VideoStream>(QDir(m_folder).filePath(s_stream_names[stream]), m_codec);
+  return target->push(counter, real_time, image);
+}
+
+VideoRecorder::Stats VideoRecorder::stats() {
+  Stats stats = {0, 0, 0, 0, false};
+  for(auto &stream : m_streams) {
+    if(stream)
+      stream->stats(stats);
+  }
+  return stats;
+}
@@ -0,0 +1,166 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file colorizer.cc Disparity colorization with percentile auto-range
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/colorizer.hpp"
+#include "proc/disparity.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <opencv2/imgproc.hpp>
+
+using namespace labforge::proc;
+
+#define HISTOGRAM_SIZE (65536)
+#define MAX_VALID (DISPARITY_INVALID - 1)
+
+DisparityColorizer::DisparityColorizer(double low, double high, double smoothing)
+: m_low(low), m_high(high), m_smoothing(smoothing), m_colormap(-1),
+  m_override_min(0), m_override_max(0), m_initialized(false),
+  m_lower(0), m_upper(MAX_VALID), m_lut_lower(0), m_lut_upper(MAX_VALID), m_lut_dirty(true),
+  m_histogram(HISTOGRAM_SIZE, 0), m_lut(HISTOGRAM_SIZE, 0) {
+  setColormap(cv::COLORMAP_JET);
+}
+
+void DisparityColorizer::setColormap(int colormap) {
+  if(colormap == m_colormap)
+    return;
+
+  cv::Mat ramp(1, 256, CV_8UC1), colors;
+  std::iota(ramp.ptr<uint8_t>(0), ramp.ptr<uint8_t>(0) + 256, 0);
+  cv::applyColorMap(ramp, colors, colormap);
+  const cv::Vec3b *bgr = colors.ptr<cv::Vec3b>(0);
+  for(int i = 0; i < 256; ++i) {
+    m_palette[i] = qRgb(bgr[i][2], bgr[i][1], bgr[i][0]);
+  }
+  m_colormap = colormap;
+  m_lut_dirty = true;
+}
+
+void DisparityColorizer::setOverride(int mindisp, int maxdisp) {
+  uint32_t omin = std::min<uint32_t>(std::max(mindisp, 0) * DISPARITY_SCALE, MAX_VALID);
+  uint32_t omax = std::min<uint32_t>(std::max(maxdisp, 0) * DISPARITY_SCALE, MAX_VALID);
+  if(omin == m_override_min && omax == m_override_max)
+    return;
+  m_override_min = omin;
+  m_override_max = omax;
+  m_lut_dirty = true;
+}
+
+void DisparityColorizer::reset() {
+  m_initialized = false;
+  m_lower = 0;
+  m_upper = MAX_VALID;
+  m_lut_lower = 0;
+  m_lut_upper = MAX_VALID;
+  m_lut_dirty = true;
+}
+
+void DisparityColorizer::process(const cv::Mat &raw, QImage &out) {
+  CV_Assert(raw.type() == CV_16UC1);
+  if(out.width() != raw.cols || out.height() != raw.rows || out.format() != QImage::Format_RGB32)
+    out = QImage(raw.cols, raw.rows, QImage::Format_RGB32);
+  if(m_lut_dirty)
+    updateLut();
+
+  // Single pass, the histogram of this frame sets the range of the next one
+  std::fill(m_histogram.begin(), m_histogram.end(), 0);
+  uint32_t *hist = m_histogram.data();
+  const QRgb *lut = m_lut.data();
+  uchar *bits = out.bits();
+  const int stride = out.bytesPerLine();
+  for(int y = 0; y < raw.rows; ++y) {
+    const uint16_t *src = raw.ptr<uint16_t>(y);
+    QRgb *dst = reinterpret_cast<QRgb*>(bits + y * stride);
+    for(int x = 0; x < raw.cols; ++x) {
+      uint16_t v = src[x];
+      hist[v]++;
+      dst[x] = lut[v];
+    }
+  }
+
+  updateRange();
+}
+
+void DisparityColorizer::updateRange() {
+  uint32_t first = m_override_min;
+  uint32_t last = m_override_max ? m_override_max : MAX_VALID;
+
+  uint64_t total = 0;
+  for(uint32_t v = first; v <= last; ++v) {
+    total += m_histogram[v];
+  }
+  // Keep the previous range on empty frames
+  if(total == 0)
+    return;
+
+  const auto low_count = static_cast<uint64_t>(std::ceil(total * m_low));
+  const auto high_count = static_cast<uint64_t>(std::ceil(total * m_high));
+  uint32_t lo = first, hi = last;
+  bool found_low = false;
+  uint64_t cumulative = 0;
+  for(uint32_t v = first; v <= last; ++v) {
+    cumulative += m_histogram[v];
+    if(!found_low && cumulative >= low_count) {
+      lo = v;
+      found_low = true;
+    }
+    if(cumulative >= high_count) {
+      hi = v;
+      break;
+    }
+  }
+
+  if(!m_initialized) {
+    m_lower = lo;
+    m_upper = hi;
+    m_initialized = true;
+  } else {
+    m_lower += m_smoothing * (lo - m_lower);
+    m_upper += m_smoothing * (hi - m_upper);
+  }
+
+  auto lower = static_cast<uint16_t>(m_override_min ? m_override_min : std::lround(m_lower));
+  auto upper = static_cast<uint16_t>(m_override_max ? m_override_max : std::lround(m_upper));
+  if(upper <= lower)
+    upper = std::min<uint16_t>(lower + 1, MAX_VALID);
+  if(lower != m_lut_lower || upper != m_lut_upper) {
+    m_lut_lower = lower;
+    m_lut_upper = upper;
+    m_lut_dirty = true;
+  }
+}
+
+void DisparityColorizer::updateLut() {
+  const uint32_t lo = m_lut_lower;
+  const uint32_t hi = std::max<uint32_t>(m_lut_upper, lo + 1);
+  for(uint32_t v = 0; v < HISTOGRAM_SIZE; ++v) {
+    bool blank = (v == DISPARITY_INVALID) ||
+                 (m_override_min && v < m_override_min) ||
+                 (m_override_max && v > m_override_max);
+    if(blank || v <= lo) {
+      m_lut[v] = m_palette[0];
+    } else if(v >= hi) {
+      m_lut[v] = m_palette[255];
+    } else {
+      m_lut[v] = m_palette[((v - lo) * 255) / (hi - lo)];
+    }
+  }
+  m_lut_dirty = false;
+}
@@ -0,0 +1,108 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file depth_stats.cc Disparity and depth statistics over a region of interest
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/depth_stats.hpp"
+#include "proc/disparity.hpp"
+
+#include <algorithm>
+
+using namespace cv;
+using namespace labforge::proc;
+
+#define DEPTH_STATS_BINS ((DISPARITY_INVALID >> DEPTH_STATS_BIN_SHIFT) + 1)
+
+DepthStatistics::DepthStatistics()
+: m_enabled(false), m_histogram(DEPTH_STATS_BINS, 0), m_stats{} {
+}
+
+void DepthStatistics::setDepthMatrix(const cv::Mat &qmat) {
+  if(qmat.empty()) {
+    m_q.release();
+    return;
+  }
+  qmat.convertTo(m_q, CV_64F);
+}
+
+const DepthStats &DepthStatistics::process(const cv::Mat &raw, const cv::Rect &roi, int32_t min_disparity) {
+  CV_Assert(raw.type() == CV_16UC1);
+  const Rect area = roi.empty() ? Rect(0, 0, raw.cols, raw.rows) : (roi & Rect(0, 0, raw.cols, raw.rows));
+  const Mat region = raw(area);
+
+  std::fill(m_histogram.begin(), m_histogram.end(), 0);
+  int lowest = DISPARITY_INVALID;
+  int highest = -1;
+  int valid = 0;
+  parallel_for_(Range(0, region.rows), [&](const Range &range) {
+    // Bands only touch the bins they saw when merging
+    std::vector<uint32_t> hist(DEPTH_STATS_BINS, 0);
+    int band_lowest = DISPARITY_INVALID;
+    int band_highest = -1;
+    int band_valid = 0;
+    for(int y = range.start; y < range.end; ++y) {
+      const uint16_t *src = region.ptr<uint16_t>(y);
+      for(int x = 0; x < region.cols; ++x) {
+        const uint16_t value = src[x];
+        if(!isValidDisparity(value))
+          continue;
+        hist[value >> DEPTH_STATS_BIN_SHIFT]++;
+        band_lowest = std::min(band_lowest, static_cast<int>(value));
+        band_highest = std::max(band_highest, static_cast<int>(value));
+        band_valid++;
+      }
+    }
+    if(band_valid == 0)
+      return;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for(int bin = band_lowest >> DEPTH_STATS_BIN_SHIFT; bin <= (band_highest >> DEPTH_STATS_BIN_SHIFT); ++bin) {
+      m_histogram[bin] += hist[bin];
+    }
+    lowest = std::min(lowest, band_lowest);
+    highest = std::max(highest, band_highest);
+    valid += band_valid;
+  });
+
+  m_stats = DepthStats{};
+  m_stats.roi = area;
+  m_stats.pixels = area.area();
+  m_stats.valid = valid;
+  m_stats.ratio = (m_stats.pixels > 0) ? static_cast<float>(valid) / m_stats.pixels : 0;
+  if(valid == 0)
+    return m_stats;
+
+  // Median bin, reported at the bin center and kept within the exact extremes
+  int bin = lowest >> DEPTH_STATS_BIN_SHIFT;
+  uint32_t seen = 0;
+  const uint32_t half = (static_cast<uint32_t>(valid) + 1) / 2;
+  for(; bin < DEPTH_STATS_BINS; ++bin) {
+    seen += m_histogram[bin];
+    if(seen >= half)
+      break;
+  }
+  const float center = static_cast<float>((bin << DEPTH_STATS_BIN_SHIFT) + (1 << (DEPTH_STATS_BIN_SHIFT - 1)));
+  const float median = std::clamp(center, static_cast<float>(lowest), static_cast<float>(highest));
+
+  m_stats.min = static_cast<float>(lowest) / DISPARITY_SCALE + min_disparity;
+  m_stats.median = median / DISPARITY_SCALE + min_disparity;
+  m_stats.max = static_cast<float>(highest) / DISPARITY_SCALE + min_disparity;
+  m_stats.nearest = toDepth(m_q, m_stats.max);
+  m_stats.depth = toDepth(m_q, m_stats.median);
+  m_stats.farthest = toDepth(m_q, m_stats.min);
+  return m_stats;
+}
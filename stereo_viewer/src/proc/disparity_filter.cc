@@ -0,0 +1,173 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file disparity_filter.cc Post-processing of raw disparity images
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/disparity_filter.hpp"
+#include "proc/disparity.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <opencv2/imgproc.hpp>
+
+using namespace cv;
+using namespace labforge::proc;
+
+static double s_elapsed_ms(int64 start) {
+  return (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+DisparityFilter::DisparityFilter()
+: m_speckle(false), m_speckle_size(200), m_speckle_diff(DISPARITY_SCALE), m_holes(false), m_hole_width(16),
+  m_median(false), m_median_ksize(5), m_tiles(SPECKLE_TILES_X * SPECKLE_TILES_Y), m_timings{0, 0, 0} {
+}
+
+void DisparityFilter::setSpeckle(bool enable, int max_size, int max_diff) {
+  m_speckle = enable;
+  m_speckle_size = max_size;
+  m_speckle_diff = max_diff * DISPARITY_SCALE;
+}
+
+void DisparityFilter::setHoleFill(bool enable, int max_width) {
+  m_holes = enable;
+  m_hole_width = max_width;
+}
+
+void DisparityFilter::setMedian(bool enable, int ksize) {
+  m_median = enable;
+  // medianBlur supports 16-bit only up to 5x5
+  m_median_ksize = (ksize <= 3) ? 3 : 5;
+}
+
+cv::Mat DisparityFilter::apply(const cv::Mat &raw) {
+  m_timings = {0, 0, 0};
+  if(!isEnabled() || raw.empty())
+    return raw;
+  CV_Assert(raw.type() == CV_16UC1);
+
+  // Allocated once per resolution
+  raw.copyTo(m_output);
+
+  if(m_speckle) {
+    int64 start = getTickCount();
+    removeSpeckles(m_output);
+    m_timings.speckle = s_elapsed_ms(start);
+  }
+  if(m_holes) {
+    int64 start = getTickCount();
+    fillHoles(m_output);
+    m_timings.holes = s_elapsed_ms(start);
+  }
+  if(m_median) {
+    int64 start = getTickCount();
+    medianBlur(m_output, m_scratch, m_median_ksize);
+    std::swap(m_output, m_scratch);
+    m_timings.median = s_elapsed_ms(start);
+  }
+  return m_output;
+}
+
+void DisparityFilter::removeSpeckles(cv::Mat &disp) {
+  const int max_size = m_speckle_size;
+  const int max_diff = m_speckle_diff;
+
+  parallel_for_(Range(0, SPECKLE_TILES_X * SPECKLE_TILES_Y), [&](const Range &range) {
+    for(int t = range.start; t < range.end; ++t) {
+      const int tx = t % SPECKLE_TILES_X;
+      const int ty = t / SPECKLE_TILES_X;
+      const int x0 = (disp.cols * tx) / SPECKLE_TILES_X;
+      const int x1 = (disp.cols * (tx + 1)) / SPECKLE_TILES_X;
+      const int y0 = (disp.rows * ty) / SPECKLE_TILES_Y;
+      const int y1 = (disp.rows * (ty + 1)) / SPECKLE_TILES_Y;
+      const int width = x1 - x0;
+      const int height = y1 - y0;
+
+      // Scratch keeps its capacity between frames
+      Scratch &scratch = m_tiles[t];
+      scratch.visited.assign(static_cast<size_t>(width) * height, 0);
+
+      for(int y = y0; y < y1; ++y) {
+        for(int x = x0; x < x1; ++x) {
+          uint8_t &seen = scratch.visited[(y - y0) * width + (x - x0)];
+          if(seen || !isValidDisparity(disp.at<uint16_t>(y, x)))
+            continue;
+
+          // Grow the segment, only remember pixels while it is still small enough to remove
+          seen = 1;
+          scratch.stack.clear();
+          scratch.segment.clear();
+          scratch.stack.emplace_back(x, y);
+          int size = 0;
+          bool border = false;
+          while(!scratch.stack.empty()) {
+            Point p = scratch.stack.back();
+            scratch.stack.pop_back();
+            size++;
+            if(size <= max_size)
+              scratch.segment.push_back(p);
+            border = border || (p.x == x0) || (p.x == x1 - 1) || (p.y == y0) || (p.y == y1 - 1);
+
+            const int value = disp.at<uint16_t>(p.y, p.x);
+            const Point neighbours[4] = {{p.x - 1, p.y}, {p.x + 1, p.y}, {p.x, p.y - 1}, {p.x, p.y + 1}};
+            for(const Point &n : neighbours) {
+              if(n.x < x0 || n.x >= x1 || n.y < y0 || n.y >= y1)
+                continue;
+              uint8_t &next = scratch.visited[(n.y - y0) * width + (n.x - x0)];
+              if(next)
+                continue;
+              const uint16_t nvalue = disp.at<uint16_t>(n.y, n.x);
+              if(!isValidDisparity(nvalue) || std::abs(nvalue - value) > max_diff)
+                continue;
+              next = 1;
+              scratch.stack.push_back(n);
+            }
+          }
+
+          // Segments crossing tiles may continue elsewhere, keep them
+          if(size <= max_size && !border) {
+            for(const Point &p : scratch.segment) {
+              disp.at<uint16_t>(p.y, p.x) = DISPARITY_INVALID;
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+void DisparityFilter::fillHoles(cv::Mat &disp) const {
+  const int max_width = m_hole_width;
+  parallel_for_(Range(0, disp.rows), [&](const Range &range) {
+    for(int y = range.start; y < range.end; ++y) {
+      uint16_t *row = disp.ptr<uint16_t>(y);
+      int x = 0;
+      while(x < disp.cols) {
+        if(isValidDisparity(row[x])) {
+          x++;
+          continue;
+        }
+        const int start = x;
+        while(x < disp.cols && !isValidDisparity(row[x]))
+          x++;
+        // Only holes bounded on both sides, filled with the background side
+        if(start > 0 && x < disp.cols && (x - start) <= max_width) {
+          std::fill(row + start, row + x, std::min(row[start - 1], row[x]));
+        }
+      }
+    }
+  });
+}
@@ -0,0 +1,153 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file exposure.cc Per frame exposure analytics on raw luma
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/exposure.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace cv;
+using namespace labforge::proc;
+
+// 8-bit lane counters are flushed before they can overflow
+#define MAX_LANE_ITERATIONS (255)
+
+static void s_analyze(const Mat &yuyv, const Rect &rect, ExposureAnalyzer::Tile &tile) {
+  // Interleaved sub-histograms avoid stalls on runs of equal values
+  uint32_t hist[4][256] = {};
+  uint64_t sum = 0;
+  uint64_t clipped = 0;
+  uint64_t crushed = 0;
+  const int x1 = rect.x + rect.width;
+
+  for(int y = rect.y; y < rect.y + rect.height; ++y) {
+    // Luma is every other byte
+    const uint8_t *row = yuyv.ptr<uint8_t>(y);
+    int x = rect.x;
+#if CV_SIMD128
+    const v_uint8x16 clip_level = v_setall_u8(EXPOSURE_CLIP_LEVEL - 1);
+    const v_uint8x16 crush_level = v_setall_u8(EXPOSURE_CRUSH_LEVEL + 1);
+    const v_uint8x16 one = v_setall_u8(1);
+    uint8_t luma_buf[16];
+    while(x + 16 <= x1) {
+      v_uint8x16 acc_clip = v_setzero_u8();
+      v_uint8x16 acc_crush = v_setzero_u8();
+      v_uint32x4 acc_sum = v_setzero_u32();
+      for(int i = 0; (i < MAX_LANE_ITERATIONS) && (x + 16 <= x1); ++i, x += 16) {
+        v_uint8x16 luma, chroma;
+        v_load_deinterleave(row + 2 * x, luma, chroma);
+
+        acc_clip += (luma > clip_level) & one;
+        acc_crush += (luma < crush_level) & one;
+
+        v_uint16x8 l0, l1;
+        v_expand(luma, l0, l1);
+        v_uint32x4 s0, s1;
+        v_expand(l0 + l1, s0, s1);
+        acc_sum += s0 + s1;
+
+        v_store(luma_buf, luma);
+        for(int k = 0; k < 16; ++k) {
+          hist[k & 3][luma_buf[k]]++;
+        }
+      }
+      v_uint16x8 c0, c1;
+      v_expand(acc_clip, c0, c1);
+      clipped += v_reduce_sum(c0 + c1);
+      v_expand(acc_crush, c0, c1);
+      crushed += v_reduce_sum(c0 + c1);
+      sum += v_reduce_sum(acc_sum);
+    }
+#endif // CV_SIMD128
+    for(; x < x1; ++x) {
+      uint8_t luma = row[2 * x];
+      hist[x & 3][luma]++;
+      sum += luma;
+      clipped += (luma >= EXPOSURE_CLIP_LEVEL);
+      crushed += (luma <= EXPOSURE_CRUSH_LEVEL);
+    }
+  }
+
+  for(int v = 0; v < 256; ++v) {
+    tile.histogram[v] = hist[0][v] + hist[1][v] + hist[2][v] + hist[3][v];
+  }
+  tile.sum = sum;
+  tile.clipped = clipped;
+  tile.crushed = crushed;
+  tile.count = static_cast<uint64_t>(rect.width) * rect.height;
+}
+
+int ExposureStats::percentile(double fraction) const {
+  const uint64_t target = static_cast<uint64_t>(std::ceil(fraction * count));
+  uint64_t cumulative = 0;
+  for(int v = 0; v < 256; ++v) {
+    cumulative += histogram[v];
+    if(cumulative >= target && cumulative > 0)
+      return v;
+  }
+  return 255;
+}
+
+ExposureAnalyzer::ExposureAnalyzer() : m_tiles{}, m_stats{} {
+}
+
+const ExposureStats &ExposureAnalyzer::process(const cv::Mat &yuyv) {
+  CV_Assert(yuyv.type() == CV_8UC2);
+  if(yuyv.cols < EXPOSURE_ZONES_X || yuyv.rows < EXPOSURE_ZONES_Y)
+    return m_stats;
+
+  parallel_for_(Range(0, EXPOSURE_ZONES), [&](const Range &range) {
+    for(int zone = range.start; zone < range.end; ++zone) {
+      const int tx = zone % EXPOSURE_ZONES_X;
+      const int ty = zone / EXPOSURE_ZONES_X;
+      const int x0 = (yuyv.cols * tx) / EXPOSURE_ZONES_X;
+      const int x1 = (yuyv.cols * (tx + 1)) / EXPOSURE_ZONES_X;
+      const int y0 = (yuyv.rows * ty) / EXPOSURE_ZONES_Y;
+      const int y1 = (yuyv.rows * (ty + 1)) / EXPOSURE_ZONES_Y;
+      s_analyze(yuyv, Rect(x0, y0, x1 - x0, y1 - y0), m_tiles[zone]);
+    }
+  });
+
+  m_stats.histogram.fill(0);
+  uint64_t sum = 0, clipped = 0, crushed = 0, count = 0;
+  for(int zone = 0; zone < EXPOSURE_ZONES; ++zone) {
+    const Tile &tile = m_tiles[zone];
+    for(int v = 0; v < 256; ++v) {
+      m_stats.histogram[v] += tile.histogram[v];
+    }
+    sum += tile.sum;
+    clipped += tile.clipped;
+    crushed += tile.crushed;
+    count += tile.count;
+    m_stats.zones[zone] = (tile.count > 0) ? static_cast<float>(tile.sum) / tile.count : 0.0f;
+  }
+  m_stats.count = count;
+  m_stats.mean = static_cast<double>(sum) / count;
+  m_stats.clipped = (100.0 * clipped) / count;
+  m_stats.crushed = (100.0 * crushed) / count;
+  return m_stats;
+}
+
+double ExposureAnalyzer::mismatch(const ExposureStats &left, const ExposureStats &right) {
+  double average = (left.mean + right.mean) / 2.0;
+  if(average <= 0)
+    return 0;
+  return 100.0 * (left.mean - right.mean) / average;
+}
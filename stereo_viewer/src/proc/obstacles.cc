@@ -0,0 +1,225 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file obstacles.cc Ground plane and obstacle detection on raw disparity
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/obstacles.hpp"
+#include "proc/disparity.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace labforge::proc;
+
+ObstacleDetector::ObstacleDetector()
+: m_enabled(false), m_margin(2.0f), m_max_range(0), m_rng(0x4f627374),
+  m_sectors(OBSTACLE_SECTORS * OBSTACLE_MAX_DISPARITY, 0), m_result{} {
+}
+
+void ObstacleDetector::setDepthMatrix(const cv::Mat &qmat) {
+  if(qmat.empty()) {
+    m_q.release();
+    return;
+  }
+  qmat.convertTo(m_q, CV_64F);
+}
+
+void ObstacleDetector::setLimits(float margin, float max_range) {
+  m_margin = margin;
+  m_max_range = max_range;
+}
+
+float ObstacleDetector::disparity(float depth) const {
+  if(m_q.empty() || depth <= 0 || m_q.at<double>(3, 2) == 0)
+    return 0;
+  return static_cast<float>((std::abs(m_q.at<double>(2, 3)) / depth - m_q.at<double>(3, 3)) /
+                            std::abs(m_q.at<double>(3, 2)));
+}
+
+const ObstacleResult &ObstacleDetector::process(const cv::Mat &raw, int32_t min_disparity) {
+  CV_Assert(raw.type() == CV_16UC1);
+  const int64 start = getTickCount();
+
+  // V-disparity, every row owns its histogram row so bands need no merging
+  m_vdisp.create(raw.rows, OBSTACLE_MAX_DISPARITY, CV_32SC1);
+  parallel_for_(Range(0, raw.rows), [&](const Range &range) {
+    for(int y = range.start; y < range.end; ++y) {
+      const uint16_t *src = raw.ptr<uint16_t>(y);
+      int *hist = m_vdisp.ptr<int>(y);
+      std::fill(hist, hist + OBSTACLE_MAX_DISPARITY, 0);
+      for(int x = 0; x < raw.cols; ++x) {
+        if(!isValidDisparity(src[x]))
+          continue;
+        const int d = src[x] / DISPARITY_SCALE + min_disparity;
+        if(d > 0 && d < OBSTACLE_MAX_DISPARITY)
+          hist[d]++;
+      }
+    }
+  });
+
+  m_result.ground = fitGround(raw.rows, raw.cols);
+  m_result.horizon = m_result.ground ? -m_result.offset / m_result.slope : 0;
+  markObstacles(raw, min_disparity);
+
+  m_result.timing = (getTickCount() - start) * 1000.0 / getTickFrequency();
+  return m_result;
+}
+
+bool ObstacleDetector::fitGround(int rows, int cols) {
+  // Candidates are well populated cells, sparse far field noise is skipped
+  const int threshold = std::max(4, cols / 64);
+  m_cells.clear();
+  int64_t total = 0;
+  for(int v = 0; v < rows; ++v) {
+    const int *hist = m_vdisp.ptr<int>(v);
+    for(int d = 1; d < OBSTACLE_MAX_DISPARITY; ++d) {
+      if(hist[d] >= threshold) {
+        m_cells.push_back({static_cast<float>(v), static_cast<float>(d), hist[d]});
+        total += hist[d];
+      }
+    }
+  }
+  if(m_cells.size() < 2)
+    return false;
+
+  // Ground disparity grows towards the bottom of the image, obstacles are vertical in V-disparity
+  const int n = static_cast<int>(m_cells.size());
+  float best_slope = 0;
+  float best_offset = 0;
+  int64_t best_score = 0;
+  for(int i = 0; i < OBSTACLE_RANSAC_ITERATIONS; ++i) {
+    const Cell &a = m_cells[m_rng.uniform(0, n)];
+    const Cell &b = m_cells[m_rng.uniform(0, n)];
+    if(std::abs(b.row - a.row) < rows / 8.0f)
+      continue;
+    const float slope = (b.disparity - a.disparity) / (b.row - a.row);
+    if(slope < OBSTACLE_MIN_SLOPE)
+      continue;
+    const float offset = a.disparity - slope * a.row;
+
+    int64_t score = 0;
+    for(const Cell &cell : m_cells) {
+      if(std::abs(slope * cell.row + offset - cell.disparity) <= OBSTACLE_GROUND_TOLERANCE)
+        score += cell.count;
+    }
+    if(score > best_score) {
+      best_score = score;
+      best_slope = slope;
+      best_offset = offset;
+    }
+  }
+  if(best_score * 10 < total)
+    return false;
+
+  // Refine with count weighted least squares over the inliers
+  double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for(const Cell &cell : m_cells) {
+    if(std::abs(best_slope * cell.row + best_offset - cell.disparity) > OBSTACLE_GROUND_TOLERANCE)
+      continue;
+    sw += cell.count;
+    sx += cell.count * cell.row;
+    sy += cell.count * cell.disparity;
+    sxx += cell.count * cell.row * cell.row;
+    sxy += cell.count * cell.row * cell.disparity;
+  }
+  const double denom = sw * sxx - sx * sx;
+  if(denom > 0) {
+    const double slope = (sw * sxy - sx * sy) / denom;
+    if(slope >= OBSTACLE_MIN_SLOPE) {
+      best_slope = static_cast<float>(slope);
+      best_offset = static_cast<float>((sy - slope * sx) / sw);
+    }
+  }
+  m_result.slope = best_slope;
+  m_result.offset = best_offset;
+  return true;
+}
+
+void ObstacleDetector::markObstacles(const cv::Mat &raw, int32_t min_disparity) {
+  m_result.mask.create(raw.size(), CV_8UC1);
+  std::fill(m_sectors.begin(), m_sectors.end(), 0);
+  std::fill(m_result.top, m_result.top + OBSTACLE_SECTORS, raw.rows);
+  std::fill(m_result.bottom, m_result.bottom + OBSTACLE_SECTORS, -1);
+  m_result.pixels = 0;
+
+  const bool ground = m_result.ground;
+  const float slope = m_result.slope;
+  const float offset = m_result.offset + m_margin;
+  // Anything beyond the range of interest is background, without calibration every valid pixel counts
+  const float nearest = std::max(1.0f, (m_max_range > 0) ? disparity(m_max_range) : 0.0f);
+
+  parallel_for_(Range(0, raw.rows), [&](const Range &range) {
+    int hist[OBSTACLE_SECTORS][OBSTACLE_MAX_DISPARITY] = {};
+    int top[OBSTACLE_SECTORS];
+    int bottom[OBSTACLE_SECTORS];
+    std::fill(top, top + OBSTACLE_SECTORS, raw.rows);
+    std::fill(bottom, bottom + OBSTACLE_SECTORS, -1);
+    int pixels = 0;
+
+    for(int y = range.start; y < range.end; ++y) {
+      // Per row threshold in raw units, closer than the ground and within range
+      const float limit = ground ? std::max(nearest, slope * y + offset) : nearest;
+      const float raw_limit = std::clamp((limit - min_disparity) * DISPARITY_SCALE, -1.0f,
+                                         static_cast<float>(DISPARITY_INVALID));
+      const int threshold = static_cast<int>(raw_limit);
+
+      const uint16_t *src = raw.ptr<uint16_t>(y);
+      uint8_t *dst = m_result.mask.ptr<uint8_t>(y);
+      for(int x = 0; x < raw.cols; ++x) {
+        const int value = src[x];
+        const bool hit = isValidDisparity(value) && (value > threshold);
+        dst[x] = hit ? 255 : 0;
+        if(!hit)
+          continue;
+        const int sector = (x * OBSTACLE_SECTORS) / raw.cols;
+        const int d = std::clamp(value / DISPARITY_SCALE + min_disparity, 0, OBSTACLE_MAX_DISPARITY - 1);
+        hist[sector][d]++;
+        top[sector] = std::min(top[sector], y);
+        bottom[sector] = std::max(bottom[sector], y);
+        pixels++;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for(int s = 0; s < OBSTACLE_SECTORS; ++s) {
+      int *dst = &m_sectors[s * OBSTACLE_MAX_DISPARITY];
+      for(int d = 0; d < OBSTACLE_MAX_DISPARITY; ++d) {
+        dst[d] += hist[s][d];
+      }
+      m_result.top[s] = std::min(m_result.top[s], top[s]);
+      m_result.bottom[s] = std::max(m_result.bottom[s], bottom[s]);
+    }
+    m_result.pixels += pixels;
+  });
+
+  // Nearest disparity with enough support, single outliers do not count
+  for(int s = 0; s < OBSTACLE_SECTORS; ++s) {
+    const int *hist = &m_sectors[s * OBSTACLE_MAX_DISPARITY];
+    int support = 0;
+    m_result.disparity[s] = 0;
+    m_result.depth[s] = 0;
+    for(int d = OBSTACLE_MAX_DISPARITY - 1; d > 0; --d) {
+      support += hist[d];
+      if(support >= OBSTACLE_MIN_PIXELS) {
+        m_result.disparity[s] = static_cast<float>(d);
+        m_result.depth[s] = toDepth(m_q, static_cast<float>(d));
+        break;
+      }
+    }
+  }
+}
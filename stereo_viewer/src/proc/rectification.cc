@@ -0,0 +1,187 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file rectification.cc Rectification quality monitor from stereo matches
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/rectification.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace labforge::proc;
+
+StreamingQuantile::StreamingQuantile(double p) : m_p(p) {
+  reset();
+}
+
+void StreamingQuantile::reset() {
+  const double p = m_p;
+  const double np[5] = {0, 2 * p, 4 * p, 2 + 2 * p, 4};
+  const double dn[5] = {0, p / 2, p, (1 + p) / 2, 1};
+  for(int i = 0; i < 5; ++i) {
+    m_q[i] = 0;
+    m_n[i] = i;
+    m_np[i] = np[i];
+    m_dn[i] = dn[i];
+  }
+  m_count = 0;
+}
+
+void StreamingQuantile::add(double x) {
+  // The first samples initialize the markers
+  if(m_count < 5) {
+    m_q[m_count++] = x;
+    if(m_count == 5)
+      std::sort(m_q, m_q + 5);
+    return;
+  }
+  m_count++;
+
+  int k;
+  if(x < m_q[0]) {
+    m_q[0] = x;
+    k = 0;
+  } else if(x >= m_q[4]) {
+    m_q[4] = x;
+    k = 3;
+  } else {
+    k = 0;
+    while(x >= m_q[k + 1])
+      k++;
+  }
+  for(int i = k + 1; i < 5; ++i) {
+    m_n[i] += 1;
+  }
+  for(int i = 0; i < 5; ++i) {
+    m_np[i] += m_dn[i];
+  }
+
+  // Move the middle markers towards their desired positions
+  for(int i = 1; i < 4; ++i) {
+    const double d = m_np[i] - m_n[i];
+    if((d >= 1 && m_n[i + 1] - m_n[i] > 1) || (d <= -1 && m_n[i - 1] - m_n[i] < -1)) {
+      const double s = (d >= 0) ? 1 : -1;
+      // Piecewise parabolic prediction, linear if it would leave the neighbours
+      const double q = m_q[i] + s / (m_n[i + 1] - m_n[i - 1]) *
+                       ((m_n[i] - m_n[i - 1] + s) * (m_q[i + 1] - m_q[i]) / (m_n[i + 1] - m_n[i]) +
+                        (m_n[i + 1] - m_n[i] - s) * (m_q[i] - m_q[i - 1]) / (m_n[i] - m_n[i - 1]));
+      if(m_q[i - 1] < q && q < m_q[i + 1]) {
+        m_q[i] = q;
+      } else {
+        const int j = i + static_cast<int>(s);
+        m_q[i] += s * (m_q[j] - m_q[i]) / (m_n[j] - m_n[i]);
+      }
+      m_n[i] += s;
+    }
+  }
+}
+
+double StreamingQuantile::value() const {
+  if(m_count == 0)
+    return 0;
+  if(m_count < 5) {
+    double sorted[5];
+    std::copy(m_q, m_q + m_count, sorted);
+    std::sort(sorted, sorted + m_count);
+    return sorted[std::min(m_count - 1, static_cast<size_t>(m_p * m_count))];
+  }
+  return m_q[2];
+}
+
+/**
+ * Quantile of a histogram of absolute offsets.
+ */
+static float s_quantile(const uint32_t *histogram, int total, double p) {
+  const double target = p * total;
+  uint32_t seen = 0;
+  for(int i = 0; i <= RECTIFICATION_RANGE; ++i) {
+    seen += histogram[i];
+    if(seen >= target)
+      return static_cast<float>(i);
+  }
+  return RECTIFICATION_RANGE;
+}
+
+RectificationMonitor::RectificationMonitor()
+: m_threshold(1.5f), m_histogram{}, m_session_p50(0.5), m_session_p95(0.95), m_baseline(0.5),
+  m_bias(RECTIFICATION_WINDOW), m_spread(RECTIFICATION_WINDOW), m_bias_sum(0), m_spread_sum(0), m_stats{} {
+}
+
+void RectificationMonitor::reset() {
+  m_session_p50.reset();
+  m_session_p95.reset();
+  m_baseline.reset();
+  m_bias.clear();
+  m_spread.clear();
+  m_bias_sum = 0;
+  m_spread_sum = 0;
+  m_stats = RectificationStats{};
+}
+
+bool RectificationMonitor::process(const matches_t &matches) {
+  if(matches.size() < RECTIFICATION_MIN_MATCHES)
+    return false;
+
+  std::fill(m_histogram, m_histogram + RECTIFICATION_RANGE + 1, 0);
+  int count = 0;
+  int outliers = 0;
+  int64_t sum = 0;
+  for(const match_t &match : matches) {
+    // Rows of the same point in both images, zero when rectified
+    const int offset = static_cast<int>(match.left.y) - static_cast<int>(match.right.y);
+    const int magnitude = std::abs(offset);
+    if(magnitude > RECTIFICATION_RANGE) {
+      outliers++;
+      continue;
+    }
+    m_histogram[magnitude]++;
+    sum += offset;
+    count++;
+    m_session_p50.add(magnitude);
+    m_session_p95.add(magnitude);
+    m_baseline.add(offset);
+  }
+  if(count < RECTIFICATION_MIN_MATCHES)
+    return false;
+
+  const float bias = static_cast<float>(sum) / count;
+  const float p95 = s_quantile(m_histogram, count, 0.95);
+
+  // Windowed means, the oldest frame leaves the sums before it is overwritten
+  if(m_bias.full()) {
+    m_bias_sum -= m_bias.front();
+    m_spread_sum -= m_spread.front();
+  }
+  m_bias.push(bias);
+  m_spread.push(p95);
+  m_bias_sum += bias;
+  m_spread_sum += p95;
+
+  m_stats.matches = count;
+  m_stats.outliers = outliers;
+  m_stats.bias = bias;
+  m_stats.p50 = s_quantile(m_histogram, count, 0.5);
+  m_stats.p95 = p95;
+  m_stats.session_p50 = static_cast<float>(m_session_p50.value());
+  m_stats.session_p95 = static_cast<float>(m_session_p95.value());
+  m_stats.baseline = static_cast<float>(m_baseline.value());
+  m_stats.drift = static_cast<float>(m_bias_sum / m_bias.size()) - m_stats.baseline;
+  m_stats.spread = static_cast<float>(m_spread_sum / m_spread.size());
+  m_stats.degraded = (m_stats.spread > m_threshold) || (std::abs(m_stats.drift) > m_threshold);
+  return true;
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file temporal_filter.cc Recursive temporal filtering of raw disparity
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/temporal_filter.hpp"
+#include "proc/disparity.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace cv;
+using namespace labforge::proc;
+
+/**
+ * Filter one row. Weights are 8 bit fixed point, the confidence contributes
+ * its upper byte.
+ */
+static void s_filter_row(const uint16_t *disp, const uint16_t *conf, uint16_t *state, int cols,
+                         int strength, int gate) {
+  int x = 0;
+#if CV_SIMD128
+  const v_uint16x8 invalid = v_setall_u16(DISPARITY_INVALID);
+  const v_uint16x8 gate_v = v_setall_u16(static_cast<uint16_t>(gate));
+  const v_uint16x8 full = v_setall_u16(0xFFFF);
+  const v_int32x4 strength_v = v_setall_s32(strength);
+  for(; x + 8 <= cols; x += 8) {
+    v_uint16x8 d = v_load(disp + x);
+    v_uint16x8 p = v_load(state + x);
+    v_uint16x8 c = conf ? v_load(conf + x) : full;
+
+    v_uint32x4 d0, d1, p0, p1, c0, c1;
+    v_expand(d, d0, d1);
+    v_expand(p, p0, p1);
+    v_expand(c, c0, c1);
+
+    // state + (d - state) * strength * confidence
+    v_int32x4 a0 = (v_reinterpret_as_s32(c0 >> 8) * strength_v) >> 8;
+    v_int32x4 a1 = (v_reinterpret_as_s32(c1 >> 8) * strength_v) >> 8;
+    v_int32x4 b0 = v_reinterpret_as_s32(p0) + (((v_reinterpret_as_s32(d0) - v_reinterpret_as_s32(p0)) * a0) >> 8);
+    v_int32x4 b1 = v_reinterpret_as_s32(p1) + (((v_reinterpret_as_s32(d1) - v_reinterpret_as_s32(p1)) * a1) >> 8);
+    v_uint16x8 blend = v_pack_u(b0, b1);
+
+    // Motion or no history restarts from the new sample, invalid samples reset the history
+    v_uint16x8 restart = (v_absdiff(d, p) > gate_v) | (p == invalid);
+    v_uint16x8 result = v_select(restart, d, blend);
+    result = v_select(d == invalid, invalid, result);
+    v_store(state + x, result);
+  }
+#endif // CV_SIMD128
+  for(; x < cols; ++x) {
+    const int d = disp[x];
+    const int p = state[x];
+    if(d == DISPARITY_INVALID || p == DISPARITY_INVALID || std::abs(d - p) > gate) {
+      state[x] = static_cast<uint16_t>(d);
+      continue;
+    }
+    const int a = (((conf ? conf[x] : 0xFFFF) >> 8) * strength) >> 8;
+    state[x] = static_cast<uint16_t>(p + (((d - p) * a) >> 8));
+  }
+}
+
+TemporalFilter::TemporalFilter()
+: m_enabled(false), m_strength(64), m_gate(2 * DISPARITY_SCALE), m_valid(false), m_timing(0) {
+}
+
+void TemporalFilter::setEnabled(bool enable) {
+  m_enabled = enable;
+  reset();
+}
+
+void TemporalFilter::setStrength(double strength) {
+  m_strength = std::clamp(static_cast<int>(std::lround(strength * 256)), 1, 256);
+}
+
+void TemporalFilter::setMotionGate(double gate) {
+  m_gate = std::clamp(static_cast<int>(std::lround(gate * DISPARITY_SCALE)), 0, DISPARITY_INVALID - 1);
+}
+
+void TemporalFilter::reset() {
+  m_valid = false;
+}
+
+cv::Mat TemporalFilter::apply(const cv::Mat &disparity, const cv::Mat &confidence) {
+  CV_Assert(disparity.type() == CV_16UC1);
+  const bool weighted = !confidence.empty() && (confidence.size() == disparity.size()) &&
+                        (confidence.type() == CV_16UC1);
+  const int64 start = getTickCount();
+
+  if(!m_valid || m_state.size() != disparity.size()) {
+    disparity.copyTo(m_state);
+    m_valid = true;
+  } else {
+    const int strength = m_strength;
+    const int gate = m_gate;
+    parallel_for_(Range(0, disparity.rows), [&](const Range &range) {
+      for(int y = range.start; y < range.end; ++y) {
+        s_filter_row(disparity.ptr<uint16_t>(y), weighted ? confidence.ptr<uint16_t>(y) : nullptr,
+                     m_state.ptr<uint16_t>(y), disparity.cols, strength, gate);
+      }
+    });
+  }
+
+  m_timing = (getTickCount() - start) * 1000.0 / getTickFrequency();
+  return m_state;
+}
@@ -0,0 +1,247 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file triangulation.cc Triangulation of stereo matches into a sparse point cloud
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "proc/triangulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace cv;
+using namespace labforge::proc;
+
+/**
+ * Triangulate one match, scalar version of the SIMD kernel in Triangulator::solve.
+ * @param n Normalized projections of both views
+ * @param u Left x, y and right x, y in normalized coordinates
+ * @param out X, Y, Z and squared reprojection error in normalized units, infinite if rejected
+ */
+static void s_triangulate(const float n[2][12], const float u[4], float out[4]) {
+  float n00 = 0, n01 = 0, n02 = 0, n11 = 0, n12 = 0, n22 = 0, r0 = 0, r1 = 0, r2 = 0;
+  for(int view = 0; view < 2; ++view) {
+    const float *p = n[view];
+    for(int row = 0; row < 2; ++row) {
+      const float c = u[2 * view + row];
+      const float a0 = c * p[8] - p[4 * row + 0];
+      const float a1 = c * p[9] - p[4 * row + 1];
+      const float a2 = c * p[10] - p[4 * row + 2];
+      const float b = p[4 * row + 3] - c * p[11];
+      n00 += a0 * a0; n01 += a0 * a1; n02 += a0 * a2;
+      n11 += a1 * a1; n12 += a1 * a2; n22 += a2 * a2;
+      r0 += a0 * b; r1 += a1 * b; r2 += a2 * b;
+    }
+  }
+  const float c00 = n11 * n22 - n12 * n12;
+  const float c01 = n02 * n12 - n01 * n22;
+  const float c02 = n01 * n12 - n02 * n11;
+  const float c11 = n00 * n22 - n02 * n02;
+  const float c12 = n01 * n02 - n00 * n12;
+  const float c22 = n00 * n11 - n01 * n01;
+  const float det = n00 * c00 + n01 * c01 + n02 * c02;
+  out[0] = out[1] = out[2] = 0;
+  out[3] = std::numeric_limits<float>::infinity();
+  if(det == 0)
+    return;
+
+  const float x = (c00 * r0 + c01 * r1 + c02 * r2) / det;
+  const float y = (c01 * r0 + c11 * r1 + c12 * r2) / det;
+  const float z = (c02 * r0 + c12 * r1 + c22 * r2) / det;
+  float error = 0;
+  for(int view = 0; view < 2; ++view) {
+    const float *p = n[view];
+    const float w = p[8] * x + p[9] * y + p[10] * z + p[11];
+    if(w <= 0)
+      return;
+    const float ex = (p[0] * x + p[1] * y + p[2] * z + p[3]) / w - u[2 * view];
+    const float ey = (p[4] * x + p[5] * y + p[6] * z + p[7]) / w - u[2 * view + 1];
+    error = std::max(error, ex * ex + ey * ey);
+  }
+  out[0] = x;
+  out[1] = y;
+  out[2] = z;
+  out[3] = error;
+}
+
+/**
+ * Color of a pixel in a YUV422 image, BT.601.
+ */
+static Vec3b s_color(const cv::Mat &yuyv, const keypoint_t &kp) {
+  const int x = kp.x;
+  const int y = kp.y;
+  if(yuyv.empty() || (yuyv.type() != CV_8UC2) || (x >= yuyv.cols) || (y >= yuyv.rows))
+    return Vec3b(255, 255, 255);
+
+  const uint8_t *row = yuyv.ptr<uint8_t>(y);
+  const float luma = row[2 * x];
+  const float u = row[4 * (x / 2) + 1] - 128.0f;
+  const float v = row[4 * (x / 2) + 3] - 128.0f;
+  return Vec3b(saturate_cast<uint8_t>(luma + 1.402f * v),
+               saturate_cast<uint8_t>(luma - 0.344f * u - 0.714f * v),
+               saturate_cast<uint8_t>(luma + 1.772f * u));
+}
+
+Triangulator::Triangulator()
+: m_enabled(false), m_calibrated(false), m_max_error(1.0f), m_n{}, m_focal(1), m_cx(0), m_cy(0), m_count(0),
+  m_timing(0) {
+}
+
+void Triangulator::setProjection(const cv::Mat &p1, const cv::Mat &p2) {
+  m_calibrated = (p1.rows == 3) && (p1.cols == 4) && (p2.rows == 3) && (p2.cols == 4);
+  if(!m_calibrated)
+    return;
+
+  Mat projection[2];
+  p1.convertTo(projection[0], CV_64F);
+  p2.convertTo(projection[1], CV_64F);
+  // Rectified views share focal length and principal row
+  m_focal = static_cast<float>(projection[0].at<double>(0, 0));
+  m_cx = static_cast<float>(projection[0].at<double>(0, 2));
+  m_cy = static_cast<float>(projection[0].at<double>(1, 2));
+  if(m_focal <= 0) {
+    m_calibrated = false;
+    return;
+  }
+
+  // Scaling the equations keeps the normal equations well conditioned in float
+  for(int view = 0; view < 2; ++view) {
+    const Mat &p = projection[view];
+    for(int j = 0; j < 4; ++j) {
+      m_n[view][j] = static_cast<float>((p.at<double>(0, j) - m_cx * p.at<double>(2, j)) / m_focal);
+      m_n[view][4 + j] = static_cast<float>((p.at<double>(1, j) - m_cy * p.at<double>(2, j)) / m_focal);
+      m_n[view][8 + j] = static_cast<float>(p.at<double>(2, j));
+    }
+  }
+}
+
+size_t Triangulator::process(const matches_t &matches, const cv::Mat &left) {
+  const int64 start = getTickCount();
+  m_points.clear();
+  m_colors.clear();
+  m_accepted.clear();
+  m_count = matches.size();
+  if(!m_calibrated || matches.empty()) {
+    m_timing = 0;
+    return 0;
+  }
+
+  // Structure of arrays padded to whole SIMD vectors, capacity is kept between frames
+  const size_t padded = (m_count + 3) & ~static_cast<size_t>(3);
+  for(int i = 0; i < 4; ++i) {
+    m_coords[i].assign(padded, 0);
+    m_solution[i].resize(padded);
+  }
+  for(size_t i = 0; i < m_count; ++i) {
+    const keypoint_t l = matches[i].left;
+    const keypoint_t r = matches[i].right;
+    m_coords[0][i] = (l.x - m_cx) / m_focal;
+    m_coords[1][i] = (l.y - m_cy) / m_focal;
+    m_coords[2][i] = (r.x - m_cx) / m_focal;
+    m_coords[3][i] = (r.y - m_cy) / m_focal;
+  }
+
+  solve(padded);
+
+  const float limit = (m_max_error * m_max_error) / (m_focal * m_focal);
+  for(size_t i = 0; i < m_count; ++i) {
+    if(!(m_solution[3][i] <= limit))
+      continue;
+    m_points.push_back({m_solution[0][i], m_solution[1][i], m_solution[2][i]});
+    m_colors.push_back(s_color(left, matches[i].left));
+    m_accepted.push_back(static_cast<uint32_t>(i));
+  }
+
+  m_timing = (getTickCount() - start) * 1000000.0 / getTickFrequency();
+  return m_points.size();
+}
+
+void Triangulator::solve(size_t count) {
+  size_t i = 0;
+#if CV_SIMD128
+  const v_float32x4 zero = v_setzero_f32();
+  const v_float32x4 infinity = v_setall_f32(std::numeric_limits<float>::infinity());
+  for(; i + 4 <= count; i += 4) {
+    v_float32x4 u[4];
+    for(int k = 0; k < 4; ++k) {
+      u[k] = v_load(&m_coords[k][i]);
+    }
+
+    // Normal equations of the four DLT rows, one match per lane
+    v_float32x4 n00 = zero, n01 = zero, n02 = zero, n11 = zero, n12 = zero, n22 = zero;
+    v_float32x4 r0 = zero, r1 = zero, r2 = zero;
+    for(int view = 0; view < 2; ++view) {
+      const float *p = m_n[view];
+      for(int row = 0; row < 2; ++row) {
+        const v_float32x4 c = u[2 * view + row];
+        const v_float32x4 a0 = c * v_setall_f32(p[8]) - v_setall_f32(p[4 * row + 0]);
+        const v_float32x4 a1 = c * v_setall_f32(p[9]) - v_setall_f32(p[4 * row + 1]);
+        const v_float32x4 a2 = c * v_setall_f32(p[10]) - v_setall_f32(p[4 * row + 2]);
+        const v_float32x4 b = v_setall_f32(p[4 * row + 3]) - c * v_setall_f32(p[11]);
+        n00 = v_fma(a0, a0, n00); n01 = v_fma(a0, a1, n01); n02 = v_fma(a0, a2, n02);
+        n11 = v_fma(a1, a1, n11); n12 = v_fma(a1, a2, n12); n22 = v_fma(a2, a2, n22);
+        r0 = v_fma(a0, b, r0); r1 = v_fma(a1, b, r1); r2 = v_fma(a2, b, r2);
+      }
+    }
+
+    // Cramer's rule on the symmetric 3x3 system
+    const v_float32x4 c00 = n11 * n22 - n12 * n12;
+    const v_float32x4 c01 = n02 * n12 - n01 * n22;
+    const v_float32x4 c02 = n01 * n12 - n02 * n11;
+    const v_float32x4 c11 = n00 * n22 - n02 * n02;
+    const v_float32x4 c12 = n01 * n02 - n00 * n12;
+    const v_float32x4 c22 = n00 * n11 - n01 * n01;
+    const v_float32x4 det = n00 * c00 + n01 * c01 + n02 * c02;
+    v_float32x4 valid = (det != zero);
+    const v_float32x4 inv = v_setall_f32(1.0f) / v_select(valid, det, v_setall_f32(1.0f));
+    const v_float32x4 x = (c00 * r0 + c01 * r1 + c02 * r2) * inv;
+    const v_float32x4 y = (c01 * r0 + c11 * r1 + c12 * r2) * inv;
+    const v_float32x4 z = (c02 * r0 + c12 * r1 + c22 * r2) * inv;
+
+    // Worst reprojection error over both views, points must lie in front of both cameras
+    v_float32x4 error = zero;
+    for(int view = 0; view < 2; ++view) {
+      const float *p = m_n[view];
+      const v_float32x4 w = v_fma(v_setall_f32(p[8]), x, v_fma(v_setall_f32(p[9]), y,
+                                  v_fma(v_setall_f32(p[10]), z, v_setall_f32(p[11]))));
+      valid = valid & (w > zero);
+      const v_float32x4 inv_w = v_setall_f32(1.0f) / v_select(valid, w, v_setall_f32(1.0f));
+      const v_float32x4 px = v_fma(v_setall_f32(p[0]), x, v_fma(v_setall_f32(p[1]), y,
+                                   v_fma(v_setall_f32(p[2]), z, v_setall_f32(p[3]))));
+      const v_float32x4 py = v_fma(v_setall_f32(p[4]), x, v_fma(v_setall_f32(p[5]), y,
+                                   v_fma(v_setall_f32(p[6]), z, v_setall_f32(p[7]))));
+      const v_float32x4 ex = px * inv_w - u[2 * view];
+      const v_float32x4 ey = py * inv_w - u[2 * view + 1];
+      error = v_max(error, v_fma(ex, ex, ey * ey));
+    }
+
+    v_store(&m_solution[0][i], x);
+    v_store(&m_solution[1][i], y);
+    v_store(&m_solution[2][i], z);
+    v_store(&m_solution[3][i], v_select(valid, error, infinity));
+  }
+#endif // CV_SIMD128
+  for(; i < count; ++i) {
+    const float u[4] = {m_coords[0][i], m_coords[1][i], m_coords[2][i], m_coords[3][i]};
+    float out[4];
+    s_triangulate(m_n, u, out);
+    for(int k = 0; k < 4; ++k) {
+      m_solution[k][i] = out[k];
+    }
+  }
+}
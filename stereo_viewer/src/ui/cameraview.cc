@@ -26,15 +26,61 @@ using namespace std;
 using namespace labforge::ui;
 
 CameraView::CameraView(QWidget *parent) : QLabel(parent), m_scaled(false), m_ruler_pos(0) {
+  m_overlay.setStyle(LAYER_FEATURES, QPen(Qt::green, 3, Qt::SolidLine, Qt::RoundCap));
+  m_overlay.setStyle(LAYER_TARGETS, QPen(Qt::red, 2));
+  m_overlay.setStyle(LAYER_RULER, QPen(Qt::red, 3), true);
+  m_overlay.setStyle(LAYER_OBSTACLES, QPen(Qt::yellow, 2));
+  m_overlay.setStyle(LAYER_MEASUREMENTS, QPen(Qt::cyan, 2));
+}
+
+void CameraView::updateTransform() {
+  if(m_frame.isNull())
+    return;
+
+  m_source = m_frame.rect();
+  if(m_scaled) {
+    QRect crop = m_crop.intersected(m_source);
+    if(!crop.isEmpty())
+      m_source = crop;
+  }
+
+  // Fit displayed region into the widget, centered and keeping aspect ratio
+  QRectF area = contentsRect();
+  QSizeF scaled = QSizeF(m_source.size()).scaled(area.size(), Qt::KeepAspectRatio);
+  m_target = QRectF(area.x() + (area.width() - scaled.width()) / 2.0,
+                    area.y() + (area.height() - scaled.height()) / 2.0,
+                    scaled.width(),
+                    scaled.height());
+
+  double scale = m_target.width() / m_source.width();
+  m_transform = QTransform(scale, 0, 0, scale,
+                           m_target.x() - m_source.x() * scale,
+                           m_target.y() - m_source.y() * scale);
 }
 
 void CameraView::resizeEvent(QResizeEvent *event) {
-  (void)event;
-  if(m_last_frame) {
-    redrawPixmap();
-  } else {
-    QLabel::resizeEvent(event);
+  QLabel::resizeEvent(event);
+  updateTransform();
+}
+
+void CameraView::paintEvent(QPaintEvent *event) {
+  if(m_frame.isNull()) {
+    QLabel::paintEvent(event);
+    return;
   }
+  // Background and border only, the frame is scaled on the fly
+  QFrame::paintEvent(event);
+
+  QPainter paint(this);
+  paint.drawImage(m_target, m_frame, m_source);
+  paint.setClipRect(m_target);
+
+  // Focus maps are translucent, annotations go on top in widget resolution
+  m_focus.paintMaps(paint, m_transform);
+  m_overlay.draw(paint, m_transform);
+  m_focus.paint(paint, m_target);
+  if(m_focus.isEnabled())
+    m_sweep.paint(paint, m_target);
 }
 
 void CameraView::mousePressEvent(QMouseEvent *event) {
@@ -45,7 +91,8 @@ void CameraView::mousePressEvent(QMouseEvent *event) {
     m_scaled = false;
     if(m_rubberband)
       m_rubberband->hide();
-    redrawPixmap();
+    updateTransform();
+    redraw();
   } else if(!m_scaled && event->button() == Qt::LeftButton) {
     m_origin = event->pos();
     // Create selector
@@ -73,34 +120,17 @@ void CameraView::mouseMoveEvent(QMouseEvent *event) {
 
 void CameraView::mouseReleaseEvent(QMouseEvent *event) {
   if(!m_scaled && event->button() == Qt::LeftButton) {
-    if(m_last_frame && m_rubberband) {
-      QRectF scaled_pixmap_rect = pixmap()->rect();
-      QSize window_size = size();
-
-      // Find start position of pixmap, assuming everything is centered
-      scaled_pixmap_rect = QRectF((window_size.width() - scaled_pixmap_rect.width()) / 2.0,
-                                  (window_size.height() - scaled_pixmap_rect.height()) / 2.0,
-                                  scaled_pixmap_rect.width(),
-                                  scaled_pixmap_rect.height());
-      QRectF selection = m_rubberband->geometry();
-
+    if(!m_frame.isNull() && m_rubberband) {
       // Make sure we do not cross boundaries
-      selection = scaled_pixmap_rect.intersected(selection);
-
-      // Find origin coordinate in scaled pixmap
-      selection = QRectF(selection.x() - scaled_pixmap_rect.x(),
-                         selection.y() - scaled_pixmap_rect.y(),
-                         selection.width(),
-                         selection.height());
-
-      double scale = m_last_frame->width() / scaled_pixmap_rect.width();
-      m_crop = QRect(selection.x()*scale,
-                     selection.y()*scale,
-                     selection.width()*scale,
-                     selection.height()*scale);
-
-      m_scaled = true;
-      redrawPixmap();
+      QRectF selection = m_target.intersected(QRectF(m_rubberband->geometry()));
+
+      // Map selection back into frame coordinates
+      m_crop = m_transform.inverted().mapRect(selection).toRect().intersected(m_frame.rect());
+      if(!m_crop.isEmpty()) {
+        m_scaled = true;
+        updateTransform();
+        redraw();
+      }
     }
     if(m_rubberband)
       m_rubberband->hide();
@@ -109,67 +139,72 @@ void CameraView::mouseReleaseEvent(QMouseEvent *event) {
   }
 }
 
-void CameraView::setImage(QImage &img, bool redraw) {
-  m_last_frame = std::make_unique<QPixmap>(QPixmap::fromImage(img));
+void CameraView::setImage(const QImage &img, bool redraw) {
+  bool resized = (img.size() != m_frame.size());
+  m_frame = img;
+  // Annotations belong to the previous frame
+  m_overlay.clearFrame();
+  if(resized) {
+    updateTransform();
+    updateRuler();
+  }
   if(redraw)
-    redrawPixmap();
+    this->redraw();
 }
 
-void CameraView::addTarget(QRect &pos, QString &label, QColor &color, int width) {
-  if(m_last_frame) {
-    // Directly paint bounding box on image
-    QPainter paint(m_last_frame.get());
-    paint.setPen(QPen(color,width));
-    paint.drawRect(pos);
-    if(label.length() > 0)
-      paint.drawText(pos, Qt::AlignCenter, label);
-  }
+void CameraView::reset() {
+  clear();
+  m_scaled = false;
+  m_frame = QImage();
+  m_overlay.clearFrame();
+  update();
 }
 
-void CameraView::addFeature(QPoint &pos, QColor &color, int width) {
-  if(m_last_frame) {
-    // Directly paint bounding box on image
-    QPainter paint(m_last_frame.get());
-    paint.setPen(QPen(color,width));
-    paint.drawPoint(pos);
-  }
+void CameraView::redraw() {
+  update();
 }
 
-void CameraView::reset() {
-  clear();
-  m_scaled = false;
-  m_last_frame.reset();
+void CameraView::enableFocus(bool value) {
+  m_focus.enable(value);
 }
 
-void CameraView::redrawPixmap() {
-  QPixmap m;
+void CameraView::showFocusZones(bool value) {
+  m_focus.showZones(value);
+  redraw();
+}
 
-  // Apply ruler
-  if(m_last_frame &&
-     m_ruler_pos > 0 &&
-     m_ruler_pos <
-     m_last_frame->height()) {
-    QPainter paint(m_last_frame.get());
-    paint.setPen(QPen(Qt::red, 3));
-    paint.drawLine(0, m_ruler_pos, m_last_frame->width(), m_ruler_pos);
-  }
+void CameraView::showFocusPeaking(bool value) {
+  m_focus.showPeaking(value);
+  redraw();
+}
 
-  if(m_scaled && m_last_frame) {
-    m = m_last_frame->copy(m_crop).scaled(size(), Qt::KeepAspectRatio, Qt::FastTransformation);
-  } else if(m_last_frame) {
-    m = m_last_frame->scaled(size(), Qt::KeepAspectRatio, Qt::FastTransformation);
-  }
-  m_focus.process(m);
-  setPixmap(m);
+void CameraView::processFocus(const cv::Mat &yuyv, uint64_t timestamp, uint32_t count) {
+  // Values of an earlier frame must not be recorded under this one
+  if(m_focus.process(yuyv, selection()) && m_sweep.isActive())
+    m_sweep.add(timestamp, count, m_focus);
 }
 
-void CameraView::enableFocus(bool value) {
-  m_focus.enable(value);
+void CameraView::startSweep() {
+  m_sweep.start();
+}
+
+void CameraView::stopSweep() {
+  m_sweep.stop();
+  redraw();
+}
+
+void CameraView::updateRuler() {
+  m_overlay.clear(LAYER_RULER);
+  if(m_ruler_pos > 0 &&
+     m_ruler_pos < m_frame.height()) {
+    m_overlay.addLine(LAYER_RULER, QLineF(0, m_ruler_pos, m_frame.width(), m_ruler_pos));
+  }
 }
 
 void CameraView::setRuler(int val) {
   m_ruler_pos = val;
-  if(m_last_frame) {
-    redrawPixmap();
+  updateRuler();
+  if(!m_frame.isNull()) {
+    redraw();
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file overlay.cc Retained annotation layers drawn on top of a camera view
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "ui/overlay.hpp"
+
+using namespace labforge::ui;
+
+Overlay::Overlay() {
+  for(auto &layer : m_layers) {
+    layer.visible = true;
+    layer.persistent = false;
+    layer.pen = QPen(Qt::green, 1);
+    layer.pen.setCosmetic(true);
+  }
+}
+
+void Overlay::clear(OverlayLayer layer) {
+  // clear() keeps the capacity, no allocation once warmed up
+  m_layers[layer].points.clear();
+  m_layers[layer].rects.clear();
+  m_layers[layer].lines.clear();
+  m_layers[layer].labels.clear();
+  m_layers[layer].image = QImage();
+}
+
+void Overlay::clearFrame() {
+  for(size_t i = 0; i < m_layers.size(); ++i) {
+    if(!m_layers[i].persistent)
+      clear(static_cast<OverlayLayer>(i));
+  }
+}
+
+void Overlay::setVisible(OverlayLayer layer, bool visible) {
+  m_layers[layer].visible = visible;
+}
+
+void Overlay::setStyle(OverlayLayer layer, const QPen &pen, bool persistent) {
+  m_layers[layer].pen = pen;
+  m_layers[layer].pen.setCosmetic(true);
+  m_layers[layer].persistent = persistent;
+}
+
+void Overlay::addLabel(OverlayLayer layer, const QRectF &rect, const QString &text) {
+  m_layers[layer].labels.push_back({rect, text});
+}
+
+void Overlay::draw(QPainter &paint, const QTransform &transform) const {
+  paint.save();
+  for(const auto &layer : m_layers) {
+    if(!layer.visible)
+      continue;
+
+    // Geometry in frame coordinates, cosmetic pens keep widths in widget pixels
+    paint.setTransform(transform);
+    if(!layer.image.isNull())
+      paint.drawImage(QPointF(0, 0), layer.image);
+    paint.setPen(layer.pen);
+    paint.setBrush(Qt::NoBrush);
+    if(!layer.points.empty())
+      paint.drawPoints(layer.points.data(), static_cast<int>(layer.points.size()));
+    if(!layer.rects.empty())
+      paint.drawRects(layer.rects.data(), static_cast<int>(layer.rects.size()));
+    if(!layer.lines.empty())
+      paint.drawLines(layer.lines.data(), static_cast<int>(layer.lines.size()));
+
+    // Text is not scaled with the frame
+    if(!layer.labels.empty()) {
+      paint.resetTransform();
+      for(const auto &label : layer.labels) {
+        paint.drawText(transform.mapRect(label.pos), Qt::AlignCenter, label.text);
+      }
+    }
+  }
+  paint.restore();
+}
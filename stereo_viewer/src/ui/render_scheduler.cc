@@ -0,0 +1,86 @@
+/******************************************************************************
+ *  Copyright 2024 Labforge Inc.                                              *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this project except in compliance with the License.        *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ ******************************************************************************
+
+@file render_scheduler.cc Display pacing for the camera views
+@author Thomas Reidemeister <thomas@labforge.ca>
+*/
+#include "ui/render_scheduler.hpp"
+
+#include <algorithm>
+
+using namespace labforge::ui;
+
+#define DEFAULT_DISPLAY_RATE 30
+
+RenderScheduler::RenderScheduler(QObject *parent)
+: QObject(parent), m_pending(false), m_received(0), m_displayed(0) {
+  m_timer.setTimerType(Qt::PreciseTimer);
+  setRate(DEFAULT_DISPLAY_RATE);
+  connect(&m_timer, &QTimer::timeout, this, &RenderScheduler::tick);
+}
+
+void RenderScheduler::addView(QWidget *view) {
+  m_views.push_back(view);
+}
+
+void RenderScheduler::setRate(int fps) {
+  fps = std::clamp(fps, 1, 240);
+  m_timer.setInterval(1000 / fps);
+}
+
+void RenderScheduler::start() {
+  m_pending = false;
+  m_timer.start();
+}
+
+void RenderScheduler::stop() {
+  m_timer.stop();
+  m_pending = false;
+}
+
+void RenderScheduler::submit() {
+  m_received++;
+  m_pending = true;
+}
+
+bool RenderScheduler::isRenderable(const QWidget *view) {
+  if(view == nullptr || !view->isVisible())
+    return false;
+  if(view->window()->isMinimized())
+    return false;
+  // Covered or zero sized
+  return !view->visibleRegion().isEmpty();
+}
+
+void RenderScheduler::resetCounters() {
+  m_received = 0;
+  m_displayed = 0;
+}
+
+void RenderScheduler::tick() {
+  if(!m_pending)
+    return;
+  bool visible = std::any_of(m_views.begin(), m_views.end(), [](const QWidget *view) {
+    return isRenderable(view);
+  });
+  // Keep the frame pending until someone can see it
+  if(!visible)
+    return;
+
+  m_pending = false;
+  m_displayed++;
+  emit render();
+}
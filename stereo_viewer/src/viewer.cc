@@ -23,12 +23,15 @@
 
 #include "ui/MainWindow.hpp"
 #include "gev/util.hpp"
+#include "io/pretrigger_ring.hpp"
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QMessageBox>
 #include <QString>
 #include <QDir>
+#include <QDateTime>
 #include <QFileDialog>
 #include <QPixmap>
+#include <QtConcurrent/QtConcurrentRun>
 #include <PvDeviceGEV.h>
 #include <PvStreamGEV.h>
 
@@ -84,34 +87,17 @@ static bool s_is_bottlenose(const PvDeviceInfo*info) {
 }
 
 static QImage s_yuv2_to_qimage(const cv::Mat*img) {
-  Mat res;
-  cvtColor(*img, res, COLOR_YUV2RGB_YUYV);
-  // data pointer looses scope, deep copy needed
-  return QImage((uchar*) res.data, res.cols, res.rows, res.step, QImage::Format_RGB888).copy();
+  // Convert straight into the image buffer, RGB32 is painted without conversion
+  QImage qimg(img->cols, img->rows, QImage::Format_RGB32);
+  Mat res(qimg.height(), qimg.width(), CV_8UC4, qimg.bits(), qimg.bytesPerLine());
+  cvtColor(*img, res, COLOR_YUV2BGRA_YUYV);
+  return qimg;
 }
 
-static QImage s_mono_to_qimage(const cv::Mat*img, int colormap=COLORMAP_JET, int mindisp=0, int maxdisp=0) {
+static QImage s_mono_to_qimage(const cv::Mat*img) {
   Mat res;
-  QImage::Format qformat = QImage::Format_Grayscale8;
-
-  if(colormap > 0){
-    Mat img_color;
-    Mat dst = img->clone();
-
-    dst.setTo(0, dst == 65535);
-    if(mindisp > 0) dst.setTo(0, dst<(mindisp * 255));
-    if(maxdisp > 0) dst.setTo(0, dst>(maxdisp * 255));
-
-    normalize(dst, res, 0, 255, NORM_MINMAX, CV_8UC1);
-
-    applyColorMap(res, img_color, colormap-1);
-    cv::cvtColor(img_color, res, COLOR_BGR2RGB);
-    qformat = QImage::Format_RGB888;
-  }
-  else {
-    img->convertTo(res, CV_8UC1, 0.00392156862745098, 0);
-  }
-  return QImage((uchar*) res.data, res.cols, res.rows, res.step, qformat).copy();
+  img->convertTo(res, CV_8UC1, 0.00392156862745098, 0);
+  return QImage((uchar*) res.data, res.cols, res.rows, res.step, QImage::Format_Grayscale8).copy();
 }
 
 static void s_load_colormap(QComboBox *cbx, int default_cm=COLORMAP_JET){
@@ -168,8 +154,14 @@ static void s_load_colormap(QComboBox *cbx, int default_cm=COLORMAP_JET){
 static void s_load_format(QComboBox *cbx, bool isVisible=true){
   cbx->addItem("BMP (Windows Bitmap)", "BMP");
   cbx->addItem("PNG (Portable Network Graphics)", "PNG");
+  cbx->addItem("PNG Fast (compression level 1)", "PNG1");
   cbx->addItem("JPEG (Joint Photographic Experts Group)", "JPG");
   cbx->addItem("PPM (Portable Pixmap)", "PPM");
+  cbx->addItem("QOI (Quite OK Image, fast lossless)", "QOI");
+  if(labforge::io::codecAvailable(labforge::io::CODEC_ZSTD))
+    cbx->addItem("zstd (raw pixels, fast lossless)", "ZSTD");
+  if(labforge::io::codecAvailable(labforge::io::CODEC_LZ4))
+    cbx->addItem("LZ4 (raw pixels, fastest lossless)", "LZ4");
   cbx->setCurrentIndex(0);
   cbx->setVisible(isVisible);
 }
@@ -178,6 +170,10 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
   // Will apply UI file changes
   cfg.setupUi(this);
   m_saving = false;
+  m_staged.converted = false;
+  m_staged.convert = nullptr;
+  m_frame_handler = nullptr;
+  m_frame_layout = qMakePair(FORMAT_NONE, FORMAT_NONE);
   cfg.btnRecord->setEnabled(false); //disable recording
 
   cfg.btnConnect->setIcon(QIcon::fromTheme("network-wired", QIcon(":/network-wired.png")));
@@ -192,13 +188,16 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 
   cfg.labelColormap->setVisible(false);
   cfg.cbxColormap->setVisible(false);
+  cfg.cbxRecordColormap->setVisible(false);
   cfg.chkCalibrate->setVisible(true);
   cfg.chkCalibrate->setChecked(false);
   cfg.chkCalibrate->setEnabled(true);
 
   s_load_colormap(cfg.cbxColormap, COLORMAP_JET);
-  s_load_format(cfg.cbxFormat, false);
-  cfg.lblFormat->setVisible(false);
+  s_load_format(cfg.cbxFormat, true);
+  connect(cfg.btnBenchmark, &QPushButton::released, this, &MainWindow::handleBenchmark);
+  connect(&m_benchmark, &QFutureWatcher<std::vector<labforge::io::BenchmarkResult>>::finished,
+          this, &MainWindow::showBenchmark);
 
   cfg.lblMinDisparity->setVisible(false);
   cfg.lblMaxDisparity->setVisible(false);
@@ -217,13 +216,73 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
   connect(cfg.btnDisconnect, &QPushButton::released, this, &MainWindow::handleDisconnect);
   connect(cfg.btnFolder, &QPushButton::released, this, &MainWindow::onFolderSelect);
   connect(cfg.btnRecord, &QPushButton::released, this, &MainWindow::handleRecording);
+  connect(cfg.btnTrigger, &QPushButton::released, this, &MainWindow::handleTrigger);
+  connect(cfg.cbxRaw, &QCheckBox::toggled, [this](bool checked){
+    cfg.spinPreTrigger->setEnabled(checked);
+    cfg.cbxTriggerDetect->setEnabled(checked);
+    cfg.cbxVideo->setEnabled(!checked);
+  });
+  cfg.cbxVideo->addItem("Image Files", labforge::io::VIDEO_NONE);
+  cfg.cbxVideo->addItem("FFV1 Video (Lossless)", labforge::io::VIDEO_FFV1);
+  cfg.cbxVideo->addItem("MJPEG Video", labforge::io::VIDEO_MJPEG);
+  cfg.cbxVideo->addItem("H.264 Video", labforge::io::VIDEO_H264);
+  cfg.spinPreTrigger->setEnabled(false);
+  cfg.cbxTriggerDetect->setEnabled(false);
   connect(cfg.btnSave, &QPushButton::released, this, &MainWindow::handleSave);
   connect(cfg.btnDeviceControl, &QPushButton::released, this, &MainWindow::handleDeviceControl);
   connect(cfg.cbxFocus,&QCheckBox::stateChanged, this, &MainWindow::handleFocus);
+  connect(cfg.cbxSweep, &QCheckBox::toggled, this, &MainWindow::handleSweep);
+  connect(cfg.cbxAnalytics, &QCheckBox::toggled, this, &MainWindow::handleAnalytics);
+  cfg.cbxSweep->setEnabled(false);
   connect(cfg.spinRuler, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::setRuler);
+  connect(cfg.spinDisplayRate, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::setDisplayRate);
   connect(cfg.btnUpload, &QPushButton::released, this, &MainWindow::handleUpload);
   connect(cfg.btnFile, &QPushButton::released, this, &MainWindow::onFileTransferSelect);
 
+  // Display pacing
+  m_scheduler.addView(cfg.widgetLeftSensor);
+  m_scheduler.addView(cfg.widgetRightSensor);
+  m_scheduler.setRate(cfg.spinDisplayRate->value());
+  connect(&m_scheduler, &RenderScheduler::render, this, &MainWindow::renderFrame);
+
+  // Annotation layers
+  m_overlay_menu = new QMenu(cfg.btnOverlays);
+  addOverlayAction("Feature Points", LAYER_FEATURES);
+  addOverlayAction("Bounding Boxes", LAYER_TARGETS);
+  addOverlayAction("Ruler", LAYER_RULER);
+  m_overlay_menu->addSeparator();
+  addFocusAction("Sharpness Zones", &CameraView::showFocusZones);
+  addFocusAction("Focus Peaking", &CameraView::showFocusPeaking);
+  m_overlay_menu->addSeparator();
+  QAction *obstacles = m_overlay_menu->addAction("Obstacles");
+  obstacles->setCheckable(true);
+  obstacles->setChecked(false);
+  obstacles->setToolTip("Requires a disparity stream");
+  connect(obstacles, &QAction::toggled, [this](bool checked){ m_obstacles.setEnabled(checked); });
+  QAction *depth = m_overlay_menu->addAction("Depth Statistics");
+  depth->setCheckable(true);
+  depth->setChecked(false);
+  depth->setToolTip("Measures the zoomed region of the disparity view, or the full frame");
+  connect(depth, &QAction::toggled, [this](bool checked){ m_depth_stats.setEnabled(checked); });
+  QAction *triangulate = m_overlay_menu->addAction("Triangulate Matches");
+  triangulate->setCheckable(true);
+  triangulate->setChecked(false);
+  triangulate->setToolTip("Replaces the recorded sparse point cloud, requires calibration and matching");
+  connect(triangulate, &QAction::toggled, [this](bool checked){ m_triangulator.setEnabled(checked); });
+  cfg.btnOverlays->setMenu(m_overlay_menu);
+  cfg.btnOverlays->setPopupMode(QToolButton::InstantPopup);
+
+  // Disparity post-processing
+  m_filter_menu = new QMenu(cfg.btnFilters);
+  addFilterAction("Speckle Removal", [this](bool on){ m_disparity_filter.setSpeckle(on); });
+  addFilterAction("Hole Filling", [this](bool on){ m_disparity_filter.setHoleFill(on); });
+  addFilterAction("Median 5x5", [this](bool on){ m_disparity_filter.setMedian(on); });
+  m_filter_menu->addSeparator();
+  addFilterAction("Temporal Smoothing", [this](bool on){ m_temporal_filter.setEnabled(on); });
+  cfg.btnFilters->setMenu(m_filter_menu);
+  cfg.btnFilters->setPopupMode(QToolButton::InstantPopup);
+  cfg.btnFilters->setVisible(false);
+
   //fileManager
   cfg.cbxFileType->addItem("Firmware", "FRW");
   cfg.cbxFileType->addItem("DNN Weights", "DNN");
@@ -257,6 +316,24 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
   }
 
   m_data_thread = std::make_unique<labforge::io::DataThread>();
+  // Recording queue, the budget applies once the queue has drained
+  cfg.cbxQueuePolicy->addItem("Drop Newest", labforge::io::QUEUE_DROP_NEWEST);
+  cfg.cbxQueuePolicy->addItem("Drop Oldest", labforge::io::QUEUE_DROP_OLDEST);
+  cfg.cbxQueuePolicy->addItem("Block", labforge::io::QUEUE_BLOCK);
+  m_data_thread->setMemoryBudget(static_cast<size_t>(cfg.spinRecordBudget->value()) * 1024 * 1024);
+  connect(cfg.spinRecordBudget, QOverload<int>::of(&QSpinBox::valueChanged), [this](int mb){
+    m_data_thread->setMemoryBudget(static_cast<size_t>(mb) * 1024 * 1024);
+  });
+  connect(cfg.cbxQueuePolicy, QOverload<int>::of(&QComboBox::currentIndexChanged), [this](int){
+    m_data_thread->setQueuePolicy(static_cast<labforge::io::QueuePolicy>(cfg.cbxQueuePolicy->currentData().toInt()));
+  });
+  m_raw_recorder = std::make_unique<labforge::io::RawRecorder>();
+  m_video_recorder = std::make_unique<labforge::io::VideoRecorder>();
+  connect(&m_recording_timer, &QTimer::timeout, this, &MainWindow::updateRecording);
+  connect(cfg.chkAdaptive, &QCheckBox::toggled, [this](bool adaptive){
+    m_recording_scheduler.setAdaptive(adaptive);
+    applyRecordingLevel();
+  });
 
   //status
   resetStatusCounters();
@@ -279,6 +356,8 @@ MainWindow::~MainWindow(){
   if(m_data_thread){
     m_data_thread.reset();
   }
+  m_raw_recorder.reset();
+  m_video_recorder.reset();
   if(m_upbar){
     m_upbar->close();
     delete m_upbar;
@@ -350,17 +429,38 @@ void MainWindow::handleStart() {
 
       cfg.chkCalibrate->setEnabled(false);
       resetStatusCounters();
+      m_scheduler.start();
+      for(auto &colorizer : m_colorizer) {
+        colorizer.reset();
+      }
+      m_temporal_filter.reset();
+      m_rectification.reset();
+      // Push the recording layout to the data thread on the first frame
+      m_frame_layout = qMakePair(FORMAT_NONE, FORMAT_NONE);
 
       cv::Mat qMat;
       m_calib.getDepthMatrix(qMat);
       m_data_thread->setDepthMatrix(qMat);
+      m_obstacles.setDepthMatrix(qMat);
+      m_depth_stats.setDepthMatrix(qMat);
+      cv::Mat p1, p2;
+      m_calib.getProjectionMatrices(p1, p2);
+      m_triangulator.setProjection(p1, p2);
     }
   }
 }
 
 void MainWindow::handleStop(bool fatal) {
   cfg.cbxFormat->setEnabled(true);
+  cfg.cbxRaw->setEnabled(true);
+  cfg.spinPreTrigger->setEnabled(cfg.cbxRaw->isChecked());
+  cfg.cbxTriggerDetect->setEnabled(cfg.cbxRaw->isChecked());
+  cfg.cbxVideo->setEnabled(!cfg.cbxRaw->isChecked());
+  cfg.cbxRecordColormap->setEnabled(true);
+  stopRecordingScheduler();
   m_data_thread->stop();
+  closeRawSession();
+  m_video_recorder->close();
   if(!cfg.btnRecord->isEnabled()){
     cfg.btnSave->setEnabled(true);
     cfg.btnRecord->setEnabled(true);
@@ -370,6 +470,10 @@ void MainWindow::handleStop(bool fatal) {
   }
 
   m_pipeline->Stop();
+  m_scheduler.stop();
+  m_staged.left.release();
+  m_staged.right.release();
+  m_staged.converted = false;
   cfg.btnStop->setEnabled(false);
   cfg.btnStart->setEnabled(true);
   cfg.btnSave->setEnabled(false);
@@ -425,25 +529,160 @@ void MainWindow::handleRecording(){
   cfg.editFolder->setEnabled(false);
   cfg.btnFolder->setEnabled(false);
   cfg.cbxFormat->setEnabled(false);
+  cfg.cbxRaw->setEnabled(false);
+  cfg.spinPreTrigger->setEnabled(false);
+  cfg.cbxTriggerDetect->setEnabled(false);
+  cfg.cbxVideo->setEnabled(false);
+  cfg.cbxRecordColormap->setEnabled(false);
+  m_data_thread->setColormapped(cfg.cbxRecordColormap->isChecked());
   m_saving = false;
 
-  if(!m_data_thread->setFolder(cfg.editFolder->text())){
+  if(cfg.cbxRaw->isChecked()){
+    const bool started = (cfg.spinPreTrigger->value() > 0) ? armRawSession() : openRawSession();
+    if(!started){
+      handleStop();
+    }
+  } else if(cfg.cbxVideo->currentData().toInt() != labforge::io::VIDEO_NONE){
+    if(!openVideoSession()){
+      handleStop();
+    }
+  } else if(!m_data_thread->setFolder(cfg.editFolder->text())){
     QMessageBox::critical(this, "Folder Error", "Could not create or find folder. Make sure you have appropriate write permission to the destination folder.");
   }
-
+  if(isRecording()){
+    startRecordingScheduler();
+  }
 }
 
 void MainWindow::handleSave(){
   cfg.btnSave->setEnabled(false);
   cfg.btnRecord->setEnabled(false);
   cfg.cbxFormat->setEnabled(false);
+  cfg.cbxRaw->setEnabled(false);
+  cfg.cbxRecordColormap->setEnabled(false);
+  m_data_thread->setColormapped(cfg.cbxRecordColormap->isChecked());
   m_saving = true;
 
-  if(!m_data_thread->setFolder(cfg.editFolder->text())){
+  if(cfg.cbxRaw->isChecked()){
+    if(!openRawSession()){
+      handleStop();
+    }
+  } else if(!m_data_thread->setFolder(cfg.editFolder->text())){
     QMessageBox::critical(this, "Folder Error", "Could not create or find folder. Make sure you have appropriate write permission to the destination folder.");
   }
 }
 
+bool MainWindow::openRawSession(){
+  QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+  QString folder = QDir(cfg.editFolder->text()).filePath("raw_" + stamp);
+  const bool opened = m_raw_recorder->isArmed() ? m_raw_recorder->trigger(folder) : m_raw_recorder->open(folder);
+  if(!opened){
+    QMessageBox::critical(this, "Folder Error", "Could not create the raw session " + folder + ". Make sure you have appropriate write permission and free space in the destination folder.");
+    return false;
+  }
+  if(m_pipeline){
+    m_pipeline->KeepChunks(true);
+  }
+  return true;
+}
+
+bool MainWindow::openVideoSession(){
+  QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+  QString folder = QDir(cfg.editFolder->text()).filePath("video_" + stamp);
+  const auto codec = static_cast<labforge::io::VideoCodec>(cfg.cbxVideo->currentData().toInt());
+  if(!m_video_recorder->open(folder, codec)){
+    QMessageBox::critical(this, "Folder Error", "Could not create the video session " + folder + ". Make sure you have appropriate write permission to the destination folder.");
+    return false;
+  }
+  return true;
+}
+
+bool MainWindow::armRawSession(){
+  if(!m_raw_recorder->arm(cfg.spinPreTrigger->value())){
+    QMessageBox::critical(this, "Memory Error", "Could not reserve " + QString::number(PRETRIGGER_MEMORY_BUDGET >> 20) + " MB for the pre-trigger history.");
+    return false;
+  }
+  if(m_pipeline){
+    m_pipeline->KeepChunks(true);
+  }
+  cfg.btnTrigger->setEnabled(true);
+  return true;
+}
+
+void MainWindow::handleTrigger(){
+  if(!m_raw_recorder->isArmed())
+    return;
+  cfg.btnTrigger->setEnabled(false);
+  if(!openRawSession()){
+    handleStop();
+  }
+}
+
+void MainWindow::closeRawSession(){
+  cfg.btnTrigger->setEnabled(false);
+  if(m_pipeline){
+    m_pipeline->KeepChunks(false);
+  }
+  m_raw_recorder->close();
+}
+
+void MainWindow::startRecordingScheduler() {
+  const QString folder = cfg.editFolder->text();
+  m_recording_scheduler.start(folder, cfg.chkAdaptive->isChecked());
+  applyRecordingLevel();
+  QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+  m_recording_log.open(QDir(folder).filePath("recording_" + stamp + ".csv"),
+                       {"timestamp", "level", "queue_fill", "dropped", "free_mb", "write_mb_s", "probe_mb_s",
+                        "seconds_to_full"});
+  m_recording_timer.start(RECORDING_UPDATE_MS);
+}
+
+void MainWindow::stopRecordingScheduler() {
+  m_recording_timer.stop();
+  m_recording_scheduler.stop();
+  m_recording_log.close();
+  applyRecordingLevel();
+}
+
+void MainWindow::applyRecordingLevel() {
+  // The codec and the frame rate are applied per frame
+  m_data_thread->setPointClouds(m_recording_scheduler.pointClouds());
+}
+
+void MainWindow::updateRecording() {
+  if(!isRecording() || !m_recording_scheduler.isActive())
+    return;
+
+  labforge::io::RecordingScheduler::Sample sample = {0, 0, 0};
+  if(m_raw_recorder->isOpen()) {
+    const labforge::io::RawRecorder::Stats raw = m_raw_recorder->stats();
+    sample = {raw.pending, raw.capacity, raw.dropped};
+  } else if(m_video_recorder->isOpen()) {
+    const labforge::io::VideoRecorder::Stats video = m_video_recorder->stats();
+    sample = {video.pending, video.streams * VIDEO_STREAM_SLOTS, video.dropped};
+  } else {
+    const labforge::io::DataThread::Stats stats = m_data_thread->stats();
+    sample = {stats.pending, stats.capacity, stats.dropped};
+  }
+  if(m_recording_scheduler.update(sample))
+    applyRecordingLevel();
+
+  const labforge::io::RecordingScheduler::Stats stats = m_recording_scheduler.stats();
+  if(m_recording_log.isOpen()) {
+    m_recording_log << QDateTime::currentMSecsSinceEpoch() << labforge::io::RecordingScheduler::levelName(stats.level)
+                    << stats.fill << sample.dropped << (stats.free_bytes >> 20) << stats.write_mb_s << stats.probe_mb_s
+                    << stats.seconds_to_full;
+    m_recording_log.endRow();
+  }
+  if(stats.full) {
+    // The reserve leaves room for the frames still queued
+    handleStop();
+    QMessageBox::warning(this, "Recording Stopped",
+                         "Less than " + QString::number(RECORDING_RESERVE_BYTES >> 20) + " MB left in " +
+                         cfg.editFolder->text() + ", the recording was stopped.");
+  }
+}
+
 void MainWindow::onFolderSelect(){
   QString fpath = cfg.editFolder->text().isEmpty()?QDir::currentPath():cfg.editFolder->text();
   QString selected_dir = QFileDialog::getExistingDirectory(this, tr("Select Directory"),
@@ -499,7 +738,10 @@ void MainWindow::handleDisconnect() {
   }
 
   OnDisconnected();
+  stopRecordingScheduler();
   m_data_thread->stop();
+  closeRawSession();
+  m_video_recorder->close();
   resetStatusCounters();
   this->statusBar()->clearMessage();
 }
@@ -507,6 +749,174 @@ void MainWindow::handleDisconnect() {
 void MainWindow::handleFocus() {
   cfg.widgetLeftSensor->enableFocus(cfg.cbxFocus->isChecked());
   cfg.widgetRightSensor->enableFocus(cfg.cbxFocus->isChecked());
+  // Sweeps record the focus metric
+  if(!cfg.cbxFocus->isChecked())
+    cfg.cbxSweep->setChecked(false);
+  cfg.cbxSweep->setEnabled(cfg.cbxFocus->isChecked());
+}
+
+void MainWindow::handleAnalytics() {
+  if(!cfg.cbxAnalytics->isChecked()) {
+    m_analytics.close();
+    m_obstacle_log.close();
+    m_depth_log.close();
+    m_rectification_log.close();
+    return;
+  }
+
+  QStringList columns = {"timestamp", "count", "gain", "exposure"};
+  for(const QString side : {"left", "right"}) {
+    columns << side + "_mean" << side + "_clipped_pct" << side + "_crushed_pct"
+            << side + "_p01" << side + "_p50" << side + "_p99";
+    for(int zone = 0; zone < EXPOSURE_ZONES; ++zone) {
+      columns << QString("%1_zone_%2_%3").arg(side).arg(zone % EXPOSURE_ZONES_X).arg(zone / EXPOSURE_ZONES_X);
+    }
+  }
+  columns << "mismatch_pct";
+
+  QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+  QString fname = QDir(cfg.editFolder->text()).filePath("analytics_" + stamp + ".csv");
+  if(!m_analytics.open(fname, columns)) {
+    QMessageBox::warning(this, "Analytics", "Could not write " + fname);
+    cfg.cbxAnalytics->setChecked(false);
+    return;
+  }
+
+  // Disparity and matching analytics get their own logs, rows are only written for frames carrying them
+  QStringList obstacle_columns = {"timestamp", "count", "ground", "slope", "offset", "horizon", "obstacle_pixels", "ms"};
+  for(int sector = 0; sector < OBSTACLE_SECTORS; ++sector) {
+    obstacle_columns << QString("sector_%1_disparity").arg(sector) << QString("sector_%1_depth").arg(sector);
+  }
+  const QStringList depth_columns = {"timestamp", "count", "roi_x", "roi_y", "roi_width", "roi_height", "valid_pct",
+                                     "min", "median", "max", "near", "depth", "far"};
+  const QStringList rectification_columns = {"timestamp", "count", "matches", "outliers", "bias", "p50", "p95",
+                                             "session_p50", "session_p95", "baseline", "drift", "spread", "degraded"};
+  auto open = [this, &stamp](labforge::io::CsvLogger &log, const QString &prefix, const QStringList &header) {
+    QString name = QDir(cfg.editFolder->text()).filePath(prefix + stamp + ".csv");
+    if(log.open(name, header))
+      return true;
+    QMessageBox::warning(this, "Analytics", "Could not write " + name);
+    return false;
+  };
+  if(!open(m_obstacle_log, "obstacles_", obstacle_columns) || !open(m_depth_log, "depth_", depth_columns) ||
+     !open(m_rectification_log, "rectification_", rectification_columns)) {
+    m_analytics.close();
+    m_obstacle_log.close();
+    m_depth_log.close();
+    m_rectification_log.close();
+    cfg.cbxAnalytics->setChecked(false);
+  }
+}
+
+void MainWindow::handleSweep() {
+  if(cfg.cbxSweep->isChecked()) {
+    cfg.widgetLeftSensor->startSweep();
+    cfg.widgetRightSensor->startSweep();
+    return;
+  }
+
+  cfg.widgetLeftSensor->stopSweep();
+  cfg.widgetRightSensor->stopSweep();
+
+  // Export into the output folder, one file per sensor
+  QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+  QStringList saved;
+  for(auto view : {qMakePair(cfg.widgetLeftSensor, QString("left")),
+                   qMakePair(cfg.widgetRightSensor, QString("right"))}) {
+    const FocusSweep &sweep = view.first->sweep();
+    if(sweep.size() == 0)
+      continue;
+    QString fname = QDir(cfg.editFolder->text()).filePath("focus_sweep_" + stamp + "_" + view.second + ".csv");
+    if(!sweep.exportCsv(fname)) {
+      QMessageBox::warning(this, "Focus Sweep", "Could not write " + fname);
+      continue;
+    }
+    FocusSweep::Peak peak = sweep.peak();
+    saved << fname + (peak.valid ? QString(" (peak %1 at frame %2)").arg(peak.sharpness, 0, 'f', 0).arg(peak.count) : "");
+  }
+  if(!saved.isEmpty()) {
+    QMessageBox::information(this, "Focus Sweep", "Saved:\n" + saved.join("\n"));
+  }
+}
+
+/**
+ * Encoder threads of the recording, the benchmark scales its rates to them.
+ */
+static int s_encoder_count() {
+  return std::max(1, QThread::idealThreadCount() - 1);
+}
+
+void MainWindow::handleBenchmark() {
+  if(m_benchmark.isRunning())
+    return;
+
+  // Synthetic frames at the stream size, received parts as raw sessions get them and views as recorded
+  cv::Size size(CODEC_BENCHMARK_WIDTH, CODEC_BENCHMARK_HEIGHT);
+  if(!m_staged.left.empty())
+    size = m_staged.left.size();
+  std::vector<labforge::io::BenchmarkFrame> frames = labforge::io::syntheticFrames(size);
+  auto add = [&frames](const QString &name, const cv::Mat &image) {
+    if(!image.empty())
+      frames.push_back({name + ((image.type() == CV_8UC2) ? " (YUYV)" : (image.type() == CV_16UC1) ? " (16-bit)" : ""),
+                        image.clone()});
+  };
+  add("received left", m_staged.left);
+  add("received right", m_staged.right);
+  if(m_staged.converted) {
+    const QImage *views[2] = {&m_staged.frame.q1, &m_staged.frame.q2};
+    for(int i = 0; i < 2; ++i) {
+      if(views[i]->isNull())
+        continue;
+      const QImage rgb = views[i]->convertToFormat(QImage::Format_RGB32);
+      add(i ? "right view" : "left view", cv::Mat(rgb.height(), rgb.width(), CV_8UC4,
+                                                  const_cast<uchar *>(rgb.constBits()), rgb.bytesPerLine()));
+    }
+  }
+
+  cfg.btnBenchmark->setEnabled(false);
+  cfg.btnBenchmark->setText("Benchmarking...");
+  const int encoders = s_encoder_count();
+  m_benchmark.setFuture(QtConcurrent::run([frames, encoders]() {
+    return labforge::io::runCodecBenchmark(frames, encoders);
+  }));
+}
+
+void MainWindow::showBenchmark() {
+  cfg.btnBenchmark->setEnabled(true);
+  cfg.btnBenchmark->setText("Benchmark");
+  const std::vector<labforge::io::BenchmarkResult> results = m_benchmark.result();
+
+  QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+  QString fname = QDir(cfg.editFolder->text()).filePath("codec_benchmark_" + stamp + ".csv");
+  const bool saved = labforge::io::exportCodecBenchmark(results, fname);
+
+  QDialog dialog(this);
+  dialog.setWindowTitle("Codec Benchmark");
+  auto *layout = new QVBoxLayout(&dialog);
+  auto *table = new QTableWidget(static_cast<int>(results.size()), 7, &dialog);
+  table->setHorizontalHeaderLabels({"Frame", "Codec", "ms", "MB/s", "Ratio", "FPS", "Lossless"});
+  table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+  table->verticalHeader()->setVisible(false);
+  for(int row = 0; row < static_cast<int>(results.size()); ++row) {
+    const labforge::io::BenchmarkResult &result = results[row];
+    table->setItem(row, 0, new QTableWidgetItem(result.frame));
+    table->setItem(row, 1, new QTableWidgetItem(result.codec));
+    table->setItem(row, 2, new QTableWidgetItem(QString::number(result.ms, 'f', 2)));
+    table->setItem(row, 3, new QTableWidgetItem(QString::number(result.mb_per_s, 'f', 0)));
+    table->setItem(row, 4, new QTableWidgetItem(QString::number(result.ratio, 'f', 2)));
+    table->setItem(row, 5, new QTableWidgetItem(QString::number(result.fps, 'f', 0)));
+    table->setItem(row, 6, new QTableWidgetItem(result.lossless ? "yes" : "no"));
+  }
+  table->resizeColumnsToContents();
+  layout->addWidget(table);
+  layout->addWidget(new QLabel(QString("FPS is per image on %1 encoder threads, without disk writes.\n%2")
+                               .arg(s_encoder_count()).arg(saved ? "Saved " + fname : "Could not write " + fname),
+                               &dialog));
+  auto *buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+  connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+  layout->addWidget(buttons);
+  dialog.resize(720, 480);
+  dialog.exec();
 }
 
 static bool validateFileType(QString fname, QString ftype){
@@ -757,53 +1167,524 @@ void MainWindow::handleTimeOut(){
   QMessageBox::information(this, "Connection Error", "Camera disconnected: Communication timed out.");
 }
 
-void MainWindow::newData(uint64_t timestamp, QImage &left, QImage &right, QPair<QString, QString> &label,
-                         bool disparity, uint16_t *raw_disparity, int32_t min_disparity,
-                         const pointcloud_t &pc) {
-  // Set the image
-  bool stereo = !label.second.isEmpty();
-  cfg.widgetLeftSensor->setImage(left, false);
+bool MainWindow::isRecording() const {
+  bool is_saving = (!cfg.btnSave->isEnabled() && m_saving);
+  bool is_recording = (!cfg.btnRecord->isEnabled() && !cfg.btnSave->isEnabled() && !m_saving);
+  return is_saving || is_recording;
+}
+
+void MainWindow::convertDisparity(const cv::Mat &raw, int slot, QImage &out) {
+  int colormap = cfg.cbxColormap->currentIndex();
+  if(colormap > 0) {
+    m_colorizer[slot].setColormap(colormap - 1);
+    m_colorizer[slot].setOverride(cfg.spinMinDisparity->value(), cfg.spinMaxDisparity->value());
+    m_colorizer[slot].process(raw, out);
+  } else {
+    out = s_mono_to_qimage(&raw);
+  }
+}
+
+template<int L, int R>
+void MainWindow::prepareFrame(const cv::Mat &left, const cv::Mat &right, ConvertedFrame &out) {
+  using Layout = FrameLayout<L, R>;
+
+  // Post-processing applies to displayed, exported and recorded disparity alike
+  if constexpr(Layout::disparity_slot >= 0) {
+    out.raw_disparity = m_disparity_filter.apply((Layout::disparity_slot == 0) ? left : right);
+  } else {
+    out.raw_disparity = cv::Mat();
+  }
+  if constexpr(Layout::confidence_slot >= 0) {
+    out.raw_confidence = (Layout::confidence_slot == 0) ? left : right;
+  } else {
+    out.raw_confidence = cv::Mat();
+  }
+
+  out.q1 = QImage();
+  out.q2 = QImage();
+  out.disparity = (Layout::disparity_slot >= 0);
+  out.disparity_slot = Layout::disparity_slot;
+  out.intensity[0] = Layout::intensity[0];
+  out.intensity[1] = Layout::intensity[1];
+  out.label.first = Layout::labels[0];
+  out.label.second = Layout::labels[1];
+  out.imtype = Layout::imtype;
+}
+
+template<int L, int R>
+void MainWindow::convertFrame(const cv::Mat &left, const cv::Mat &right, ConvertedFrame &out) {
+  using Layout = FrameLayout<L, R>;
+
+  prepareFrame<L, R>(left, right, out);
+  const cv::Mat &first = (Layout::disparity_slot == 0) ? out.raw_disparity : left;
+  const cv::Mat &second = (Layout::disparity_slot == 1) ? out.raw_disparity : right;
+
+  if constexpr(L == CV_16UC1) {
+    convertDisparity(first, 0, out.q1);
+  } else {
+    out.q1 = s_yuv2_to_qimage(&first);
+  }
+  if constexpr(R == CV_16UC1) {
+    convertDisparity(second, 1, out.q2);
+  } else if constexpr(R == CV_8UC2) {
+    out.q2 = s_yuv2_to_qimage(&second);
+  }
+}
+
+void MainWindow::recordVideo(const BNImageData &image, const ConvertedFrame &frame) {
+  const uint64_t counter = image.info.count;
+  const bool lossless = m_video_recorder->isLossless();
+  const bool colormapped = cfg.cbxRecordColormap->isChecked() || !lossless;
+  const QImage *views[2] = {&frame.q1, &frame.q2};
+
+  if(frame.intensity[0])
+    m_video_recorder->write(labforge::io::OUTPUT_LEFT, counter, image.timestamp, frame.q1);
+  if(frame.intensity[1])
+    m_video_recorder->write(labforge::io::OUTPUT_RIGHT, counter, image.timestamp, frame.q2);
+  if(frame.disparity_slot >= 0) {
+    if(lossless)
+      m_video_recorder->write(labforge::io::OUTPUT_DISPARITY, counter, image.timestamp, frame.raw_disparity);
+    if(colormapped)
+      m_video_recorder->write(labforge::io::OUTPUT_DISPARITY_COLOR, counter, image.timestamp, *views[frame.disparity_slot]);
+  }
+  // Confidence is only streamed next to disparity, in the other view
+  if(!frame.raw_confidence.empty() && (frame.disparity_slot >= 0)) {
+    if(lossless)
+      m_video_recorder->write(labforge::io::OUTPUT_CONFIDENCE, counter, image.timestamp, frame.raw_confidence);
+    if(colormapped)
+      m_video_recorder->write(labforge::io::OUTPUT_CONFIDENCE_COLOR, counter, image.timestamp, *views[1 - frame.disparity_slot]);
+  }
+}
+
+void MainWindow::recordData(uint64_t timestamp, const ConvertedFrame &frame, int32_t min_disparity,
+                            const pointcloud_t &pc, const std::vector<cv::Vec3b> &pc_colors) {
+  m_data_thread->process(timestamp, frame.q1, frame.q2, m_recording_scheduler.format(cfg.cbxFormat->currentData().toString()),
+                         frame.raw_disparity, frame.raw_confidence, min_disparity, pc, pc_colors);
+  if(m_saving){
+    cfg.btnSave->setEnabled(true);
+    cfg.btnRecord->setEnabled(true);
+    cfg.cbxFormat->setEnabled(true);
+    cfg.cbxRaw->setEnabled(true);
+    cfg.cbxRecordColormap->setEnabled(true);
+    m_saving = false;
+  }
+}
+
+void MainWindow::recordRaw(const BNImageData &image, const labforge::io::RawFormat formats[2]) {
+  labforge::io::RawFrame &frame = m_raw_frame;
+  frame.counter = image.info.count;
+  frame.real_time = image.timestamp;
+  frame.min_disparity = image.min_disparity;
+  frame.formats[0] = formats[0];
+  frame.formats[1] = formats[1];
+  frame.images[0] = *image.left;
+  frame.images[1] = *image.right;
+  frame.chunks.assign(image.chunks.begin(), image.chunks.end());
+  m_raw_recorder->process(frame);
+  // Do not hold on to the stream buffers
+  frame.images[0].release();
+  frame.images[1].release();
+  if(m_saving){
+    closeRawSession();
+    cfg.btnSave->setEnabled(true);
+    cfg.btnRecord->setEnabled(true);
+    cfg.cbxFormat->setEnabled(true);
+    cfg.cbxRaw->setEnabled(true);
+    cfg.cbxRecordColormap->setEnabled(true);
+    m_saving = false;
+  }
+}
+
+std::pair<bool, bool> MainWindow::displayData(const ConvertedFrame &frame) {
+  std::pair<bool, bool> rendered(false, false);
+  bool stereo = !frame.label.second.isEmpty();
   cfg.widgetRightSensor->setVisible(stereo);
   cfg.lblDisplayRight->setVisible(stereo);
 
-  cfg.labelColormap->setVisible(disparity);
-  cfg.cbxColormap->setVisible(disparity);
+  cfg.labelColormap->setVisible(frame.disparity);
+  cfg.cbxColormap->setVisible(frame.disparity);
+  cfg.cbxRecordColormap->setVisible(frame.disparity);
 
-  cfg.lblMinDisparity->setVisible(disparity);
-  cfg.lblMaxDisparity->setVisible(disparity);
-  cfg.spinMinDisparity->setVisible(disparity);
-  cfg.spinMaxDisparity->setVisible(disparity);
+  cfg.lblMinDisparity->setVisible(frame.disparity);
+  cfg.lblMaxDisparity->setVisible(frame.disparity);
+  cfg.btnFilters->setVisible(frame.disparity);
+  cfg.spinMinDisparity->setVisible(frame.disparity);
+  cfg.spinMaxDisparity->setVisible(frame.disparity);
 
-  cfg.lblDisplayLeft->setText(label.first);
+  cfg.lblDisplayLeft->setText(frame.label.first);
+  if(RenderScheduler::isRenderable(cfg.widgetLeftSensor)) {
+    cfg.widgetLeftSensor->setImage(frame.q1, true);
+    rendered.first = true;
+  }
   if(stereo){
-    cfg.widgetRightSensor->setImage(right, false);
-    cfg.lblDisplayRight->setText(label.second);
+    cfg.lblDisplayRight->setText(frame.label.second);
+    if(RenderScheduler::isRenderable(cfg.widgetRightSensor)) {
+      cfg.widgetRightSensor->setImage(frame.q2, true);
+      rendered.second = true;
+    }
   }
 
-  // Do we have boundingboxes or feature points
-  QColor color_dnn(255, 0, 0, 255);
-  QColor color_feature(0, 255, 0, 255);
+  // Restyling is expensive, only do it once streaming starts
+  static const QString s_streaming_style = QStringLiteral("background-color:black; border: 2px solid green;");
+  if(cfg.widgetLeftSensor->styleSheet() != s_streaming_style) {
+    cfg.widgetLeftSensor->setStyleSheet(s_streaming_style);
+    cfg.widgetRightSensor->setStyleSheet(s_streaming_style);
+  }
+  return rendered;
+}
 
-  bool is_saving = (!cfg.btnSave->isEnabled() && m_saving);
-  bool is_recording = (!cfg.btnRecord->isEnabled() && !cfg.btnSave->isEnabled() && !m_saving);
-  if(is_saving || is_recording){
-    m_data_thread->process(timestamp, left, right, cfg.cbxFormat->currentData().toString(),
-                           raw_disparity, min_disparity, pc);
-    if(is_saving){
-      cfg.btnSave->setEnabled(true);
-      cfg.btnRecord->setEnabled(true);
-      cfg.cbxFormat->setEnabled(true);
-      m_saving = false;
+void MainWindow::addOverlayAction(const QString &name, OverlayLayer layer) {
+  QAction *action = m_overlay_menu->addAction(name);
+  action->setCheckable(true);
+  action->setChecked(true);
+  connect(action, &QAction::toggled, [this, layer](bool checked){
+    for(CameraView *view : {cfg.widgetLeftSensor, cfg.widgetRightSensor}) {
+      view->overlay().setVisible(layer, checked);
+      view->redraw();
+    }
+  });
+}
+
+void MainWindow::addFilterAction(const QString &name, const std::function<void(bool)> &enable) {
+  QAction *action = m_filter_menu->addAction(name);
+  action->setCheckable(true);
+  action->setChecked(false);
+  // Takes effect with the next converted frame
+  connect(action, &QAction::toggled, enable);
+}
+
+void MainWindow::addFocusAction(const QString &name, void (CameraView::*show)(bool)) {
+  QAction *action = m_overlay_menu->addAction(name);
+  action->setCheckable(true);
+  action->setChecked(false);
+  action->setToolTip("Requires Focus to be enabled");
+  connect(action, &QAction::toggled, [this, show](bool checked){
+    for(CameraView *view : {cfg.widgetLeftSensor, cfg.widgetRightSensor}) {
+      (view->*show)(checked);
+    }
+  });
+}
+
+void MainWindow::annotate(CameraView *view, const keypoints_t &keypoints, const bboxes_t &boxes) {
+  Overlay &overlay = view->overlay();
+  if(overlay.isVisible(LAYER_FEATURES)) {
+    for(const auto &kp : keypoints) {
+      overlay.addPoint(LAYER_FEATURES, QPointF(kp.x, kp.y));
+    }
+  }
+  if(overlay.isVisible(LAYER_TARGETS)) {
+    for(const auto &box : boxes) {
+      QRectF rect(QPointF(box.left, box.top), QPointF(box.right, box.bottom));
+      overlay.addRect(LAYER_TARGETS, rect);
+      overlay.addLabel(LAYER_TARGETS, rect, QString::fromLatin1(box.label));
     }
   }
+}
+
+void MainWindow::annotateObstacles(CameraView *view) {
+  const labforge::proc::ObstacleResult &result = m_obstacles.result();
+  Overlay &overlay = view->overlay();
+  if(!overlay.isVisible(LAYER_OBSTACLES) || result.mask.empty())
+    return;
+
+  // Translucent mask, the detector overwrites its buffer with the next frame
+  static const QVector<QRgb> s_palette = []{
+    QVector<QRgb> palette(256, qRgba(0, 0, 0, 0));
+    palette[255] = qRgba(255, 0, 0, 96);
+    return palette;
+  }();
+  QImage mask(result.mask.data, result.mask.cols, result.mask.rows, static_cast<int>(result.mask.step),
+              QImage::Format_Indexed8);
+  mask.setColorTable(s_palette);
+  overlay.setImage(LAYER_OBSTACLES, mask.copy());
+
+  if(result.ground && result.horizon >= 0 && result.horizon < result.mask.rows) {
+    overlay.addLine(LAYER_OBSTACLES, QLineF(0, result.horizon, result.mask.cols, result.horizon));
+  }
+  for(int s = 0; s < OBSTACLE_SECTORS; ++s) {
+    if(result.disparity[s] <= 0)
+      continue;
+    const double x0 = static_cast<double>(result.mask.cols) * s / OBSTACLE_SECTORS;
+    const double x1 = static_cast<double>(result.mask.cols) * (s + 1) / OBSTACLE_SECTORS;
+    QRectF rect(QPointF(x0, result.top[s]), QPointF(x1, result.bottom[s] + 1));
+    overlay.addRect(LAYER_OBSTACLES, rect);
+    overlay.addLabel(LAYER_OBSTACLES, rect, (result.depth[s] > 0) ? QString::number(result.depth[s], 'f', 2)
+                                                                   : "d " + QString::number(result.disparity[s], 'f', 0));
+  }
+}
 
-  // Force redraw with updated feature points / boxes
-  cfg.widgetLeftSensor->redrawPixmap();
-  cfg.widgetRightSensor->redrawPixmap();
+void MainWindow::annotateDepth(CameraView *view) {
+  const labforge::proc::DepthStats &stats = m_depth_stats.stats();
+  Overlay &overlay = view->overlay();
+  if(!overlay.isVisible(LAYER_MEASUREMENTS) || stats.pixels == 0)
+    return;
 
-  cfg.widgetLeftSensor->setStyleSheet(QStringLiteral("background-color:black; border: 2px solid green;"));
-  cfg.widgetRightSensor->setStyleSheet(QStringLiteral("background-color:black; border: 2px solid green;"));
+  QRectF roi(stats.roi.x, stats.roi.y, stats.roi.width, stats.roi.height);
+  QString text = QString("Valid %1%").arg(stats.ratio * 100, 0, 'f', 1);
+  if(stats.valid > 0) {
+    text += QString("\nDisparity %1 / %2 / %3").arg(stats.min, 0, 'f', 2).arg(stats.median, 0, 'f', 2)
+                                                .arg(stats.max, 0, 'f', 2);
+    if(stats.depth > 0) {
+      text += QString("\nDepth %1 / %2 / %3").arg(stats.nearest, 0, 'f', 3).arg(stats.depth, 0, 'f', 3)
+                                             .arg(stats.farthest, 0, 'f', 3);
+    }
+  }
+  // Text in the top band of the region, the region itself is outlined
+  overlay.addRect(LAYER_MEASUREMENTS, roi);
+  overlay.addLabel(LAYER_MEASUREMENTS, QRectF(roi.topLeft(), QSizeF(roi.width(), roi.height() / 4)), text);
+}
 
+void MainWindow::logDepth(const BNImageData &image, const labforge::proc::DepthStats &stats) {
+  // Copy, info_t is packed
+  const uint32_t count = image.info.count;
+  m_depth_log << image.timestamp << count << stats.roi.x << stats.roi.y << stats.roi.width << stats.roi.height
+              << stats.ratio * 100 << stats.min << stats.median << stats.max << stats.nearest << stats.depth
+              << stats.farthest;
+  m_depth_log.endRow();
+}
+
+void MainWindow::logRectification(const BNImageData &image, const labforge::proc::RectificationStats &stats) {
+  // Copy, info_t is packed
+  const uint32_t count = image.info.count;
+  m_rectification_log << image.timestamp << count << stats.matches << stats.outliers << stats.bias << stats.p50
+                      << stats.p95 << stats.session_p50 << stats.session_p95 << stats.baseline << stats.drift
+                      << stats.spread << static_cast<int>(stats.degraded);
+  m_rectification_log.endRow();
+}
+
+void MainWindow::logObstacles(const BNImageData &image, const labforge::proc::ObstacleResult &result) {
+  // Copy, info_t is packed
+  const uint32_t count = image.info.count;
+  m_obstacle_log << image.timestamp << count << static_cast<int>(result.ground) << result.slope << result.offset
+                 << result.horizon << result.pixels << result.timing;
+  for(int s = 0; s < OBSTACLE_SECTORS; ++s) {
+    m_obstacle_log << result.disparity[s] << result.depth[s];
+  }
+  m_obstacle_log.endRow();
+}
+
+void MainWindow::logExposure(const BNImageData &image, const labforge::proc::ExposureStats *left,
+                             const labforge::proc::ExposureStats *right) {
+  // Copies, info_t is packed
+  const uint32_t count = image.info.count;
+  const float gain = image.info.gain;
+  const float exposure = image.info.exposure;
+  m_analytics << image.timestamp << count << gain << exposure;
+  for(const labforge::proc::ExposureStats *stats : {left, right}) {
+    if(stats == nullptr) {
+      // Keep columns aligned for sides without a camera image
+      for(int i = 0; i < 6 + EXPOSURE_ZONES; ++i) {
+        m_analytics << "";
+      }
+      continue;
+    }
+    m_analytics << stats->mean << stats->clipped << stats->crushed
+                << stats->percentile(0.01) << stats->percentile(0.5) << stats->percentile(0.99);
+    for(float zone : stats->zones) {
+      m_analytics << zone;
+    }
+  }
+  if(left && right) {
+    m_analytics << labforge::proc::ExposureAnalyzer::mismatch(*left, *right);
+  } else {
+    m_analytics << "";
+  }
+  m_analytics.endRow();
+}
+
+void MainWindow::selectFrameHandler(int left, int right) {
+  // One entry per FrameLayout specialization
+  static const struct {
+    int left;
+    int right;
+    FrameHandler handler;
+    labforge::io::ImageDataType imtype;
+  } s_handlers[] = {
+    {CV_8UC2, FORMAT_NONE, &MainWindow::handleFrame<CV_8UC2, FORMAT_NONE>, FrameLayout<CV_8UC2, FORMAT_NONE>::imtype},
+    {CV_16UC1, FORMAT_NONE, &MainWindow::handleFrame<CV_16UC1, FORMAT_NONE>, FrameLayout<CV_16UC1, FORMAT_NONE>::imtype},
+    {CV_8UC2, CV_8UC2, &MainWindow::handleFrame<CV_8UC2, CV_8UC2>, FrameLayout<CV_8UC2, CV_8UC2>::imtype},
+    {CV_8UC2, CV_16UC1, &MainWindow::handleFrame<CV_8UC2, CV_16UC1>, FrameLayout<CV_8UC2, CV_16UC1>::imtype},
+    {CV_16UC1, CV_8UC2, &MainWindow::handleFrame<CV_16UC1, CV_8UC2>, FrameLayout<CV_16UC1, CV_8UC2>::imtype},
+    {CV_16UC1, CV_16UC1, &MainWindow::handleFrame<CV_16UC1, CV_16UC1>, FrameLayout<CV_16UC1, CV_16UC1>::imtype},
+  };
+
+  // Unknown layouts are treated as color images
+  m_frame_handler = (right == FORMAT_NONE) ? &MainWindow::handleFrame<CV_8UC2, FORMAT_NONE>
+                                           : &MainWindow::handleFrame<CV_8UC2, CV_8UC2>;
+  labforge::io::ImageDataType imtype = (right == FORMAT_NONE) ? labforge::io::IMTYPE_IO
+                                                              : labforge::io::IMTYPE_LR;
+  for(const auto &entry : s_handlers) {
+    if((entry.left == left) && (entry.right == right)) {
+      m_frame_handler = entry.handler;
+      imtype = entry.imtype;
+      break;
+    }
+  }
+  m_frame_layout = qMakePair(left, right);
+  m_data_thread->setImageDataType(imtype);
+}
+
+void MainWindow::dispatchFrame(const BNImageData &image) {
+  int left = image.left->type();
+  int right = image.right->empty() ? FORMAT_NONE : image.right->type();
+  if((m_frame_layout.first != left) || (m_frame_layout.second != right)) {
+    selectFrameHandler(left, right);
+  }
+  (this->*m_frame_handler)(image);
+}
+
+template<int L, int R>
+void MainWindow::handleFrame(const BNImageData &image) {
+  using Layout = FrameLayout<L, R>;
+  m_payload = image.left->cols * image.left->rows * 16;
+
+  // Focus assist runs on every frame at native resolution, independent of display pacing
+  if constexpr(L == CV_8UC2) {
+    if(cfg.widgetLeftSensor->focusEnabled())
+      cfg.widgetLeftSensor->processFocus(*image.left, image.timestamp, image.info.count);
+  }
+  if constexpr(R == CV_8UC2) {
+    if(cfg.widgetRightSensor->focusEnabled())
+      cfg.widgetRightSensor->processFocus(*image.right, image.timestamp, image.info.count);
+  }
+
+  if constexpr((L == CV_8UC2) || (R == CV_8UC2)) {
+    if(m_analytics.isOpen()) {
+      const labforge::proc::ExposureStats *left = nullptr;
+      const labforge::proc::ExposureStats *right = nullptr;
+      if constexpr(L == CV_8UC2) {
+        left = &m_exposure[0].process(*image.left);
+      }
+      if constexpr(R == CV_8UC2) {
+        right = &m_exposure[1].process(*image.right);
+      }
+      logExposure(image, left, right);
+    }
+  }
+
+  // Temporal smoothing needs every frame, it replaces the raw disparity from here on
+  cv::Mat left = *image.left;
+  cv::Mat right = *image.right;
+  if constexpr(Layout::disparity_slot >= 0) {
+    cv::Mat &disparity = (Layout::disparity_slot == 0) ? left : right;
+    if(m_temporal_filter.isEnabled()) {
+      cv::Mat confidence;
+      if constexpr(Layout::confidence_slot >= 0) {
+        confidence = (Layout::confidence_slot == 0) ? left : right;
+      }
+      disparity = m_temporal_filter.apply(disparity, confidence);
+    }
+    if(m_obstacles.isEnabled() || m_obstacle_log.isOpen()) {
+      const auto &result = m_obstacles.process(disparity, image.min_disparity);
+      if(m_obstacle_log.isOpen())
+        logObstacles(image, result);
+    }
+    if(m_depth_stats.isEnabled() || m_depth_log.isOpen()) {
+      // Follows the selection of the view showing the disparity
+      const QRect roi = ((Layout::disparity_slot == 0) ? cfg.widgetLeftSensor : cfg.widgetRightSensor)->selection();
+      const auto &stats = m_depth_stats.process(disparity, cv::Rect(roi.x(), roi.y(), roi.width(), roi.height()),
+                                                image.min_disparity);
+      if(m_depth_log.isOpen())
+        logDepth(image, stats);
+    }
+  }
+
+  // Rectification is checked on every frame with matches, cheap enough to run alongside recording
+  if(!image.matches.empty() && m_rectification.process(image.matches) && m_rectification_log.isOpen()) {
+    logRectification(image, m_rectification.stats());
+  }
+
+  // Matches refer to the left keypoints, colors are taken from the left image
+  bool triangulated = false;
+  if constexpr(L == CV_8UC2) {
+    if(m_triangulator.isEnabled() && m_triangulator.isCalibrated() && !image.matches.empty()) {
+      m_triangulator.process(image.matches, left);
+      triangulated = true;
+    }
+  }
+
+  // Frames the recording scheduler skips are still displayed
+  const bool recording = isRecording() && m_recording_scheduler.admit();
+  // Raw sessions take the parts as received, ahead of any processing and without conversion
+  const bool raw = recording && m_raw_recorder->isOpen();
+  if(raw) {
+    recordRaw(image, Layout::raw);
+    // The frame with the first detection is part of the history it triggers
+    if(cfg.cbxTriggerDetect->isChecked() && !image.bboxes.empty() && m_raw_recorder->isArmed())
+      handleTrigger();
+  }
+
+  bool converted = false;
+  if(recording && !raw) {
+    // Lossy video keeps disparity and confidence colormapped only
+    const bool video = m_video_recorder->isOpen();
+    const bool colormapped = cfg.cbxRecordColormap->isChecked() || (video && !m_video_recorder->isLossless());
+    // Camera images and colormapped output are encoded from the converted frame, reuse it for display
+    if(Layout::intensity[0] || Layout::intensity[1] || colormapped) {
+      convertFrame<L, R>(left, right, m_staged.frame);
+      converted = true;
+    } else {
+      // Only 16-bit values are recorded, colorizing is left to the display tick
+      prepareFrame<L, R>(left, right, m_staged.frame);
+    }
+    if(video) {
+      recordVideo(image, m_staged.frame);
+    } else if(triangulated) {
+      recordData(image.timestamp, m_staged.frame, image.min_disparity, m_triangulator.points(),
+                 m_triangulator.colors());
+    } else {
+      recordData(image.timestamp, m_staged.frame, image.min_disparity, image.pc);
+    }
+  }
+  if(!converted) {
+    // Defer conversion to the next display tick, only the newest frame gets converted
+    left.copyTo(m_staged.left);
+    if constexpr(R != FORMAT_NONE) {
+      right.copyTo(m_staged.right);
+    } else {
+      m_staged.right.release();
+    }
+  }
+  m_staged.converted = converted;
+  m_staged.convert = &MainWindow::convertFrame<L, R>;
+  m_staged.kp_left = image.kp_left;
+  m_staged.kp_right = image.kp_right;
+  m_staged.bboxes = image.bboxes;
+  m_staged.bbox_frame = image.bbox_frame;
+  m_scheduler.submit();
+}
+
+void MainWindow::renderFrame() {
+  if(!m_staged.converted) {
+    if(m_staged.left.empty() || (m_staged.convert == nullptr))
+      return;
+    (this->*m_staged.convert)(m_staged.left, m_staged.right, m_staged.frame);
+    m_staged.converted = true;
+  }
+  // Overlays are cleared with the image, views that were skipped keep both
+  const std::pair<bool, bool> rendered = displayData(m_staged.frame);
+
+  // Keypoints and boxes only apply to views showing intensity images
+  static const bboxes_t s_no_boxes;
+  bool left_boxes = (m_staged.bbox_frame == FRAME_LEFT_ONLY) || (m_staged.bbox_frame == FRAME_LEFT_STEREO);
+  if(rendered.first && m_staged.frame.intensity[0]) {
+    annotate(cfg.widgetLeftSensor, m_staged.kp_left, left_boxes ? m_staged.bboxes : s_no_boxes);
+  }
+  if(rendered.second && m_staged.frame.intensity[1]) {
+    annotate(cfg.widgetRightSensor, m_staged.kp_right, left_boxes ? s_no_boxes : m_staged.bboxes);
+  }
+  const bool disparity_rendered = (m_staged.frame.disparity_slot == 0) ? rendered.first : rendered.second;
+  if(m_staged.frame.disparity && disparity_rendered) {
+    CameraView *view = (m_staged.frame.disparity_slot == 0) ? cfg.widgetLeftSensor : cfg.widgetRightSensor;
+    if(m_obstacles.isEnabled())
+      annotateObstacles(view);
+    if(m_depth_stats.isEnabled())
+      annotateDepth(view);
+  }
+}
+
+void MainWindow::setDisplayRate(int fps) {
+  m_scheduler.setRate(fps);
 }
 
 void MainWindow::showStatusMessage(uint32_t rcv_images){
@@ -818,16 +1699,116 @@ void MainWindow::showStatusMessage(uint32_t rcv_images){
   QString message = "GVSP/UDP Stream: " + QString::number(rcv_images * m_frameCount) + " images" +
                     "   " + QString::number(fps, 'f', 2) + " FPS" +
                     "   " + QString::number(rcv_images * payload, 'f', 2) + " Mbps" +
+                    "   Displayed: " + QString::number(m_scheduler.displayed()) +
+                    "/" + QString::number(m_scheduler.received()) +
+                    recordingStatus() + schedulerStatus() + filterTimings() + triangulationStatus() + rectificationStatus() +
                     "   Error Count: " + QString::number(m_errorCount) + last_error + warn;
   this->statusBar()->showMessage(message);
 }
 
+QString MainWindow::filterTimings() const {
+  if(!m_disparity_filter.isEnabled() && !m_temporal_filter.isEnabled())
+    return "";
+
+  const auto &timings = m_disparity_filter.timings();
+  QStringList stages;
+  if(m_temporal_filter.isEnabled())
+    stages << "Temporal " + QString::number(m_temporal_filter.timing(), 'f', 1);
+  if(m_disparity_filter.speckleEnabled())
+    stages << "Speckle " + QString::number(timings.speckle, 'f', 1);
+  if(m_disparity_filter.holeFillEnabled())
+    stages << "Holes " + QString::number(timings.holes, 'f', 1);
+  if(m_disparity_filter.medianEnabled())
+    stages << "Median " + QString::number(timings.median, 'f', 1);
+  return "   Filters: " + stages.join(" / ") + " ms";
+}
+
+QString MainWindow::triangulationStatus() const {
+  if(!m_triangulator.isEnabled())
+    return "";
+  if(!m_triangulator.isCalibrated())
+    return "   Triangulation: not calibrated";
+  return "   Triangulated: " + QString::number(m_triangulator.points().size()) + "/" +
+         QString::number(m_triangulator.matches()) + " in " + QString::number(m_triangulator.timing(), 'f', 0) + " us";
+}
+
+QString MainWindow::recordingStatus() const {
+  if(!isRecording())
+    return "";
+  if(m_raw_recorder->isOpen()) {
+    const labforge::io::RawRecorder::Stats raw = m_raw_recorder->stats();
+    if(raw.armed) {
+      return "   Pre-trigger: " + QString::number(raw.buffered_ms / 1000.0, 'f', 1) + " s in " +
+             QString::number(raw.buffered) + " frames (" +
+             QString::number(raw.buffered_bytes / (1024.0 * 1024.0), 'f', 0) + " MB)" +
+             "   Dropped: " + QString::number(raw.dropped);
+    }
+    return "   Recording: raw (" + QString(raw.backend) + ") queue " + QString::number(raw.pending) + "/" + QString::number(raw.capacity) +
+           "   Written: " + QString::number(raw.bytes / (1024.0 * 1024.0 * 1024.0), 'f', 2) + " GB" +
+           "   Dropped: " + QString::number(raw.dropped) + (raw.failed ? " (Write Error)" : "");
+  }
+  if(m_video_recorder->isOpen()) {
+    const labforge::io::VideoRecorder::Stats video = m_video_recorder->stats();
+    return "   Recording: video " + QString::number(video.streams) + " streams, queue " + QString::number(video.pending) +
+           "   Written: " + QString::number(video.written) + "   Dropped: " + QString::number(video.dropped) +
+           (video.failed ? " (Codec Error)" : "");
+  }
+  const labforge::io::DataThread::Stats stats = m_data_thread->stats();
+  QString outcomes;
+  if(stats.dropped > 0)
+    outcomes += " (oldest " + QString::number(stats.dropped_oldest) + ", newest " + QString::number(stats.dropped_newest) + ")";
+  if(stats.blocked > 0)
+    outcomes += "   Blocked: " + QString::number(stats.blocked) + " for " + QString::number(stats.blocked_ms / 1000.0, 'f', 1) + " s";
+  return "   Recording: queue " + QString::number(stats.pending) + "/" + QString::number(stats.capacity) +
+         " x " + QString::number(stats.slot_bytes / (1024.0 * 1024.0), 'f', 1) + " MB" +
+         "   Encode: " + QString::number(stats.encode_ms, 'f', 1) + " ms x" + QString::number(stats.encoders) +
+         "   Dropped: " + QString::number(stats.dropped) + outcomes;
+}
+
+/**
+ * Hours and minutes, or minutes and seconds below an hour.
+ */
+static QString s_duration(double seconds) {
+  const int total = static_cast<int>(seconds);
+  if(total >= 3600)
+    return QString("%1h %2m").arg(total / 3600).arg((total / 60) % 60, 2, 10, QChar('0'));
+  return QString("%1m %2s").arg(total / 60).arg(total % 60, 2, 10, QChar('0'));
+}
+
+QString MainWindow::schedulerStatus() const {
+  if(!m_recording_scheduler.isActive())
+    return "";
+  const labforge::io::RecordingScheduler::Stats stats = m_recording_scheduler.stats();
+  QString status = "   Disk: " + QString::number(stats.free_bytes / (1024.0 * 1024.0 * 1024.0), 'f', 1) + " GB free, " +
+                   QString::number(stats.write_mb_s, 'f', 0);
+  if(stats.probe_mb_s > 0)
+    status += "/" + QString::number(stats.probe_mb_s, 'f', 0);
+  status += " MB/s";
+  if(stats.seconds_to_full >= 0)
+    status += ", full in " + s_duration(stats.seconds_to_full);
+  if(stats.level != labforge::io::RECORD_FULL)
+    status += "   Degraded: " + QString(labforge::io::RecordingScheduler::levelName(stats.level));
+  return status;
+}
+
+QString MainWindow::rectificationStatus() const {
+  if(!m_rectification.isValid())
+    return "";
+  const labforge::proc::RectificationStats &stats = m_rectification.stats();
+  QString status = "   Vertical Offset: p95 " + QString::number(stats.spread, 'f', 1) +
+                   " px, drift " + QString::number(stats.drift, 'f', 2) + " px";
+  if(stats.degraded)
+    status += " (Check Calibration)";
+  return status;
+}
+
 void MainWindow::resetStatusCounters(){
   m_frameCount = 0;
   m_errorCount = 0;
   m_payload = 0;
   m_errorMsg = "";
   m_startTime = std::chrono::system_clock::now();
+  m_scheduler.resetCounters();
 }
 
 void MainWindow::handleError(const QString &msg){
@@ -836,98 +1817,28 @@ void MainWindow::handleError(const QString &msg){
   showStatusMessage();
 }
 
-void MainWindow::handleStereoData() {
+void MainWindow::handleData(uint32_t parts) {
   if(m_pipeline) {
     list<BNImageData> images;
-    uint16_t *raw_disparity = nullptr;
     m_pipeline->GetPairs(images);
 
     m_frameCount += images.size();
-    showStatusMessage(2);
+    showStatusMessage(parts);
 
-    // Convert and display
     for (auto const & image:images) {
-      m_payload = image.left->cols * image.left->rows * 16;
-      QImage q1;
-      QImage q2;
-      QPair<QString, QString> label;
-      bool is_disparity = false;
-
-      if((image.left->type() == CV_16UC1) && (image.right->type() == CV_16UC1)){
-        q1 = s_mono_to_qimage(image.left, cfg.cbxColormap->currentIndex(), cfg.spinMinDisparity->value(), cfg.spinMaxDisparity->value());
-        raw_disparity = (uint16_t*)image.left->data;
-        q2 = s_mono_to_qimage(image.right, cfg.cbxColormap->currentIndex(), cfg.spinMinDisparity->value(), cfg.spinMaxDisparity->value());
-
-        label.first = "Disparity";
-        label.second = "Confidence";
-        m_data_thread->setImageDataType(labforge::io::IMTYPE_DC);
-        is_disparity = true;
-      } else if((image.left->type() == CV_8UC2) && (image.right->type() == CV_16UC1)){
-        q1 = s_yuv2_to_qimage(image.left);
-        q2 = s_mono_to_qimage(image.right, cfg.cbxColormap->currentIndex(), cfg.spinMinDisparity->value(), cfg.spinMaxDisparity->value());
-        raw_disparity = (uint16_t*)image.right->data;
-        label.first = "Left";
-        label.second = "Disparity";
-        m_data_thread->setImageDataType(labforge::io::IMTYPE_LD);
-        is_disparity = true;
-      } else if((image.left->type() == CV_16UC1) && (image.right->type() == CV_8UC2)){
-        q1 = s_mono_to_qimage(image.left, cfg.cbxColormap->currentIndex(), cfg.spinMinDisparity->value(), cfg.spinMaxDisparity->value());
-        q2 = s_yuv2_to_qimage(image.right);
-        raw_disparity = (uint16_t*)image.left->data;
-        label.first = "Disparity";
-        label.second = "Right";
-        m_data_thread->setImageDataType(labforge::io::IMTYPE_DR);
-        is_disparity = true;
-      } else{
-        q1 = s_yuv2_to_qimage(image.left);
-        q2 = s_yuv2_to_qimage(image.right);
-        label.first = "Left";
-        label.second = "Right";
-        m_data_thread->setImageDataType(labforge::io::IMTYPE_LR);
-      }
-
-      newData(image.timestamp, q1, q2, label, is_disparity, raw_disparity, image.min_disparity, image.pc);
+      dispatchFrame(image);
       delete image.left;
       delete image.right;
     }
   }
 }
 
-void MainWindow::handleMonoData(){
-  if(m_pipeline){
-    list<BNImageData> images;
-    uint16_t *raw_disparity = nullptr;
-    m_pipeline->GetPairs(images);
-
-    m_frameCount += images.size();
-    showStatusMessage(1);
-
-    for (auto const& image:images) {
-      m_payload = image.left->cols * image.left->rows * 16;
-      QImage q1;
-      QImage q2;
-      QPair<QString, QString> label;
-      bool is_disparity = false;
-
-      if(image.left->type() == CV_16UC1){
-        q1 = s_mono_to_qimage(image.left, cfg.cbxColormap->currentIndex(), cfg.spinMinDisparity->value(), cfg.spinMaxDisparity->value());
-        raw_disparity = (uint16_t*)image.left->data;
-        label.first = "Disparity";
-        m_data_thread->setImageDataType(labforge::io::IMTYPE_DO);
-        is_disparity = true;
-      }
-      else{
-        q1 = s_yuv2_to_qimage(image.left);
-        label.first = "Display";
-        m_data_thread->setImageDataType(labforge::io::IMTYPE_IO);
-      }
-      label.second = "";
+void MainWindow::handleStereoData() {
+  handleData(2);
+}
 
-      newData(image.timestamp, q1, q2, label, is_disparity, raw_disparity, image.min_disparity, image.pc);
-      delete image.left;
-      delete image.right;
-    }
-  }
+void MainWindow::handleMonoData(){
+  handleData(1);
 }
 
 void MainWindow::setRuler(int value) {